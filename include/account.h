@@ -23,6 +23,8 @@ typedef Anope::hash_map<NickCore *> nickcore_map;
 typedef TR1NS::unordered_map<uint64_t, NickCore *> nickcoreid_map;
 
 extern CoreExport Serialize::Checker<nickalias_map> NickAliasList;
+/* Every nick in NickAliasList, in order, so they can be listed a page at a time */
+extern CoreExport Anope::map<NickAlias *> SortedNickAliasList;
 extern CoreExport Serialize::Checker<nickcore_map> NickCoreList;
 extern CoreExport nickcoreid_map NickCoreIdList;
 
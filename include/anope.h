@@ -336,6 +336,165 @@ namespace Anope
 	template<typename T> class multimap : public std::multimap<string, T, ci::less> { };
 	template<typename T> class hash_map : public TR1NS::unordered_map<string, T, hash_ci, compare> { };
 
+	/** A map from IRCd IDs (UIDs and SIDs) to objects. IDs of up to ten letters and digits,
+	 * which covers the IDs of every supported IRCd, are packed into an integer and kept in
+	 * an open addressing table, so looking them up neither hashes a string nor allocates.
+	 * Any other keys are kept in a hash_map. Keys are case insensitive, like the hash_map
+	 * this replaces. T must be a pointer type.
+	 */
+	template<typename T> class IDMap
+	{
+		struct Slot
+		{
+			uint64_t key;
+			T value;
+
+			Slot() : key(0), value(NULL) { }
+		};
+
+		std::vector<Slot> slots;
+		size_t count;
+		hash_map<T> others;
+
+		/* Packs id into a non zero integer: its length followed by six bits per character, or 0 if it can not be packed */
+		static uint64_t Pack(const string &id)
+		{
+			if (id.empty() || id.length() > 10)
+				return 0;
+
+			uint64_t key = id.length();
+			for (size_t i = 0; i < id.length(); ++i)
+			{
+				char c = id[i];
+				unsigned v;
+				if (c >= '0' && c <= '9')
+					v = c - '0';
+				else if (c >= 'A' && c <= 'Z')
+					v = c - 'A' + 10;
+				else if (c >= 'a' && c <= 'z')
+					v = c - 'a' + 10;
+				else
+					return 0;
+				key = (key << 6) | v;
+			}
+			return key;
+		}
+
+		static size_t Hash(uint64_t key)
+		{
+			key ^= key >> 31;
+			key *= 0x7fb5d329728ea185ULL;
+			key ^= key >> 27;
+			return static_cast<size_t>(key);
+		}
+
+		/* Returns the slot holding key, or the empty slot it would go in */
+		size_t Locate(uint64_t key) const
+		{
+			size_t mask = this->slots.size() - 1, i = Hash(key) & mask;
+			while (this->slots[i].key && this->slots[i].key != key)
+				i = (i + 1) & mask;
+			return i;
+		}
+
+		void Grow()
+		{
+			std::vector<Slot> old;
+			old.swap(this->slots);
+			this->slots.resize(old.empty() ? 64 : old.size() * 2);
+
+			for (size_t i = 0; i < old.size(); ++i)
+				if (old[i].key)
+					this->slots[this->Locate(old[i].key)] = old[i];
+		}
+
+	 public:
+		IDMap() : count(0) { }
+
+		/** Finds the object with the given id
+		 * @return The object, or NULL if there is none
+		 */
+		T Find(const string &id) const
+		{
+			uint64_t key = Pack(id);
+			if (!key)
+			{
+				typename hash_map<T>::const_iterator it = this->others.find(id);
+				return it != this->others.end() ? it->second : NULL;
+			}
+
+			if (this->slots.empty())
+				return NULL;
+			return this->slots[this->Locate(key)].value;
+		}
+
+		/** Sets the object with the given id, replacing any existing one */
+		void Insert(const string &id, T value)
+		{
+			uint64_t key = Pack(id);
+			if (!key)
+			{
+				this->others[id] = value;
+				return;
+			}
+
+			/* Keep the table at most three quarters full */
+			if ((this->count + 1) * 4 > this->slots.size() * 3)
+				this->Grow();
+
+			Slot &slot = this->slots[this->Locate(key)];
+			if (!slot.key)
+				++this->count;
+			slot.key = key;
+			slot.value = value;
+		}
+
+		void Erase(const string &id)
+		{
+			uint64_t key = Pack(id);
+			if (!key)
+			{
+				this->others.erase(id);
+				return;
+			}
+
+			if (this->slots.empty())
+				return;
+
+			size_t mask = this->slots.size() - 1, i = this->Locate(key);
+			if (!this->slots[i].key)
+				return;
+			--this->count;
+
+			/* Shift back the slots after this one which would no longer be found past the gap */
+			for (size_t j = (i + 1) & mask; this->slots[j].key; j = (j + 1) & mask)
+			{
+				size_t k = Hash(this->slots[j].key) & mask;
+				if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+					continue;
+				this->slots[i] = this->slots[j];
+				i = j;
+			}
+
+			this->slots[i] = Slot();
+		}
+
+		size_t Size() const { return this->count + this->others.size(); }
+		bool Empty() const { return !this->Size(); }
+		/* Number of slots in the table */
+		size_t Capacity() const { return this->slots.size(); }
+
+		/* The longest distance between a packed id's slot and the slot it hashes to */
+		size_t LongestProbe() const
+		{
+			size_t longest = 0, mask = this->slots.size() - 1;
+			for (size_t i = 0; i < this->slots.size(); ++i)
+				if (this->slots[i].key)
+					longest = std::max(longest, (i - Hash(this->slots[i].key)) & mask);
+			return longest;
+		}
+	};
+
 #ifndef REPRODUCIBLE_BUILD
 	static const char *const compiled = __TIME__ " " __DATE__;
 #endif
@@ -36,9 +36,33 @@ class CoreExport Channel : public Base, public Extensible
  public:
 	typedef std::multimap<Anope::string, Anope::string> ModeList;
  private:
-	/** A map of channel modes with their parameters set on this channel
+	/** Entries of a single list mode (eg bans), kept in the order they were set
+	 * and indexed case insensitively
 	 */
-	ModeList modes;
+	struct ListModeEntries
+	{
+		typedef std::list<Anope::string> list;
+		list entries;
+		Anope::hash_map<list::iterator> index;
+	};
+
+	/** Regular and param modes set on this channel, indexed by ChannelMode::id
+	 */
+	std::vector<bool> modes;
+	/** Parameters of the param modes set on this channel. Channels only ever
+	 * have a handful of these so a linear search is cheaper than a map
+	 */
+	std::vector<std::pair<unsigned, Anope::string> > mode_params;
+	/** Entries of the list modes set on this channel, keyed by ChannelMode::id
+	 */
+	std::map<unsigned, ListModeEntries> list_modes;
+	/** Cached ModeList view returned by GetModes(), rebuilt when modes change
+	 */
+	mutable ModeList modes_view;
+	mutable bool modes_view_dirty;
+
+	const Anope::string *FindModeParam(unsigned id) const;
+	size_t HasModeID(unsigned id, const Anope::string &param) const;
 
  public:
 	/* Channel name */
@@ -136,6 +160,13 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	bool HasUserStatus(User *u, const Anope::string &name);
 
+	/** Check if a user has a status on a channel
+	 * @param u The user
+	 * @param id The mode ID, eg CMODE_OP, CMODE_VOICE
+	 * @return true or false
+	 */
+	bool HasUserStatus(User *u, ChannelModeID id);
+
 	/** See if a channel has a mode
 	 * @param name The mode name
 	 * @return The number of modes set
@@ -143,6 +174,12 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	size_t HasMode(const Anope::string &name, const Anope::string &param = "");
 
+	/** See if a channel has a mode
+	 * @param id The mode ID, eg CMODE_PERM
+	 * @return The number of modes set
+	 */
+	size_t HasMode(ChannelModeID id);
+
 	/** Set a mode internally on a channel, this is not sent out to the IRCd
 	 * @param setter The setter
 	 * @param cm The mode
@@ -16,6 +16,7 @@
 #include "regchannel.h"
 #include "users.h"
 #include "opertype.h"
+#include "regexpr.h"
 #include <stack>
 
 namespace Configuration
@@ -67,6 +68,42 @@ namespace Configuration
 	template<> CoreExport time_t Block::Get(const Anope::string &tag, const Anope::string &def) const;
 	template<> CoreExport bool Block::Get(const Anope::string &tag, const Anope::string &def) const;
 
+	/** A typed setting in a configuration block. The value is looked up and
+	 * converted once when Load() is called, usually from the module's OnReload,
+	 * so reading it on hot paths does not go through the block's item map.
+	 */
+	template<typename T> class Setting
+	{
+		Anope::string tag;
+		Anope::string def;
+		T value;
+
+	 public:
+		/** Constructor
+		 * @param t The name of the setting
+		 * @param d The default value, used if the setting is missing
+		 */
+		Setting(const Anope::string &t, const Anope::string &d = "") : tag(t), def(d), value() { }
+
+		/** (Re)load this setting
+		 * @param block The block to read it from, may be NULL
+		 */
+		void Load(const Block *block)
+		{
+			static const Block empty("");
+			this->value = (block ? block : &empty)->Get<T>(this->tag, this->def);
+		}
+
+		inline const T &operator*() const { return this->value; }
+		inline const T *operator->() const { return &this->value; }
+		inline operator const T &() const { return this->value; }
+	};
+
+	template<> inline void Setting<Anope::string>::Load(const Block *block)
+	{
+		this->value = block ? block->Get<const Anope::string>(this->tag, this->def) : this->def;
+	}
+
 	/** Represents a configuration file
 	 */
 	class File
@@ -103,8 +140,16 @@ namespace Configuration
 		time_t TimeoutCheck;
 		/* options:usestrictprivmsg */
 		bool UseStrictPrivmsg;
+		/* options:outputlines, lines of replies to send to all users per second */
+		unsigned OutputLines;
+		/* options:outputbytes, bytes of replies to send to all users per second */
+		unsigned OutputBytes;
+		/* options:targetlines, lines of replies to send to one user per second */
+		unsigned TargetLines;
 		/* networkinfo:nickchars */
 		Anope::string NickChars;
+		/* options:regexengine, the provider used to compile the regexes given to Anope::Match */
+		ServiceReference<RegexProvider> RegexEngine;
 
 		/* either "/msg " or "/" */
 		Anope::string StrictPrivmsg;
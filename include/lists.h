@@ -77,6 +77,18 @@ class CoreExport ListFormatter
 	void Process(std::vector<Anope::string> &);
 };
 
+/** Where a paged LIST reply stopped. This is kept on the user so that
+ * "LIST pattern NEXT" can continue from the next entry.
+ */
+struct ListCursor
+{
+	/* The pattern and options the list was made with */
+	Anope::string pattern;
+	Anope::string options;
+	/* The name of the last entry shown */
+	Anope::string last;
+};
+
 /** This class handles formatting INFO replies
  */
 class CoreExport InfoFormatter
@@ -91,4 +103,288 @@ class CoreExport InfoFormatter
 	void AddOption(const Anope::string &opt);
 };
 
+/** A set of masks, each with a value, which can quickly find the masks matching a string.
+ * Masks are matched like Anope::Match(str, mask, false, use_regex) would. Masks without
+ * wildcards are looked up by hash, masks beginning or ending with literal text are
+ * looked up by the prefixes or suffixes of the string, and only the rest (regular
+ * expressions and masks such as "*!*@*") are tried one by one.
+ * Values must be unique and are usually pointers to the object owning the mask.
+ */
+template<typename T> class MaskSet
+{
+	enum ItemType
+	{
+		MASK_EXACT,
+		MASK_PREFIX,
+		MASK_SUFFIX,
+		MASK_OTHER
+	};
+
+	struct Item
+	{
+		Anope::string mask;
+		T value;
+		/* When this item was added, matches are returned in this order */
+		unsigned long seq;
+		ItemType type;
+		/* Lowercased literal text this item is bucketed by */
+		Anope::string key;
+	};
+
+	typedef TR1NS::unordered_map<Anope::string, std::vector<Item *>, Anope::hash_cs> bucket_map;
+
+	bool use_regex;
+	unsigned long seq;
+	std::map<T, Item *> items;
+	bucket_map buckets[MASK_OTHER];
+	/* Number of prefix and suffix items by key length, so only lengths in use are looked up */
+	std::map<size_t, unsigned> lengths[MASK_OTHER];
+	std::vector<Item *> others;
+
+	static bool SeqLess(const Item *a, const Item *b)
+	{
+		return a->seq < b->seq;
+	}
+
+	/* Lists are kept ordered by seq, so lookups for only the newest or oldest match can stop early */
+	static void Insert(std::vector<Item *> &list, Item *item)
+	{
+		list.insert(std::upper_bound(list.begin(), list.end(), item, SeqLess), item);
+	}
+
+	void Index(Item *item)
+	{
+		const Anope::string &mask = item->mask;
+		size_t first = mask.find_first_of("*?"), last = mask.find_last_of("*?");
+
+		if (this->use_regex && mask.length() >= 2 && mask[0] == '/' && mask[mask.length() - 1] == '/')
+			item->type = MASK_OTHER;
+		else if (first == Anope::string::npos)
+		{
+			item->type = MASK_EXACT;
+			item->key = mask.lower();
+		}
+		else if (first > 0 && first >= mask.length() - last - 1)
+		{
+			item->type = MASK_PREFIX;
+			item->key = mask.substr(0, first).lower();
+		}
+		else if (last + 1 < mask.length())
+		{
+			item->type = MASK_SUFFIX;
+			item->key = mask.substr(last + 1).lower();
+		}
+		else
+			item->type = MASK_OTHER;
+
+		if (item->type == MASK_OTHER)
+			Insert(this->others, item);
+		else
+		{
+			Insert(this->buckets[item->type][item->key], item);
+			++this->lengths[item->type][item->key.length()];
+		}
+	}
+
+	void Unindex(Item *item)
+	{
+		std::vector<Item *> *list = &this->others;
+		if (item->type != MASK_OTHER)
+		{
+			typename bucket_map::iterator it = this->buckets[item->type].find(item->key);
+			if (it == this->buckets[item->type].end())
+				return;
+			list = &it->second;
+		}
+
+		typename std::vector<Item *>::iterator it = std::find(list->begin(), list->end(), item);
+		if (it != list->end())
+			list->erase(it);
+
+		if (item->type != MASK_OTHER)
+		{
+			if (list->empty())
+				this->buckets[item->type].erase(item->key);
+			if (--this->lengths[item->type][item->key.length()] == 0)
+				this->lengths[item->type].erase(item->key.length());
+		}
+	}
+
+	/* Adds the matches of str in list to found. If order is positive only the newest match
+	 * is kept in found, if it is negative only the oldest.
+	 */
+	void Check(const std::vector<Item *> &list, const Anope::string &str, std::map<unsigned long, T> &found, int order) const
+	{
+		if (order > 0)
+		{
+			for (unsigned i = list.size(); i > 0 && (found.empty() || list[i - 1]->seq > found.rbegin()->first); --i)
+				if (Anope::Match(str, list[i - 1]->mask, false, this->use_regex))
+				{
+					found.clear();
+					found[list[i - 1]->seq] = list[i - 1]->value;
+					break;
+				}
+		}
+		else if (order < 0)
+		{
+			for (unsigned i = 0; i < list.size() && (found.empty() || list[i]->seq < found.begin()->first); ++i)
+				if (Anope::Match(str, list[i]->mask, false, this->use_regex))
+				{
+					found.clear();
+					found[list[i]->seq] = list[i]->value;
+					break;
+				}
+		}
+		else
+		{
+			for (unsigned i = 0; i < list.size(); ++i)
+				if (!found.count(list[i]->seq) && Anope::Match(str, list[i]->mask, false, this->use_regex))
+					found[list[i]->seq] = list[i]->value;
+		}
+	}
+
+	void Collect(const Anope::string &str, std::map<unsigned long, T> &found, int order) const
+	{
+		const Anope::string lstr = str.lower();
+
+		typename bucket_map::const_iterator it = this->buckets[MASK_EXACT].find(lstr);
+		if (it != this->buckets[MASK_EXACT].end())
+			this->Check(it->second, str, found, order);
+
+		for (std::map<size_t, unsigned>::const_iterator lit = this->lengths[MASK_PREFIX].begin(); lit != this->lengths[MASK_PREFIX].end() && lit->first <= lstr.length(); ++lit)
+		{
+			it = this->buckets[MASK_PREFIX].find(lstr.substr(0, lit->first));
+			if (it != this->buckets[MASK_PREFIX].end())
+				this->Check(it->second, str, found, order);
+		}
+
+		for (std::map<size_t, unsigned>::const_iterator lit = this->lengths[MASK_SUFFIX].begin(); lit != this->lengths[MASK_SUFFIX].end() && lit->first <= lstr.length(); ++lit)
+		{
+			it = this->buckets[MASK_SUFFIX].find(lstr.substr(lstr.length() - lit->first));
+			if (it != this->buckets[MASK_SUFFIX].end())
+				this->Check(it->second, str, found, order);
+		}
+
+		this->Check(this->others, str, found, order);
+	}
+
+	bool FindOne(const Anope::string &str, T &value, int order) const
+	{
+		std::map<unsigned long, T> found;
+		this->Collect(str, found, order);
+		if (found.empty())
+			return false;
+		value = found.begin()->second;
+		return true;
+	}
+
+ public:
+	/** Constructor
+	 * @param regex Whether masks enclosed in slashes are regular expressions
+	 */
+	MaskSet(bool regex = true) : use_regex(regex), seq(0) { }
+
+	~MaskSet()
+	{
+		this->Clear();
+	}
+
+	/** Adds a mask, or changes the mask of a value which is already in the set.
+	 * A value keeps its place in the order of matches when its mask is changed.
+	 * @param mask The mask
+	 * @param value The value
+	 * @return true if the value was not in the set before
+	 */
+	bool Add(const Anope::string &mask, const T &value)
+	{
+		typename std::map<T, Item *>::iterator it = this->items.find(value);
+		if (it != this->items.end())
+		{
+			Item *item = it->second;
+			if (item->mask != mask)
+			{
+				this->Unindex(item);
+				item->mask = mask;
+				this->Index(item);
+			}
+			return false;
+		}
+
+		Item *item = new Item();
+		item->mask = mask;
+		item->value = value;
+		item->seq = this->seq++;
+		this->items[value] = item;
+		this->Index(item);
+		return true;
+	}
+
+	/** Removes a value
+	 * @return true if the value was in the set
+	 */
+	bool Remove(const T &value)
+	{
+		typename std::map<T, Item *>::iterator it = this->items.find(value);
+		if (it == this->items.end())
+			return false;
+
+		this->Unindex(it->second);
+		delete it->second;
+		this->items.erase(it);
+		return true;
+	}
+
+	void Clear()
+	{
+		for (typename std::map<T, Item *>::iterator it = this->items.begin(), it_end = this->items.end(); it != it_end; ++it)
+			delete it->second;
+		this->items.clear();
+		for (unsigned i = 0; i < MASK_OTHER; ++i)
+		{
+			this->buckets[i].clear();
+			this->lengths[i].clear();
+		}
+		this->others.clear();
+	}
+
+	/** Finds the values of all masks matching any of the given strings
+	 * @param strs The strings to match
+	 * @param matches Filled with the matching values, in the order they were added
+	 */
+	void Find(const std::vector<Anope::string> &strs, std::vector<T> &matches) const
+	{
+		std::map<unsigned long, T> found;
+		for (unsigned i = 0; i < strs.size(); ++i)
+			this->Collect(strs[i], found, 0);
+
+		for (typename std::map<unsigned long, T>::const_iterator it = found.begin(), it_end = found.end(); it != it_end; ++it)
+			matches.push_back(it->second);
+	}
+
+	/** Finds the values of all masks matching a string
+	 * @param str The string to match
+	 * @param matches Filled with the matching values, in the order they were added
+	 */
+	void Find(const Anope::string &str, std::vector<T> &matches) const
+	{
+		this->Find(std::vector<Anope::string>(1, str), matches);
+	}
+
+	/** Finds the value of the most recently added mask matching a string
+	 * @return true if a mask matched, in which case value is set
+	 */
+	bool FindNewest(const Anope::string &str, T &value) const
+	{
+		return this->FindOne(str, value, 1);
+	}
+
+	/** Finds the value of the first added mask matching a string
+	 * @return true if a mask matched, in which case value is set
+	 */
+	bool FindOldest(const Anope::string &str, T &value) const
+	{
+		return this->FindOne(str, value, -1);
+	}
+};
+
 #endif // LISTS_H
@@ -22,21 +22,48 @@ namespace Mail
 	extern CoreExport bool Send(NickCore *to, const Anope::string &subject, const Anope::string &message);
 	extern CoreExport bool Validate(const Anope::string &email);
 
+	/** Stop sending mail, called on shutdown. Mail not sent yet is lost.
+	 */
+	extern void Shutdown();
+
+	/** Counters of the mail queue */
+	struct Counters
+	{
+		/* Messages waiting to be sent, and waiting to be retried */
+		unsigned long queued, retrying;
+		/* Messages sent, given up on, retried, and refused because the queue was full */
+		unsigned long long sent, failed, retried, dropped;
+
+		Counters() : queued(0), retrying(0), sent(0), failed(0), retried(0), dropped(0) { }
+	};
+
+	extern CoreExport Counters GetStats();
+
 	/* A email message being sent */
-	class Message : public Thread
+	class Message
 	{
-	 private:
+	 public:
 		Anope::string sendmail_path;
+		Anope::string smtp_server;
+		unsigned smtp_port;
+		Anope::string helo;
 		Anope::string send_from;
 		Anope::string mail_to;
 		Anope::string addr;
 		Anope::string subject;
 		Anope::string message;
 		bool dont_quote_addresses;
+		/* The Date and Message-ID headers. They are set when the message is created, so every attempt to send it sends the same ones */
+		Anope::string date;
+		Anope::string message_id;
 
-		bool success;
-	 public:
-		/** Construct this message. Once constructed call Thread::Start to launch the mail sending.
+		/* How many times sending this failed */
+		unsigned attempts;
+		/* Why sending this failed the last time, and whether trying again is pointless */
+		Anope::string error;
+		bool permanent;
+
+		/** Construct this message. Once constructed it is queued by Mail::Send.
 		 * @param sf Config->SendFrom
 		 * @param mailto Name of person being mailed (u->nick, nc->display, etc)
 		 * @param addr Destination address to mail
@@ -45,10 +72,8 @@ namespace Mail
 		 */
 		Message(const Anope::string &sf, const Anope::string &mailto, const Anope::string &addr, const Anope::string &subject, const Anope::string &message);
 
-		~Message();
-
-		/* Called from within the thread to actually send the mail */
-		void Run() anope_override;
+		/* Called from within a sender thread to send the mail by running sendmailpath */
+		bool Sendmail();
 	};
 
 } // namespace Mail
@@ -26,6 +26,31 @@ enum ModeType
 	MODE_STATUS
 };
 
+/* IDs of the channel modes the core refers to by name. The ModeManager gives
+ * these names their IDs before any mode is added, so they are constant.
+ */
+enum ChannelModeID
+{
+	CMODE_BAN,
+	CMODE_EXCEPT,
+	CMODE_INVITEOVERRIDE,
+	CMODE_LBAN,
+	CMODE_PERM,
+	CMODE_VOICE,
+	CMODE_OP
+};
+
+/* IDs of the user modes the core refers to by name
+ */
+enum UserModeID
+{
+	UMODE_OPER,
+	UMODE_CLOAK,
+	UMODE_VHOST,
+	UMODE_PROTECTED,
+	UMODE_GOD
+};
+
 /* Classes of modes, Channel modes and User modes
  */
 enum ModeClass
@@ -47,6 +72,11 @@ class CoreExport Mode : public Base
 	char mchar;
 	/* Type of mode this is, eg MODE_LIST */
 	ModeType type;
+	/* Numeric ID of this mode, assigned by the ModeManager when the mode is added.
+	 * Mode names always map to the same ID, even across the mode being removed and
+	 * added again, so users and channels can store their modes by ID.
+	 */
+	unsigned id;
 
 	/** constructor
 	 * @param mname The mode name
@@ -301,6 +331,9 @@ class CoreExport ModeManager
 	static unsigned GenericChannelModes;
 	static unsigned GenericUserModes;
 
+	/* Returned by GetChannelModeID and GetUserModeID for unknown modes */
+	static const unsigned NO_MODE_ID = static_cast<unsigned>(-1);
+
 	/** Add a user mode to Anope
 	 * @param um A UserMode or UserMode derived class
 	 * @return true on success, false on error
@@ -347,6 +380,44 @@ class CoreExport ModeManager
 	 */
 	static UserMode *FindUserModeByName(const Anope::string &name);
 
+	/** Get the numeric ID of a channel mode name
+	 * @param name The mode name
+	 * @param create If true, assign an ID to the name if it does not have one yet
+	 * @return The ID, or NO_MODE_ID if the name has never been given an ID
+	 */
+	static unsigned GetChannelModeID(const Anope::string &name, bool create = false);
+
+	/** Get the name a channel mode ID was assigned to
+	 * @param id The mode ID
+	 * @return The mode name
+	 */
+	static const Anope::string &GetChannelModeName(unsigned id);
+
+	/** Find a channel mode by its ID
+	 * @param id The mode ID
+	 * @return The mode class, or NULL if no mode with this ID is currently loaded
+	 */
+	static ChannelMode *FindChannelModeByID(unsigned id);
+
+	/** Get the numeric ID of a user mode name
+	 * @param name The mode name
+	 * @param create If true, assign an ID to the name if it does not have one yet
+	 * @return The ID, or NO_MODE_ID if the name has never been given an ID
+	 */
+	static unsigned GetUserModeID(const Anope::string &name, bool create = false);
+
+	/** Get the name a user mode ID was assigned to
+	 * @param id The mode ID
+	 * @return The mode name
+	 */
+	static const Anope::string &GetUserModeName(unsigned id);
+
+	/** Find a user mode by its ID
+	 * @param id The mode ID
+	 * @return The mode class, or NULL if no mode with this ID is currently loaded
+	 */
+	static UserMode *FindUserModeByID(unsigned id);
+
 	/** Gets the channel mode char for a symbol (eg + returns v)
 	 * @param symbol The symbol
 	 * @return The char
@@ -0,0 +1,184 @@
+/*
+ *
+ * (C) 2003-2020 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include "modules/encryption.h"
+
+#ifndef _WIN32
+# include <sys/time.h>
+#endif
+
+namespace ExternalAuth
+{
+	/* Upper bounds of the latency buckets, in milliseconds. Slower lookups go in the last bucket */
+	static const unsigned LatencyLimits[] = { 10, 50, 100, 500, 1000, 5000 };
+	static const unsigned LatencyBuckets = sizeof(LatencyLimits) / sizeof(*LatencyLimits) + 1;
+
+	struct Stats
+	{
+		/* Lookups sent to the backend, and how long they took */
+		unsigned long long lookups, latency[LatencyBuckets];
+		/* Attempts answered from the cache, and attempts which waited on a lookup already in progress */
+		unsigned long long cache_hits, coalesced;
+
+		Stats() : lookups(0), cache_hits(0), coalesced(0)
+		{
+			for (unsigned i = 0; i < LatencyBuckets; ++i)
+				latency[i] = 0;
+		}
+	};
+
+	/** Credentials recently verified by an external authentication backend, and lookups
+	 * in progress. Credentials are only kept as a salted SHA256 hash of the account and
+	 * password, so nothing is cached unless enc_sha256 is loaded.
+	 */
+	class Cache : public Service
+	{
+		/* Verified credentials and when they expire */
+		std::map<Anope::string, time_t> verified;
+		/* Lookups in progress, when they started, and the requests waiting on them */
+		struct Lookup
+		{
+			/* Tells this lookup apart from an earlier one with the same key which was given up on */
+			unsigned long long id;
+			struct timeval started;
+			/* Whether the key is a hash, rather than the password itself */
+			bool hashed;
+			std::vector<IdentifyRequest *> waiting;
+		};
+		std::map<Anope::string, Lookup> pending;
+		unsigned long long next_id;
+		Anope::string salt;
+		time_t last_purge;
+		ServiceReference<Encryption::Provider> sha256;
+
+		Anope::string GetKey(IdentifyRequest *req)
+		{
+			const Anope::string account = req->GetAccount().lower();
+			if (!this->sha256)
+				return account + "\n" + req->GetPassword();
+
+			const Anope::string data = this->salt + account + "\n" + req->GetPassword();
+			Encryption::Context *context = this->sha256->CreateContext();
+			context->Update(reinterpret_cast<const unsigned char *>(data.c_str()), data.length());
+			context->Finalize();
+			Encryption::Hash hash = context->GetFinalizedHash();
+			Anope::string key = account + "\n" + Anope::Hex(reinterpret_cast<const char *>(hash.first), hash.second);
+			delete context;
+			return key;
+		}
+
+	 public:
+		/* How long verified credentials are kept, 0 to not keep them */
+		time_t ttl;
+		Stats stats;
+
+		Cache(Module *o, const Anope::string &n) : Service(o, "ExternalAuth::Cache", n), next_id(0), salt(Anope::Random(32)), last_purge(0), sha256("Encryption::Provider", "sha256"), ttl(0)
+		{
+		}
+
+		/** Check a request against the cache and the lookups in progress
+		 * @param req The request
+		 * @param key Set to the key to pass to Finish once the lookup is done
+		 * @param id Set to the id of the lookup to pass to Finish
+		 * @return true if the request was handled, false if the caller must look it up
+		 */
+		bool Check(IdentifyRequest *req, Anope::string &key, unsigned long long &id)
+		{
+			if (this->ttl && Anope::CurTime - this->last_purge >= this->ttl)
+			{
+				for (std::map<Anope::string, time_t>::iterator it = this->verified.begin(), it_end = this->verified.end(); it != it_end;)
+				{
+					if (it->second <= Anope::CurTime)
+						this->verified.erase(it++);
+					else
+						++it;
+				}
+				this->last_purge = Anope::CurTime;
+			}
+
+			key = this->GetKey(req);
+
+			std::map<Anope::string, time_t>::iterator it = this->verified.find(key);
+			/* The account may have been dropped since, in which case it must be recreated by a lookup */
+			if (it != this->verified.end() && it->second > Anope::CurTime && NickAlias::Find(req->GetAccount()))
+			{
+				++this->stats.cache_hits;
+				req->Success(this->owner);
+				return true;
+			}
+
+			std::map<Anope::string, Lookup>::iterator pit = this->pending.find(key);
+			/* A lookup which never got an answer, for example as the backend was unloaded, is given up on */
+			if (pit != this->pending.end() && pit->second.started.tv_sec + 60 < Anope::CurTime)
+			{
+				this->Finish(key, pit->second.id, false);
+				pit = this->pending.end();
+			}
+			if (pit != this->pending.end())
+			{
+				++this->stats.coalesced;
+				req->Hold(this->owner);
+				pit->second.waiting.push_back(req);
+				return true;
+			}
+
+			Lookup &l = this->pending[key];
+			l.id = id = ++this->next_id;
+			gettimeofday(&l.started, NULL);
+			l.hashed = this->sha256;
+			++this->stats.lookups;
+			return false;
+		}
+
+		/** Finish a lookup started by Check
+		 * @param key The key from Check
+		 * @param id The id from Check
+		 * @param success Whether the credentials were accepted
+		 */
+		void Finish(const Anope::string &key, unsigned long long id, bool success)
+		{
+			std::map<Anope::string, Lookup>::iterator it = this->pending.find(key);
+			/* The lookup may have been given up on, and another one started for the key since */
+			if (it == this->pending.end() || it->second.id != id)
+				return;
+
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			long long ms = (now.tv_sec - it->second.started.tv_sec) * 1000LL + (now.tv_usec - it->second.started.tv_usec) / 1000;
+			unsigned bucket = 0;
+			while (bucket < LatencyBuckets - 1 && ms >= static_cast<long long>(LatencyLimits[bucket]))
+				++bucket;
+			++this->stats.latency[bucket];
+
+			if (success && this->ttl && it->second.hashed)
+				this->verified[key] = Anope::CurTime + this->ttl;
+
+			std::vector<IdentifyRequest *> waiting;
+			waiting.swap(it->second.waiting);
+			this->pending.erase(it);
+
+			for (unsigned i = 0; i < waiting.size(); ++i)
+			{
+				if (success)
+					waiting[i]->Success(this->owner);
+				waiting[i]->Release(this->owner);
+			}
+		}
+
+		/** Forget every verified credential */
+		void Clear()
+		{
+			this->verified.clear();
+		}
+	};
+}
+
+#endif // AUTH_CACHE_H
@@ -110,6 +110,27 @@ struct LDAPResult
 	}
 };
 
+/** Counters of an LDAP provider. Latencies are in milliseconds, and include the time
+ * a request waited for a connection.
+ */
+struct LDAPStats
+{
+	/* Connections in the pool, and how many of them are up */
+	unsigned connections, connected;
+	/* Requests waiting for a connection, and requests taken by one and not yet answered */
+	unsigned long queued, active;
+	/* Connections made again after one was lost */
+	unsigned long long reconnects;
+	/* Requests answered of each type, how many of them failed, and their total and longest latency */
+	unsigned long long requests[QUERY_MODIFY + 1], errors[QUERY_MODIFY + 1], total_ms[QUERY_MODIFY + 1], max_ms[QUERY_MODIFY + 1];
+
+	LDAPStats() : connections(0), connected(0), queued(0), active(0), reconnects(0)
+	{
+		for (int i = 0; i <= QUERY_MODIFY; ++i)
+			requests[i] = errors[i] = total_ms[i] = max_ms[i] = 0;
+	}
+};
+
 class LDAPInterface
 {
  public:
@@ -166,6 +187,10 @@ class LDAPProvider : public Service
 	 * @param attributes The attributes to modify
 	 */
 	virtual void Modify(LDAPInterface *i, const Anope::string &base, LDAPMods &attributes) = 0;
+
+	/** Get the connection and latency counters of this provider, if it keeps any
+	 */
+	virtual LDAPStats GetStats() { return LDAPStats(); }
 };
 
 #endif // ANOPE_LDAP_H
@@ -9,13 +9,69 @@
 #ifndef OS_SESSION_H
 #define OS_SESSION_H
 
+/* The address of a session: the family followed by the address masked to the session
+ * CIDR length, so sessions can be hashed and compared without building a cidr.
+ */
+struct SessionKey
+{
+	uint8_t family;
+	uint8_t len;
+	uint8_t bytes[16];
+
+	SessionKey(const sockaddrs &ip, unsigned l) : family(0), len(0)
+	{
+		memset(this->bytes, 0, sizeof(this->bytes));
+
+		const uint8_t *addr;
+		unsigned size;
+		if (ip.sa.sa_family == AF_INET)
+		{
+			addr = reinterpret_cast<const uint8_t *>(&ip.sa4.sin_addr);
+			size = 4;
+		}
+		else if (ip.sa.sa_family == AF_INET6)
+		{
+			addr = reinterpret_cast<const uint8_t *>(&ip.sa6.sin6_addr);
+			size = 16;
+		}
+		else
+			return;
+
+		this->family = ip.sa.sa_family == AF_INET ? 4 : 6;
+		this->len = std::min(l, size * 8);
+		memcpy(this->bytes, addr, this->len / 8);
+		if (this->len % 8)
+			this->bytes[this->len / 8] = addr[this->len / 8] & (0xFF << (8 - this->len % 8));
+	}
+
+	bool valid() const { return this->family != 0; }
+
+	bool operator==(const SessionKey &other) const
+	{
+		return this->family == other.family && this->len == other.len && !memcmp(this->bytes, other.bytes, sizeof(this->bytes));
+	}
+
+	struct hash
+	{
+		size_t operator()(const SessionKey &k) const
+		{
+			/* FNV-1a */
+			size_t h = 2166136261U ^ k.family;
+			for (unsigned i = 0; i < sizeof(k.bytes); ++i)
+				h = (h ^ k.bytes[i]) * 16777619U;
+			return h;
+		}
+	};
+};
+
 struct Session
 {
 	cidr addr;                      /* A cidr (sockaddrs + len) representing this session */
+	SessionKey key;                 /* The key of this session in the session map */
 	unsigned count;                 /* Number of clients with this host */
 	unsigned hits;                  /* Number of subsequent kills for a host */
 
-	Session(const sockaddrs &ip, int len) : addr(ip, len), count(1), hits(0) { }
+	Session(const sockaddrs &ip, int len) : addr(ip, len), key(ip, len), count(1), hits(0) { }
 };
 
 struct Exception : Serializable
@@ -28,6 +84,7 @@ struct Exception : Serializable
 	time_t expires;			/* Time when it expires. 0 == no expiry */
 
 	Exception() : Serializable("Exception") { }
+	~Exception();
 	void Serialize(Serialize::Data &data) const anope_override;
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &data);
 };
@@ -35,7 +92,7 @@ struct Exception : Serializable
 class SessionService : public Service
 {
  public:
-	typedef TR1NS::unordered_map<cidr, Session *, cidr::hash> SessionMap;
+	typedef TR1NS::unordered_map<SessionKey, Session *, SessionKey::hash> SessionMap;
 	typedef std::vector<Exception *> ExceptionVector;
 
 	SessionService(Module *m) : Service(m, "SessionService", "session") { }
@@ -59,6 +116,12 @@ class SessionService : public Service
 
 static ServiceReference<SessionService> session_service("SessionService", "session");
 
+Exception::~Exception()
+{
+	if (session_service)
+		session_service->DelException(this);
+}
+
 void Exception::Serialize(Serialize::Data &data) const
 {
 	data["mask"] << this->mask;
@@ -86,8 +149,8 @@ Serializable* Exception::Unserialize(Serializable *obj, Serialize::Data &data)
 	data["time"] >> ex->time;
 	data["expires"] >> ex->expires;
 
-	if (!obj)
-		session_service->AddException(ex);
+	/* Also reindexes existing exceptions whose mask changed */
+	session_service->AddException(ex);
 	return ex;
 }
 
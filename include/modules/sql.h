@@ -193,6 +193,33 @@ namespace SQL
 		virtual void OnError(const Result &r) = 0;
 	};
 
+	/** Queue and latency counters of a provider. Queries are either run
+	 * synchronously by RunQuery or queued in the background by Run, and
+	 * each kind is counted separately.
+	 */
+	struct QueueStats
+	{
+		enum Lane
+		{
+			LANE_SYNC,
+			LANE_BACKGROUND,
+			LANE_SIZE
+		};
+
+		/* Background queries waiting to be run, including those running now */
+		unsigned long queued;
+		/* Queries run, and their total and longest latency in milliseconds.
+		 * The latency of a background query includes its time in the queue.
+		 */
+		unsigned long long queries[LANE_SIZE], total_ms[LANE_SIZE], max_ms[LANE_SIZE];
+
+		QueueStats() : queued(0)
+		{
+			for (int i = 0; i < LANE_SIZE; ++i)
+				queries[i] = total_ms[i] = max_ms[i] = 0;
+		}
+	};
+
 	/** Class providing the SQL service, modules call this to execute queries
 	 */
 	class Provider : public Service
@@ -208,9 +235,26 @@ namespace SQL
 
 		virtual Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) = 0;
 
+		/** Builds one query that inserts or updates several rows of a table at once.
+		 * Every row must already have an id, and CreateTable must have been called
+		 * for the data of every row.
+		 */
+		virtual Query BuildInsert(const Anope::string &table, const std::vector<std::pair<unsigned int, Data *> > &rows) = 0;
+
 		virtual Query GetTables(const Anope::string &prefix) = 0;
 
+		/** Builds the queries which create the change log table, if it does not exist,
+		 * and triggers on table which record the id of every row inserted, updated, or
+		 * deleted in it. Each change log row has an increasing `id`, type_name as
+		 * its `type`, and the `object_id` of the changed row.
+		 */
+		virtual std::vector<Query> CreateChangeLog(const Anope::string &log_table, const Anope::string &table, const Anope::string &type_name) = 0;
+
 		virtual Anope::string FromUnixtime(time_t) = 0;
+
+		/** Get the queue and latency counters of this provider, if it keeps any
+		 */
+		virtual QueueStats GetStats() { return QueueStats(); }
 	};
 
 }
@@ -8,6 +8,12 @@
 
 #include "httpd.h"
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+class XMLRPCMulticall;
+
 class XMLRPCRequest
 {
 	std::map<Anope::string, Anope::string> replies;
@@ -17,8 +23,17 @@ class XMLRPCRequest
 	Anope::string id;
 	std::deque<Anope::string> data;
 	HTTPReply& r;
+	/* The system.multicall this request is a part of, if any, and its position in it */
+	XMLRPCMulticall *multicall;
+	unsigned multicall_index;
+	/* When this request started being processed */
+	struct timeval started;
+
+	XMLRPCRequest(HTTPReply &_r) : r(_r), multicall(NULL), multicall_index(0)
+	{
+		gettimeofday(&started, NULL);
+	}
 
-	XMLRPCRequest(HTTPReply &_r) : r(_r) { }
 	inline void reply(const Anope::string &dname, const Anope::string &ddata) { this->replies.insert(std::make_pair(dname, ddata)); }
 	inline const std::map<Anope::string, Anope::string> &get_replies() { return this->replies; }
 };
@@ -44,4 +59,10 @@ class XMLRPCServiceInterface : public Service
 	virtual Anope::string Sanitize(const Anope::string &string) = 0;
 
 	virtual void Reply(XMLRPCRequest &request) = 0;
+
+	/** Send the reply to a request whose event returned false from Run() to answer it later.
+	 * @param client The client the request came from
+	 * @param request The request, with its replies filled in
+	 */
+	virtual void SendReply(HTTPClient *client, XMLRPCRequest &request) = 0;
 };
@@ -20,6 +20,8 @@
 typedef Anope::hash_map<ChannelInfo *> registered_channel_map;
 
 extern CoreExport Serialize::Checker<registered_channel_map> RegisteredChannelList;
+/* Every channel in RegisteredChannelList, in order, so they can be listed a page at a time */
+extern CoreExport Anope::map<ChannelInfo *> SortedRegisteredChannelList;
 
 /* AutoKick data. */
 class CoreExport AutoKick : public Serializable
@@ -39,7 +39,19 @@ class CoreExport RegexProvider : public Service
 {
  public:
 	RegexProvider(Module *o, const Anope::string &n) : Service(o, "Regex", n) { }
+	/* Removes the regexes compiled by this provider from the regex cache */
+	~RegexProvider();
 	virtual Regex *Compile(const Anope::string &) = 0;
 };
 
+namespace Anope
+{
+	/* Counters of the cache of compiled regexes used by Anope::Match */
+	struct RegexCacheCounters
+	{
+		uint64_t hits, misses, entries;
+	};
+	extern CoreExport RegexCacheCounters RegexCacheStats;
+}
+
 #endif // REGEXPR_H
@@ -41,6 +41,22 @@ namespace Serialize
 	extern void RegisterTypes();
 	extern void CheckTypes();
 
+	/** Starts a new update generation. Objects and types only fire
+	 * OnSerializableUpdate and OnSerializeCheck once per generation, no matter
+	 * how often they are dereferenced. This is called at the top of every main
+	 * loop iteration, and must be called by database modules once they have
+	 * written out the objects they were told about, so they are told again
+	 * about objects that change afterwards.
+	 */
+	extern CoreExport void NewGeneration();
+
+	/* Counters of update and check events fired and skipped */
+	struct Counters
+	{
+		uint64_t updates, updates_skipped, checks, checks_skipped;
+	};
+	extern CoreExport Counters Stats;
+
 	class Type;
 	template<typename T> class Checker;
 	template<typename T> class Reference;
@@ -68,6 +84,8 @@ class CoreExport Serializable : public virtual Base
 	size_t last_commit;
 	/* The last time this object was committed to the database */
 	time_t last_commit_time;
+	/* The generation in which OnSerializableUpdate was last fired for this object */
+	uint64_t update_generation;
 
  protected:
 	Serializable(const Anope::string &serialize_type);
@@ -85,6 +103,7 @@ class CoreExport Serializable : public virtual Base
 	unsigned short redis_ignore;
 
 	/** Marks the object as potentially being updated "soon".
+	 * This only does anything once per generation, see Serialize::NewGeneration.
 	 */
 	void QueueUpdate();
 
@@ -129,6 +148,9 @@ class CoreExport Serialize::Type : public Base
 	 */
 	time_t timestamp;
 
+	/* The generation in which OnSerializeCheck was last fired for this type */
+	uint64_t check_generation;
+
  public:
 	/* Map of Serializable::id to Serializable objects */
 	std::map<uint64_t, Serializable *> objects;
@@ -155,6 +177,7 @@ class CoreExport Serialize::Type : public Base
 	Serializable *Unserialize(Serializable *obj, Serialize::Data &data);
 
 	/** Check if this object type has any pending changes and update them.
+	 * This only does anything once per generation, see Serialize::NewGeneration.
 	 */
 	void Check();
 
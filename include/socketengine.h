@@ -41,6 +41,11 @@ class CoreExport SocketEngine
 	 */
 	static void Process();
 
+	/** Get how long Process may wait for activity
+	 * @return options:readtimeout, or at most a second while replies wait for room to be sent
+	 */
+	static time_t GetTimeout();
+
 	static int GetLastError();
 	static void SetLastError(int);
 
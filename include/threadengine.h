@@ -15,7 +15,116 @@
 #include "sockets.h"
 #include "extensible.h"
 
-class CoreExport Thread : public Pipe, public Extensible
+/** Atomic operations for the lock free primitives below
+ */
+namespace Atomic
+{
+#ifdef _WIN32
+	template<typename T> inline T *Exchange(T *volatile *p, T *v) { return static_cast<T *>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(p), v)); }
+	inline long Exchange(volatile long *p, long v) { return InterlockedExchange(p, v); }
+	template<typename T> inline T Load(const volatile T *p) { T v = *p; MemoryBarrier(); return v; }
+	template<typename T> inline void Store(volatile T *p, T v) { MemoryBarrier(); *p = v; }
+#else
+	template<typename T> inline T Exchange(volatile T *p, T v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+	template<typename T> inline T Load(const volatile T *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+	template<typename T> inline void Store(volatile T *p, T v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+#endif
+}
+
+/** A queue which any number of threads push to without locking, and which one
+ * thread, usually the main thread, pops from. Values must be copyable and default
+ * constructible.
+ */
+template<typename T> class MPSCQueue
+{
+	struct Node
+	{
+		Node *volatile next;
+		T value;
+
+		Node() : next(NULL) { }
+		Node(const T &v) : next(NULL), value(v) { }
+	};
+
+	/* The last node pushed, which each push swaps for its own */
+	Node *volatile head;
+	/* The node of the last value popped, followed by the values to pop */
+	Node *tail;
+
+	MPSCQueue(const MPSCQueue &);
+	MPSCQueue &operator=(const MPSCQueue &);
+
+ public:
+	MPSCQueue() : head(new Node()), tail(head) { }
+
+	~MPSCQueue()
+	{
+		for (Node *n = this->tail; n != NULL;)
+		{
+			Node *next = n->next;
+			delete n;
+			n = next;
+		}
+	}
+
+	/** Push a value. May be called from any thread
+	 */
+	void Push(const T &value)
+	{
+		Node *n = new Node(value);
+		Node *prev = Atomic::Exchange(&this->head, n);
+		Atomic::Store(&prev->next, n);
+	}
+
+	/** Pop a value. May only be called from one thread
+	 * @param value Set to the value popped
+	 * @return false if there is nothing to pop. A value still being pushed
+	 * may not be seen yet, so this must be called again after the pusher's
+	 * notification.
+	 */
+	bool Pop(T &value)
+	{
+		Node *next = Atomic::Load(&this->tail->next);
+		if (next == NULL)
+			return false;
+
+		value = next->value;
+		next->value = T();
+		delete this->tail;
+		this->tail = next;
+		return true;
+	}
+};
+
+/** Wakes the main thread from other threads, like Pipe::Notify. It uses an eventfd
+ * where available, and notifications made before the main thread wakes up are
+ * coalesced into one call to OnNotify.
+ */
+class CoreExport Notifier : public Socket
+{
+	/* The descriptor written to, the same as the socket for an eventfd */
+	int write_fd;
+	/* Set while a wakeup is waiting for the main thread */
+	volatile long pending;
+
+ public:
+	Notifier();
+	~Notifier();
+
+	/** Called when the notifier is readable, clears it then calls OnNotify
+	 */
+	bool ProcessRead() anope_override;
+
+	/** Wake the main thread. May be called from any thread
+	 */
+	void Notify();
+
+	/** Called in the main thread after one or more calls to Notify
+	 */
+	virtual void OnNotify() = 0;
+};
+
+class CoreExport Thread : public Notifier, public Extensible
 {
  private:
 	/* Set to true to tell the thread to finish and we are waiting for it */
@@ -128,4 +128,65 @@ class CoreExport TimerManager
 	static void DeleteTimersFor(Module *m);
 };
 
+/** Work which runs once at the end of the current iteration of the main loop, after
+ * the sockets have been processed. Posting it again before it has run does nothing,
+ * so a burst of events which all post it cost only one run.
+ */
+class CoreExport Deferred
+{
+ private:
+	/** True if this is waiting to run
+	 */
+	bool posted;
+
+ public:
+	/** Constructor
+	 */
+	Deferred();
+
+	/** Destructor, removes this from the queue if it is waiting to run
+	 */
+	virtual ~Deferred();
+
+	/** Queue this to run at the end of the current iteration of the main loop
+	 */
+	void Post();
+
+	/** Returns true if this is waiting to run
+	 * @return Returns true if this is waiting to run
+	 */
+	bool IsPosted() const;
+
+	/** Called at the end of the iteration of the main loop this was posted in
+	 * This should be overridden with something useful
+	 */
+	virtual void Run() = 0;
+
+	friend class DeferredManager;
+};
+
+/** This class manages the queue of Deferred work, in the order it was posted
+ */
+class CoreExport DeferredManager
+{
+	/** The work waiting to run, entries of work deleted before it ran are NULL
+	 */
+	static std::vector<Deferred *> Queue;
+ public:
+	/** Add work to the queue
+	 * @param d The work
+	 */
+	static void Add(Deferred *d);
+
+	/** Remove work from the queue
+	 * @param d The work
+	 */
+	static void Del(Deferred *d);
+
+	/** Run all of the work in the queue. Work posted while this runs,
+	 * including work which posts itself again, runs before it returns.
+	 */
+	static void RunAll();
+};
+
 #endif // TIMERS_H
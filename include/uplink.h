@@ -18,6 +18,43 @@
 namespace Uplink
 {
 	extern void Connect();
+
+	/* Replies to users which are waiting for room to be sent */
+	struct OutputStats
+	{
+		/* Lines and bytes queued now, and the number of users they are for */
+		unsigned long lines, bytes, targets;
+		/* Lines which had to wait in the queue, and queued lines dropped as their user left */
+		unsigned long long delayed, dropped;
+
+		OutputStats() : lines(0), bytes(0), targets(0), delayed(0), dropped(0) { }
+	};
+
+	/** Send a reply to a user. It is sent right away unless the user or all users
+	 * together have been sent as much as options:targetlines, outputlines and
+	 * outputbytes allow this second, or the uplink has a backlog of protocol
+	 * messages. Otherwise it waits in the user's queue, and users with queued
+	 * replies take turns once there is room again.
+	 * @param source The bot sending the reply, or NULL for the server
+	 * @param target The user
+	 * @param msg One line of the reply
+	 * @param privmsg Whether to send a PRIVMSG instead of a NOTICE
+	 */
+	extern CoreExport void SendReply(BotInfo *source, User *target, const Anope::string &msg, bool privmsg);
+
+	/** Send as many queued replies as there is room for
+	 */
+	extern void SendQueued();
+
+	/** Drop the replies queued for a user, called when the user is deleted
+	 */
+	extern void DropReplies(User *u);
+
+	/** Check whether any replies are waiting for room to be sent
+	 */
+	extern bool HasQueued();
+
+	extern CoreExport OutputStats GetOutputStats();
 }
 
 /* This is the socket to our uplink */
@@ -22,7 +22,8 @@
 
 typedef Anope::hash_map<User *> user_map;
 
-extern CoreExport user_map UserListByNick, UserListByUID;
+extern CoreExport user_map UserListByNick;
+extern CoreExport Anope::IDMap<User *> UserListByUID;
 
 extern CoreExport int OperCount;
 extern CoreExport unsigned MaxUserCount;
@@ -44,8 +45,13 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	Anope::string uid;
 	/* If the user is on the access list of the nick they're on */
 	bool on_access;
-	/* Map of user modes and the params this user has (if any) */
-	ModeList modes;
+	/* User modes this user has, indexed by UserMode::id */
+	std::vector<bool> modes;
+	/* Parameters of the param modes this user has */
+	std::vector<std::pair<unsigned, Anope::string> > mode_params;
+	/* Cached ModeList view returned by GetModeList(), rebuilt when modes change */
+	mutable ModeList modes_view;
+	mutable bool modes_view_dirty;
 	/* NickCore account the user is currently loggged in as, if they are logged in */
 	Serialize::Reference<NickCore> nc;
 
@@ -253,6 +259,12 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	 */
 	bool HasMode(const Anope::string &name) const;
 
+	/** Check if the user has a mode
+	 * @param id Mode ID, eg UMODE_OPER
+	 * @return true or false
+	 */
+	bool HasMode(UserModeID id) const;
+
 	/** Set a mode internally on the user, the IRCd is not informed
 	 * @param setter who/what is setting the mode
 	 * @param um The user mode
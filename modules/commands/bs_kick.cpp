@@ -1031,6 +1031,8 @@ class BSKick : public Module
 
 	BanDataPurger purger;
 
+	Configuration::Setting<bool> casesensitive, gentlebadwordreason;
+
 	BanData::Data &GetBanData(User *u, Channel *c)
 	{
 		BanData *bd = bandata.Require(c);
@@ -1100,12 +1102,20 @@ class BSKick : public Module
 
 		commandbssetdontkickops(this), commandbssetdontkickvoices(this),
 
-		purger(this)
+		purger(this),
+
+		casesensitive("casesensitive"), gentlebadwordreason("gentlebadwordreason")
 	{
 		me = this;
 
 	}
 
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		casesensitive.Load(conf->GetModule("botserv"));
+		gentlebadwordreason.Load(conf->GetModule(this));
+	}
+
 	void OnBotInfo(CommandSource &source, BotInfo *bi, ChannelInfo *ci, InfoFormatter &info) anope_override
 	{
 		if (!ci)
@@ -1333,7 +1343,6 @@ class BSKick : public Module
 
 			/* Normalize the buffer */
 			Anope::string nbuf = Anope::NormalizeBuffer(realbuf);
-			bool casesensitive = Config->GetModule("botserv")->Get<bool>("casesensitive");
 
 			/* Normalize can return an empty string if this only conains control codes etc */
 			if (badwords && !nbuf.empty())
@@ -1402,7 +1411,7 @@ class BSKick : public Module
 					if (mustkick)
 					{
 						check_ban(ci, u, kd, TTB_BADWORDS);
-						if (Config->GetModule(me)->Get<bool>("gentlebadwordreason"))
+						if (gentlebadwordreason)
 							bot_kick(ci, u, _("Watch your language!"));
 						else
 							bot_kick(ci, u, _("Don't use the word \"%s\" on this channel!"), bw->word.c_str());
@@ -171,6 +171,7 @@ public:
 			target_ci->name = target;
 			target_ci->time_registered = Anope::CurTime;
 			(*RegisteredChannelList)[target_ci->name] = target_ci;
+			SortedRegisteredChannelList[target_ci->name] = target_ci;
 			target_ci->c = Channel::Find(target_ci->name);
 
 			target_ci->bi = NULL;
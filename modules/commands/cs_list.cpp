@@ -18,7 +18,7 @@ class CommandCSList : public Command
 	CommandCSList(Module *creator) : Command(creator, "chanserv/list", 1, 2)
 	{
 		this->SetDesc(_("Lists all registered channels matching the given pattern"));
-		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE]"));
+		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE] [NEXT]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -27,7 +27,26 @@ class CommandCSList : public Command
 		unsigned nchans;
 		bool is_servadmin = source.HasCommand("chanserv/list");
 		int count = 0, from = 0, to = 0;
-		bool suspended = false, channoexpire = false;
+		bool suspended = false, channoexpire = false, next = false, more = false;
+		User *u = source.GetUser();
+
+		Anope::string options = params.size() > 1 ? params[1] : "", keyword;
+		for (spacesepstream keywords(options); keywords.GetToken(keyword);)
+			if (keyword.equals_ci("NEXT"))
+				next = true;
+
+		ListCursor *cursor = NULL;
+		if (next)
+		{
+			cursor = u ? u->GetExt<ListCursor>("CS_LIST_CURSOR") : NULL;
+			if (!cursor || !cursor->pattern.equals_cs(pattern))
+			{
+				source.Reply(_("There are no more entries matching \002%s\002."), pattern.c_str());
+				return;
+			}
+			/* Continue with the options of the first page */
+			options = cursor->options;
+		}
 
 		if (pattern[0] == '#')
 		{
@@ -53,10 +72,9 @@ class CommandCSList : public Command
 
 		nchans = 0;
 
-		if (is_servadmin && params.size() > 1)
+		if (is_servadmin && !options.empty())
 		{
-			Anope::string keyword;
-			spacesepstream keywords(params[1]);
+			spacesepstream keywords(options);
 			while (keywords.GetToken(keyword))
 			{
 				if (keyword.equals_ci("SUSPENDED"))
@@ -74,11 +92,13 @@ class CommandCSList : public Command
 		ListFormatter list(source.GetAccount());
 		list.AddColumn(_("Name")).AddColumn(_("Description"));
 
-		Anope::map<ChannelInfo *> ordered_map;
-		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
+		/* Load any channels which are in the database but not yet in memory */
+		RegisteredChannelList.operator->();
 
-		for (Anope::map<ChannelInfo *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
+		/* The index is kept sorted, so a page starts right after the last channel shown */
+		Anope::string last;
+		Anope::map<ChannelInfo *>::const_iterator it = cursor ? SortedRegisteredChannelList.upper_bound(cursor->last) : SortedRegisteredChannelList.begin();
+		for (Anope::map<ChannelInfo *>::const_iterator it_end = SortedRegisteredChannelList.end(); it != it_end; ++it)
 		{
 			const ChannelInfo *ci = it->second;
 
@@ -103,21 +123,32 @@ class CommandCSList : public Command
 
 			if (pattern.equals_ci(ci->name) || ci->name.equals_ci(spattern) || Anope::Match(ci->name, pattern, false, true) || Anope::Match(ci->name, spattern, false, true) || Anope::Match(ci->desc, pattern, false, true) || Anope::Match(ci->last_topic, pattern, false, true))
 			{
-				if (((count + 1 >= from && count + 1 <= to) || (!from && !to)) && ++nchans <= listmax)
+				++count;
+				if (to && count > to)
+					break;
+				else if (from && count < from)
+					continue;
+				else if (!to && nchans == listmax)
 				{
-					bool isnoexpire = false;
-					if (is_servadmin && (ci->HasExt("CS_NO_EXPIRE")))
-						isnoexpire = true;
-
-					ListFormatter::ListEntry entry;
-					entry["Name"] = (isnoexpire ? "!" : "") + ci->name;
-					if (ci->HasExt("CS_SUSPENDED"))
-						entry["Description"] = Language::Translate(source.GetAccount(), _("[Suspended]"));
-					else
-						entry["Description"] = ci->desc;
-					list.AddEntry(entry);
+					/* Stop at a full page rather than matching every remaining channel */
+					more = true;
+					break;
 				}
-				++count;
+				else if (++nchans > listmax)
+					continue;
+
+				bool isnoexpire = false;
+				if (is_servadmin && (ci->HasExt("CS_NO_EXPIRE")))
+					isnoexpire = true;
+
+				ListFormatter::ListEntry entry;
+				entry["Name"] = (isnoexpire ? "!" : "") + ci->name;
+				if (ci->HasExt("CS_SUSPENDED"))
+					entry["Description"] = Language::Translate(source.GetAccount(), _("[Suspended]"));
+				else
+					entry["Description"] = ci->desc;
+				list.AddEntry(entry);
+				last = ci->name;
 			}
 		}
 
@@ -127,7 +158,23 @@ class CommandCSList : public Command
 		for (unsigned i = 0; i < replies.size(); ++i)
 			source.Reply(replies[i]);
 
-		source.Reply(_("End of list - %d/%d matches shown."), nchans > listmax ? listmax : nchans, nchans);
+		if (more && u)
+		{
+			ListCursor *c = u->Extend<ListCursor>("CS_LIST_CURSOR");
+			c->pattern = params[0];
+			c->options = options;
+			c->last = last;
+
+			source.Reply(_("%d matches shown. Type \002%s%s %s %s NEXT\002 for more."), nchans, Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.command.c_str(), params[0].c_str());
+		}
+		else if (more)
+			source.Reply(_("%d matches shown."), nchans);
+		else
+		{
+			if (u)
+				u->Shrink<ListCursor>("CS_LIST_CURSOR");
+			source.Reply(_("End of list - %d/%d matches shown."), nchans > listmax ? listmax : nchans, nchans);
+		}
 	}
 
 	bool OnHelp(CommandSource &source, const Anope::string &subcommand) anope_override
@@ -149,6 +196,9 @@ class CommandCSList : public Command
 				"all channels matching at least one option will be displayed.\n"
 				"Note that these options are limited to \037Services Operators\037.\n"
 				" \n"
+				"At most %d channels are shown at a time. If there are more,\n"
+				"\002NEXT\002 with the same pattern shows the next ones.\n"
+				" \n"
 				"Examples:\n"
 				" \n"
 				"    \002LIST *anope*\002\n"
@@ -159,7 +209,8 @@ class CommandCSList : public Command
 				"        Lists all registered channels which have been set to not expire.\n"
 				" \n"
 				"    \002LIST #51-100\002\n"
-				"        Lists all registered channels within the given range (51-100)."));
+				"        Lists all registered channels within the given range (51-100)."),
+				Config->GetModule(this->owner)->Get<unsigned>("listmax", "50"));
 
 		if (!Config->GetBlock("options")->Get<const Anope::string>("regexengine").empty())
 		{
@@ -246,10 +297,11 @@ class CSList : public Module
 	CommandCSSetPrivate commandcssetprivate;
 
 	SerializableExtensibleItem<bool> priv;
+	PrimitiveExtensibleItem<ListCursor> cursor;
 
  public:
 	CSList(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
-		commandcslist(this), commandcssetprivate(this), priv(this, "CS_PRIVATE")
+		commandcslist(this), commandcssetprivate(this), priv(this, "CS_PRIVATE"), cursor(this, "CS_LIST_CURSOR")
 	{
 	}
 
@@ -17,7 +17,7 @@ class CommandNSList : public Command
 	CommandNSList(Module *creator) : Command(creator, "nickserv/list", 1, 2)
 	{
 		this->SetDesc(_("List all registered nicknames that match a given pattern"));
-		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE] [UNCONFIRMED]"));
+		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE] [UNCONFIRMED] [NEXT]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -28,10 +28,29 @@ class CommandNSList : public Command
 		unsigned nnicks;
 		bool is_servadmin = source.HasCommand("nickserv/list");
 		int count = 0, from = 0, to = 0;
-		bool suspended, nsnoexpire, unconfirmed;
+		bool suspended, nsnoexpire, unconfirmed, next, more;
 		unsigned listmax = Config->GetModule(this->owner)->Get<unsigned>("listmax", "50");
+		User *u = source.GetUser();
 
-		suspended = nsnoexpire = unconfirmed = false;
+		suspended = nsnoexpire = unconfirmed = next = more = false;
+
+		Anope::string options = params.size() > 1 ? params[1] : "", keyword;
+		for (spacesepstream keywords(options); keywords.GetToken(keyword);)
+			if (keyword.equals_ci("NEXT"))
+				next = true;
+
+		ListCursor *cursor = NULL;
+		if (next)
+		{
+			cursor = u ? u->GetExt<ListCursor>("NS_LIST_CURSOR") : NULL;
+			if (!cursor || !cursor->pattern.equals_cs(pattern))
+			{
+				source.Reply(_("There are no more entries matching \002%s\002."), pattern.c_str());
+				return;
+			}
+			/* Continue with the options of the first page */
+			options = cursor->options;
+		}
 
 		if (pattern[0] == '#')
 		{
@@ -54,10 +73,9 @@ class CommandNSList : public Command
 
 		nnicks = 0;
 
-		if (is_servadmin && params.size() > 1)
+		if (is_servadmin && !options.empty())
 		{
-			Anope::string keyword;
-			spacesepstream keywords(params[1]);
+			spacesepstream keywords(options);
 			while (keywords.GetToken(keyword))
 			{
 				if (keyword.equals_ci("NOEXPIRE"))
@@ -74,11 +92,13 @@ class CommandNSList : public Command
 
 		list.AddColumn(_("Nick")).AddColumn(_("Last usermask"));
 
-		Anope::map<NickAlias *> ordered_map;
-		for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
+		/* Load any nicks which are in the database but not yet in memory */
+		NickAliasList.operator->();
 
-		for (Anope::map<NickAlias *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
+		/* The index is kept sorted, so a page starts right after the last nick shown */
+		Anope::string last;
+		Anope::map<NickAlias *>::const_iterator it = cursor ? SortedNickAliasList.upper_bound(cursor->last) : SortedNickAliasList.begin();
+		for (Anope::map<NickAlias *>::const_iterator it_end = SortedNickAliasList.end(); it != it_end; ++it)
 		{
 			const NickAlias *na = it->second;
 
@@ -98,25 +118,36 @@ class CommandNSList : public Command
 			Anope::string buf = Anope::printf("%s!%s", na->nick.c_str(), !na->last_usermask.empty() ? na->last_usermask.c_str() : "*@*");
 			if (na->nick.equals_ci(pattern) || Anope::Match(buf, pattern, false, true))
 			{
-				if (((count + 1 >= from && count + 1 <= to) || (!from && !to)) && ++nnicks <= listmax)
+				++count;
+				if (to && count > to)
+					break;
+				else if (from && count < from)
+					continue;
+				else if (!to && nnicks == listmax)
 				{
-					bool isnoexpire = false;
-					if (is_servadmin && na->HasExt("NS_NO_EXPIRE"))
-						isnoexpire = true;
-
-					ListFormatter::ListEntry entry;
-					entry["Nick"] = (isnoexpire ? "!" : "") + na->nick;
-					if (na->nc->HasExt("HIDE_MASK") && !is_servadmin && na->nc != mync)
-						entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Hostname hidden]"));
-					else if (na->nc->HasExt("NS_SUSPENDED"))
-						entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Suspended]"));
-					else if (na->nc->HasExt("UNCONFIRMED"))
-						entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Unconfirmed]"));
-					else
-						entry["Last usermask"] = na->last_usermask;
-					list.AddEntry(entry);
+					/* Stop at a full page rather than matching every remaining nick */
+					more = true;
+					break;
 				}
-				++count;
+				else if (++nnicks > listmax)
+					continue;
+
+				bool isnoexpire = false;
+				if (is_servadmin && na->HasExt("NS_NO_EXPIRE"))
+					isnoexpire = true;
+
+				ListFormatter::ListEntry entry;
+				entry["Nick"] = (isnoexpire ? "!" : "") + na->nick;
+				if (na->nc->HasExt("HIDE_MASK") && !is_servadmin && na->nc != mync)
+					entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Hostname hidden]"));
+				else if (na->nc->HasExt("NS_SUSPENDED"))
+					entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Suspended]"));
+				else if (na->nc->HasExt("UNCONFIRMED"))
+					entry["Last usermask"] = Language::Translate(source.GetAccount(), _("[Unconfirmed]"));
+				else
+					entry["Last usermask"] = na->last_usermask;
+				list.AddEntry(entry);
+				last = na->nick;
 			}
 		}
 
@@ -128,7 +159,23 @@ class CommandNSList : public Command
 		for (unsigned i = 0; i < replies.size(); ++i)
 			source.Reply(replies[i]);
 
-		source.Reply(_("End of list - %d/%d matches shown."), nnicks > listmax ? listmax : nnicks, nnicks);
+		if (more && u)
+		{
+			ListCursor *c = u->Extend<ListCursor>("NS_LIST_CURSOR");
+			c->pattern = params[0];
+			c->options = options;
+			c->last = last;
+
+			source.Reply(_("%d matches shown. Type \002%s%s %s %s NEXT\002 for more."), nnicks, Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.command.c_str(), params[0].c_str());
+		}
+		else if (more)
+			source.Reply(_("%d matches shown."), nnicks);
+		else
+		{
+			if (u)
+				u->Shrink<ListCursor>("NS_LIST_CURSOR");
+			source.Reply(_("End of list - %d/%d matches shown."), nnicks > listmax ? listmax : nnicks, nnicks);
+		}
 		return;
 	}
 
@@ -150,6 +197,9 @@ class CommandNSList : public Command
 				"given, all nicks matching at least one option will be displayed.\n"
 				"Note that these options are limited to \037Services Operators\037.\n"
 				" \n"
+				"At most %d nicks are shown at a time. If there are more,\n"
+				"\002NEXT\002 with the same pattern shows the next ones.\n"
+				" \n"
 				"Examples:\n"
 				" \n"
 				"    \002LIST *!joeuser@foo.com\002\n"
@@ -163,7 +213,8 @@ class CommandNSList : public Command
 				"        Lists all registered nicks which have been set to not expire.\n"
 				" \n"
 				"    \002LIST #51-100\002\n"
-				"        Lists all registered nicks within the given range (51-100)."));
+				"        Lists all registered nicks within the given range (51-100)."),
+				Config->GetModule(this->owner)->Get<unsigned>("listmax", "50"));
 
 		const Anope::string &regexengine = Config->GetBlock("options")->Get<const Anope::string>("regexengine");
 		if (!regexengine.empty())
@@ -280,11 +331,12 @@ class NSList : public Module
 	CommandNSSASetPrivate commandnssasetprivate;
 
 	SerializableExtensibleItem<bool> priv;
+	PrimitiveExtensibleItem<ListCursor> cursor;
 
  public:
 	NSList(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
 		commandnslist(this), commandnssetprivate(this), commandnssasetprivate(this),
-		priv(this, "NS_PRIVATE")
+		priv(this, "NS_PRIVATE"), cursor(this, "NS_LIST_CURSOR")
 	{
 	}
 
@@ -54,16 +54,24 @@ Serializable* ForbidDataImpl::Unserialize(Serializable *obj, Serialize::Data &da
 	if (t > FT_SIZE - 1)
 		return NULL;
 
-	if (!obj)
-		forbid_service->AddForbid(fb);
+	/* Also reindexes existing forbids whose mask or type changed */
+	forbid_service->AddForbid(fb);
 	return fb;
 }
 
 class MyForbidService : public ForbidService
 {
-	Serialize::Checker<std::vector<ForbidData *>[FT_SIZE - 1]> forbid_data;
+	struct ForbidList
+	{
+		std::vector<ForbidData *> forbids;
+		/* Index of the masks of forbids, so FindForbid does not have to try them all */
+		MaskSet<ForbidData *> masks;
+	};
+
+	Serialize::Checker<ForbidList[FT_SIZE - 1]> forbid_data;
 
-	inline std::vector<ForbidData *>& forbids(unsigned t) { return (*this->forbid_data)[t - 1]; }
+	inline std::vector<ForbidData *>& forbids(unsigned t) { return (*this->forbid_data)[t - 1].forbids; }
+	inline MaskSet<ForbidData *>& masks(unsigned t) { return (*this->forbid_data)[t - 1].masks; }
 
  public:
 	MyForbidService(Module *m) : ForbidService(m), forbid_data("ForbidData") { }
@@ -77,7 +85,13 @@ class MyForbidService : public ForbidService
 
 	void AddForbid(ForbidData *d) anope_override
 	{
-		this->forbids(d->type).push_back(d);
+		/* This is also called for forbids which already exist when they are updated from the database */
+		for (unsigned t = FT_NICK; t < FT_SIZE; ++t)
+			if (t != d->type && this->masks(t).Remove(d))
+				this->forbids(t).erase(std::find(this->forbids(t).begin(), this->forbids(t).end(), d));
+
+		if (this->masks(d->type).Add(d->mask, d))
+			this->forbids(d->type).push_back(d);
 	}
 
 	void RemoveForbid(ForbidData *d) anope_override
@@ -85,6 +99,7 @@ class MyForbidService : public ForbidService
 		std::vector<ForbidData *>::iterator it = std::find(this->forbids(d->type).begin(), this->forbids(d->type).end(), d);
 		if (it != this->forbids(d->type).end())
 			this->forbids(d->type).erase(it);
+		this->masks(d->type).Remove(d);
 		delete d;
 	}
 
@@ -95,14 +110,10 @@ class MyForbidService : public ForbidService
 
 	ForbidData *FindForbid(const Anope::string &mask, ForbidType ftype) anope_override
 	{
-		for (unsigned i = this->forbids(ftype).size(); i > 0; --i)
-		{
-			ForbidData *d = this->forbids(ftype)[i - 1];
-
-			if (Anope::Match(mask, d->mask, false, true))
-				return d;
-		}
-		return NULL;
+		/* The most recently added forbid wins */
+		ForbidData *d = NULL;
+		this->masks(ftype).FindNewest(mask, d);
+		return d;
 	}
 
 	ForbidData *FindForbidExact(const Anope::string &mask, ForbidType ftype) anope_override
@@ -137,6 +148,7 @@ class MyForbidService : public ForbidService
 
 					Log(LOG_NORMAL, "expire/forbid", Config->GetClient("OperServ")) << "Expiring forbid for " << d->mask << " type " << ftype;
 					this->forbids(j).erase(this->forbids(j).begin() + i - 1);
+					this->masks(j).Remove(d);
 					delete d;
 				}
 				else
@@ -43,16 +43,15 @@ Serializable* IgnoreDataImpl::Unserialize(Serializable *obj, Serialize::Data &da
 	if (obj)
 		ign = anope_dynamic_static_cast<IgnoreDataImpl *>(obj);
 	else
-	{
 		ign = new IgnoreDataImpl();
-		ignore_service->AddIgnore(ign);
-	}
 
 	data["mask"] >> ign->mask;
 	data["creator"] >> ign->creator;
 	data["reason"] >> ign->reason;
 	data["time"] >> ign->time;
 
+	/* Also reindexes existing ignores whose mask changed */
+	ignore_service->AddIgnore(ign);
 	return ign;
 }
 
@@ -60,13 +59,32 @@ Serializable* IgnoreDataImpl::Unserialize(Serializable *obj, Serialize::Data &da
 class OSIgnoreService : public IgnoreService
 {
 	Serialize::Checker<std::vector<IgnoreData *> > ignores;
+	/* Index of the masks of ignores, so Find does not have to try them all */
+	MaskSet<IgnoreData *> masks;
+
+	/* The mask an ignore is indexed by. Ignores are matched against users as an Entry,
+	 * which for masks of the usual nick!user@host form only matches users whose
+	 * nick!user@host matches the mask for some combination of their idents, hosts
+	 * and IP. Other masks, such as CIDR ranges or masks with an empty part, are always tried.
+	 */
+	static Anope::string IndexMask(const IgnoreData *ign)
+	{
+		const Anope::string &mask = ign->mask;
+		size_t ex = mask.find('!'), at = mask.find('@');
+		if (ex == Anope::string::npos || at == Anope::string::npos || !ex || ex + 1 >= at || at + 1 == mask.length())
+			return "*";
+		if (mask.find_first_of("/#") != Anope::string::npos || (IRCD && IRCD->IsExtbanValid(mask)))
+			return "*";
+		return mask;
+	}
 
  public:
 	OSIgnoreService(Module *o) : IgnoreService(o), ignores("IgnoreData") { }
 
 	void AddIgnore(IgnoreData *ign) anope_override
 	{
-		ignores->push_back(ign);
+		if (this->masks.Add(IndexMask(ign), ign))
+			ignores->push_back(ign);
 	}
 
 	void DelIgnore(IgnoreData *ign) anope_override
@@ -74,6 +92,7 @@ class OSIgnoreService : public IgnoreService
 		std::vector<IgnoreData *>::iterator it = std::find(ignores->begin(), ignores->end(), ign);
 		if (it != ignores->end())
 			ignores->erase(it);
+		this->masks.Remove(ign);
 	}
 
 	void ClearIgnores() anope_override
@@ -92,12 +111,26 @@ class OSIgnoreService : public IgnoreService
 
 	IgnoreData *Find(const Anope::string &mask) anope_override
 	{
+		if (this->ignores->empty())
+			return NULL;
+
 		User *u = User::Find(mask, true);
-		std::vector<IgnoreData *>::iterator ign = this->ignores->begin(), ign_end = this->ignores->end();
+		std::vector<IgnoreData *> matches;
+		std::vector<IgnoreData *>::iterator ign, ign_end;
 
 		if (u)
 		{
-			for (; ign != ign_end; ++ign)
+			const Anope::string idents[] = { u->GetVIdent(), u->GetIdent() },
+				hosts[] = { u->GetDisplayedHost(), u->GetCloakedHost(), u->host, u->ip.addr() };
+
+			std::vector<Anope::string> nuhs;
+			for (unsigned i = 0; i < 2; ++i)
+				for (unsigned j = 0; j < 4; ++j)
+					nuhs.push_back(u->nick + "!" + idents[i] + "@" + hosts[j]);
+
+			this->masks.Find(nuhs, matches);
+
+			for (ign = matches.begin(), ign_end = matches.end(); ign != ign_end; ++ign)
 			{
 				Entry ignore_mask("", (*ign)->mask);
 				if (ignore_mask.Matches(u, true))
@@ -126,7 +159,9 @@ class OSIgnoreService : public IgnoreService
 			else
 				tmp = mask + "!*@*";
 
-			for (; ign != ign_end; ++ign)
+			this->masks.Find(tmp, matches);
+
+			for (ign = matches.begin(), ign_end = matches.end(); ign != ign_end; ++ign)
 				if (Anope::Match(tmp, (*ign)->mask, false, true))
 					break;
 		}
@@ -11,22 +11,121 @@
 
 #include "module.h"
 
+/** A page of a list of users or channels, in order. Entries are offered in any
+ * order and only the first ones after the cursor are kept, so a page of a large
+ * list is found without copying or sorting all of it.
+ */
+template<typename T> class ListPage
+{
+	Anope::map<T *> entries;
+	Anope::string after;
+	unsigned max;
+
+ public:
+	ListPage(const Anope::string &a, unsigned m) : after(a), max(m) { }
+
+	/** Check whether an entry would be on this page, so it is only matched if it would be */
+	bool Wants(const Anope::string &name) const
+	{
+		if (!after.empty() && !ci::less()(after, name))
+			return false;
+		/* One more than a page is kept, to know whether there is another page */
+		return !max || this->entries.size() <= max || ci::less()(name, this->entries.rbegin()->first);
+	}
+
+	void Add(const Anope::string &name, T *t)
+	{
+		this->entries[name] = t;
+		if (max && this->entries.size() > max + 1)
+			this->entries.erase(--this->entries.end());
+	}
+
+	/** Drop the entry beyond the page, if any
+	 * @return true if there is another page
+	 */
+	bool Finish()
+	{
+		if (!max || this->entries.size() <= max)
+			return false;
+		this->entries.erase(--this->entries.end());
+		return true;
+	}
+
+	const Anope::map<T *> &GetEntries() const { return this->entries; }
+};
+
+/** Get where to continue a list from, if NEXT was given
+ * @return false if NEXT was given but there is nothing to continue
+ */
+static bool GetCursor(CommandSource &source, const Anope::string &ext, const Anope::string &pattern, Anope::string &opt, Anope::string &after)
+{
+	bool next = false;
+	Anope::string options, keyword;
+	for (spacesepstream keywords(opt); keywords.GetToken(keyword);)
+	{
+		if (keyword.equals_ci("NEXT"))
+			next = true;
+		else
+			options += (options.empty() ? "" : " ") + keyword;
+	}
+	opt = options;
+
+	if (!next)
+		return true;
+
+	ListCursor *cursor = source.GetUser() ? source.GetUser()->GetExt<ListCursor>(ext) : NULL;
+	if (!cursor || !cursor->pattern.equals_cs(pattern))
+	{
+		source.Reply(_("There are no more entries matching \002%s\002."), pattern.c_str());
+		return false;
+	}
+
+	/* Continue with the options of the first page */
+	opt = cursor->options;
+	after = cursor->last;
+	return true;
+}
+
+/** Save where a list stopped, or clear it if the list is finished */
+static void SetCursor(CommandSource &source, const Anope::string &ext, const Anope::string &pattern, const Anope::string &opt, const Anope::string &last, bool more)
+{
+	User *u = source.GetUser();
+	if (!u)
+		return;
+
+	if (!more)
+	{
+		u->Shrink<ListCursor>(ext);
+		return;
+	}
+
+	ListCursor *cursor = u->Extend<ListCursor>(ext);
+	cursor->pattern = pattern;
+	cursor->options = opt;
+	cursor->last = last;
+	source.Reply(_("Type \002%s%s %s %s NEXT\002 for more."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.command.c_str(), pattern.c_str());
+}
+
 class CommandOSChanList : public Command
 {
  public:
 	CommandOSChanList(Module *creator) : Command(creator, "operserv/chanlist", 0, 2)
 	{
 		this->SetDesc(_("Lists all channel records"));
-		this->SetSyntax(_("[{\037pattern\037 | \037nick\037} [\037SECRET\037]]"));
+		this->SetSyntax(_("[{\037pattern\037 | \037nick\037} [\037SECRET\037] [NEXT]]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
 		const Anope::string &pattern = !params.empty() ? params[0] : "";
-		const Anope::string &opt = params.size() > 1 ? params[1] : "";
+		Anope::string opt = params.size() > 1 ? params[1] : "", after;
 		std::set<Anope::string> modes;
 		User *u2;
 		unsigned int count = 0;
+		bool paged = false, more = false;
+
+		if (!GetCursor(source, "OS_CHANLIST_CURSOR", !pattern.empty() ? pattern : "*", opt, after))
+			return;
 
 		if (!pattern.empty())
 			Log(LOG_ADMIN, source, this) << "for " << pattern;
@@ -69,10 +168,13 @@ class CommandOSChanList : public Command
 		{
 			source.Reply(_("Channel list:"));
 
+			ListPage<Channel> page(after, Config->GetModule(this->owner)->Get<unsigned>("listmax", "500"));
 			for (channel_map::const_iterator cit = ChannelList.begin(), cit_end = ChannelList.end(); cit != cit_end; ++cit)
 			{
 				Channel *c = cit->second;
 
+				if (!page.Wants(c->name))
+					continue;
 				if (!pattern.empty() && !Anope::Match(c->name, pattern, false, true))
 					continue;
 				if (!modes.empty())
@@ -80,6 +182,15 @@ class CommandOSChanList : public Command
 						if (!c->HasMode(*it))
 							continue;
 
+				page.Add(c->name, c);
+			}
+			paged = true;
+			more = page.Finish();
+
+			for (Anope::map<Channel *>::const_iterator it = page.GetEntries().begin(), it_end = page.GetEntries().end(); it != it_end; ++it)
+			{
+				Channel *c = it->second;
+
 				ListFormatter::ListEntry entry;
 				entry["Name"] = c->name;
 				entry["Users"] = stringify(c->users.size());
@@ -88,6 +199,7 @@ class CommandOSChanList : public Command
 				list.AddEntry(entry);
 
 				++count;
+				after = c->name;
 			}
 		}
 
@@ -98,6 +210,8 @@ class CommandOSChanList : public Command
 			source.Reply(replies[i]);
 
 		source.Reply(_("End of channel list. \002%u\002 channels shown."), count);
+		if (paged)
+			SetCursor(source, "OS_CHANLIST_CURSOR", !pattern.empty() ? pattern : "*", opt, after, more);
 	}
 
 	bool OnHelp(CommandSource &source, const Anope::string &subcommand) anope_override
@@ -110,7 +224,10 @@ class CommandOSChanList : public Command
 				"If \002pattern\002 is given, lists only channels that match it. If a nickname\n"
 				"is given, lists only the channels the user using it is on. If SECRET is\n"
 				"specified, lists only channels matching \002pattern\002 that have the +s or\n"
-				"+p mode."));
+				"+p mode.\n"
+				" \n"
+				"When there are more channels than are shown at a time, \002NEXT\002\n"
+				"with the same pattern shows the next ones."));
 
 		const Anope::string &regexengine = Config->GetBlock("options")->Get<const Anope::string>("regexengine");
 		if (!regexengine.empty())
@@ -130,16 +247,20 @@ class CommandOSUserList : public Command
 	CommandOSUserList(Module *creator) : Command(creator, "operserv/userlist", 0, 2)
 	{
 		this->SetDesc(_("Lists all user records"));
-		this->SetSyntax(_("[{\037pattern\037 | \037channel\037} [\037INVISIBLE\037]]"));
+		this->SetSyntax(_("[{\037pattern\037 | \037channel\037} [\037INVISIBLE\037] [NEXT]]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
 		const Anope::string &pattern = !params.empty() ? params[0] : "";
-		const Anope::string &opt = params.size() > 1 ? params[1] : "";
+		Anope::string opt = params.size() > 1 ? params[1] : "", after;
 		Channel *c;
 		std::set<Anope::string> modes;
 		unsigned int count = 0;
+		bool paged = false, more = false;
+
+		if (!GetCursor(source, "OS_USERLIST_CURSOR", !pattern.empty() ? pattern : "*", opt, after))
+			return;
 
 		if (!pattern.empty())
 			Log(LOG_ADMIN, source, this) << "for " << pattern;
@@ -176,17 +297,17 @@ class CommandOSUserList : public Command
 		}
 		else
 		{
-			/* Historically this has been ordered, so... */
-			Anope::map<User *> ordered_map;
-			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-				ordered_map[it->first] = it->second;
-
 			source.Reply(_("Users list:"));
 
-			for (Anope::map<User *>::const_iterator it = ordered_map.begin(); it != ordered_map.end(); ++it)
+			/* Historically this has been ordered, so... */
+			ListPage<User> page(after, Config->GetModule(this->owner)->Get<unsigned>("listmax", "500"));
+			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
 			{
 				User *u2 = it->second;
 
+				if (!page.Wants(u2->nick))
+					continue;
+
 				if (!pattern.empty())
 				{
 					/* check displayed host, host, and ip */
@@ -216,6 +337,15 @@ class CommandOSUserList : public Command
 								continue;
 				}
 
+				page.Add(u2->nick, u2);
+			}
+			paged = true;
+			more = page.Finish();
+
+			for (Anope::map<User *>::const_iterator it = page.GetEntries().begin(), it_end = page.GetEntries().end(); it != it_end; ++it)
+			{
+				User *u2 = it->second;
+
 				ListFormatter::ListEntry entry;
 				entry["Name"] = u2->nick;
 				entry["Mask"] = u2->GetIdent() + "@" + u2->GetDisplayedHost();
@@ -223,6 +353,7 @@ class CommandOSUserList : public Command
 				list.AddEntry(entry);
 
 				++count;
+				after = u2->nick;
 			}
 		}
 
@@ -233,6 +364,8 @@ class CommandOSUserList : public Command
 			source.Reply(replies[i]);
 
 		source.Reply(_("End of users list. \002%u\002 users shown."), count);
+		if (paged)
+			SetCursor(source, "OS_USERLIST_CURSOR", !pattern.empty() ? pattern : "*", opt, after, more);
 		return;
 	}
 
@@ -246,7 +379,10 @@ class CommandOSUserList : public Command
 				"If \002pattern\002 is given, lists only users that match it (it must be in\n"
 				"the format nick!user@host[#realname]). If \002channel\002 is given, lists\n"
 				"only users that are on the given channel. If INVISIBLE is specified, only users\n"
-				"with the +i flag will be listed."));
+				"with the +i flag will be listed.\n"
+				" \n"
+				"When there are more users than are shown at a time, \002NEXT\002\n"
+				"with the same pattern shows the next ones."));
 
 		const Anope::string &regexengine = Config->GetBlock("options")->Get<const Anope::string>("regexengine");
 		if (!regexengine.empty())
@@ -265,9 +401,12 @@ class OSList : public Module
 	CommandOSChanList commandoschanlist;
 	CommandOSUserList commandosuserlist;
 
+	PrimitiveExtensibleItem<ListCursor> chanlist_cursor, userlist_cursor;
+
  public:
 	OSList(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
-		commandoschanlist(this), commandosuserlist(this)
+		commandoschanlist(this), commandosuserlist(this),
+		chanlist_cursor(this, "OS_CHANLIST_CURSOR"), userlist_cursor(this, "OS_USERLIST_CURSOR")
 	{
 
 	}
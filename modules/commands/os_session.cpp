@@ -33,14 +33,191 @@ namespace
 	/* Number of bits to use when comparing session IPs */
 	unsigned ipv4_cidr;
 	unsigned ipv6_cidr;
+
+	/* A storm ends once no session limit has been exceeded for this long */
+	const time_t storm_quiet = 300;
+
+	/* Session limit kills during the current connection storm */
+	struct Storm
+	{
+		time_t start, last;
+		unsigned long kills;
+		/* Kills by session CIDR */
+		std::map<Anope::string, unsigned long> cidrs;
+
+		Storm() : start(0), last(0), kills(0) { }
+
+		bool Active() const
+		{
+			return this->kills && Anope::CurTime - this->last < storm_quiet;
+		}
+
+		void Hit(const Anope::string &mask)
+		{
+			if (!this->Active())
+			{
+				this->start = Anope::CurTime;
+				this->kills = 0;
+				this->cidrs.clear();
+			}
+
+			this->last = Anope::CurTime;
+			++this->kills;
+			++this->cidrs[mask];
+		}
+	} storm;
 }
 
+/** A binary trie of IPv4 and IPv6 prefixes, used to find the CIDR exceptions containing an address
+ */
+class ExceptionTrie
+{
+	struct Node
+	{
+		Node *child[2];
+		std::vector<Exception *> exceptions;
+
+		Node() { child[0] = child[1] = NULL; }
+		~Node() { delete child[0]; delete child[1]; }
+	};
+
+	Node roots[2];
+
+	static const uint8_t *Bytes(const sockaddrs &addr, unsigned &bits)
+	{
+		if (addr.sa.sa_family == AF_INET)
+		{
+			bits = 32;
+			return reinterpret_cast<const uint8_t *>(&addr.sa4.sin_addr);
+		}
+		bits = 128;
+		return reinterpret_cast<const uint8_t *>(&addr.sa6.sin6_addr);
+	}
+
+ public:
+	/* Parses a mask the way cidr does, returns false if it is not an address */
+	static bool Parse(const Anope::string &mask, sockaddrs &addr, unsigned &len)
+	{
+		size_t sl = mask.find_last_of('/');
+		addr.pton(mask.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, mask.substr(0, sl));
+
+		len = addr.ipv6() ? 128 : 32;
+		try
+		{
+			if (sl != Anope::string::npos && mask.substr(sl + 1).is_pos_number_only())
+				len = std::min(len, convertTo<unsigned>(mask.substr(sl + 1)));
+		}
+		catch (const ConvertException &) { }
+
+		return addr.valid();
+	}
+
+	void Add(const sockaddrs &addr, unsigned len, Exception *e)
+	{
+		unsigned bits;
+		const uint8_t *ip = Bytes(addr, bits);
+		Node *node = &this->roots[addr.ipv6()];
+
+		for (unsigned i = 0; i < len && i < bits; ++i)
+		{
+			Node *&next = node->child[(ip[i / 8] >> (7 - i % 8)) & 1];
+			if (!next)
+				next = new Node();
+			node = next;
+		}
+
+		node->exceptions.push_back(e);
+	}
+
+	void Remove(const sockaddrs &addr, unsigned len, Exception *e)
+	{
+		unsigned bits;
+		const uint8_t *ip = Bytes(addr, bits);
+		std::vector<Node **> path;
+		Node *node = &this->roots[addr.ipv6()];
+
+		for (unsigned i = 0; node && i < len && i < bits; ++i)
+		{
+			path.push_back(&node->child[(ip[i / 8] >> (7 - i % 8)) & 1]);
+			node = *path.back();
+		}
+
+		if (!node)
+			return;
+
+		std::vector<Exception *>::iterator it = std::find(node->exceptions.begin(), node->exceptions.end(), e);
+		if (it != node->exceptions.end())
+			node->exceptions.erase(it);
+
+		/* Free the nodes which no longer lead anywhere */
+		for (unsigned i = path.size(); i > 0; --i)
+		{
+			Node *n = *path[i - 1];
+			if (!n->exceptions.empty() || n->child[0] || n->child[1])
+				break;
+			delete n;
+			*path[i - 1] = NULL;
+		}
+	}
+
+	/* Adds every exception containing addr to matches */
+	void Find(const sockaddrs &addr, std::vector<Exception *> &matches) const
+	{
+		if (!addr.valid())
+			return;
+
+		unsigned bits;
+		const uint8_t *ip = Bytes(addr, bits);
+		const Node *node = &this->roots[addr.ipv6()];
+
+		for (unsigned i = 0; node; ++i)
+		{
+			matches.insert(matches.end(), node->exceptions.begin(), node->exceptions.end());
+			node = i < bits ? node->child[(ip[i / 8] >> (7 - i % 8)) & 1] : NULL;
+		}
+	}
+};
+
 class MySessionService : public SessionService
 {
 	SessionMap Sessions;
 	Serialize::Checker<ExceptionVector> Exceptions;
+
+	/* Exceptions are matched against hosts by their mask and against IPs by their CIDR.
+	 * When several match, the one added first is used, as the exception list is ordered.
+	 */
+	MaskSet<Exception *> exception_masks;
+	ExceptionTrie exception_cidrs;
+	/* The order exceptions were added in and the mask they are indexed by */
+	std::map<Exception *, std::pair<unsigned long, Anope::string> > exception_index;
+	unsigned long exception_seq;
+
+	void Unindex(Exception *e)
+	{
+		std::map<Exception *, std::pair<unsigned long, Anope::string> >::iterator it = this->exception_index.find(e);
+		if (it == this->exception_index.end())
+			return;
+
+		sockaddrs addr;
+		unsigned len;
+		if (ExceptionTrie::Parse(it->second.second, addr, len))
+			this->exception_cidrs.Remove(addr, len, e);
+		this->exception_masks.Remove(e);
+		this->exception_index.erase(it);
+	}
+
+	/* Picks the first added exception out of the candidates */
+	Exception *First(const std::vector<Exception *> &candidates)
+	{
+		Exception *e = NULL;
+		for (unsigned i = 0; i < candidates.size(); ++i)
+			if (!e || this->exception_index[candidates[i]].first < this->exception_index[e].first)
+				e = candidates[i];
+		return e;
+	}
+
  public:
-	MySessionService(Module *m) : SessionService(m), Exceptions("Exception") { }
+	MySessionService(Module *m) : SessionService(m), Exceptions("Exception"), exception_masks(false), exception_seq(0) { }
 
 	Exception *CreateException() anope_override
 	{
@@ -49,7 +226,29 @@ class MySessionService : public SessionService
 
 	void AddException(Exception *e) anope_override
 	{
-		this->Exceptions->push_back(e);
+		/* This is also called for exceptions which already exist when they are updated from the database */
+		std::map<Exception *, std::pair<unsigned long, Anope::string> >::iterator it = this->exception_index.find(e);
+		unsigned long seq;
+		if (it == this->exception_index.end())
+		{
+			this->Exceptions->push_back(e);
+			seq = this->exception_seq++;
+		}
+		else if (it->second.second == e->mask)
+			return;
+		else
+		{
+			seq = it->second.first;
+			this->Unindex(e);
+		}
+
+		this->exception_index[e] = std::make_pair(seq, e->mask);
+		this->exception_masks.Add(e->mask, e);
+
+		sockaddrs addr;
+		unsigned len;
+		if (ExceptionTrie::Parse(e->mask, addr, len))
+			this->exception_cidrs.Add(addr, len, e);
 	}
 
 	void DelException(Exception *e) anope_override
@@ -57,35 +256,39 @@ class MySessionService : public SessionService
 		ExceptionVector::iterator it = std::find(this->Exceptions->begin(), this->Exceptions->end(), e);
 		if (it != this->Exceptions->end())
 			this->Exceptions->erase(it);
+		this->Unindex(e);
 	}
 
 	Exception *FindException(User *u) anope_override
 	{
-		for (std::vector<Exception *>::const_iterator it = this->Exceptions->begin(), it_end = this->Exceptions->end(); it != it_end; ++it)
-		{
-			Exception *e = *it;
-			if (Anope::Match(u->host, e->mask) || Anope::Match(u->ip.addr(), e->mask))
-				return e;
+		if (this->Exceptions->empty())
+			return NULL;
 
-			if (cidr(e->mask).match(u->ip))
-				return e;
-		}
-		return NULL;
+		std::vector<Exception *> candidates;
+		this->exception_cidrs.Find(u->ip, candidates);
+
+		Exception *e = NULL;
+		if (this->exception_masks.FindOldest(u->host, e))
+			candidates.push_back(e);
+		if (this->exception_masks.FindOldest(u->ip.addr(), e))
+			candidates.push_back(e);
+
+		return this->First(candidates);
 	}
 
 	Exception *FindException(const Anope::string &host) anope_override
 	{
-		for (std::vector<Exception *>::const_iterator it = this->Exceptions->begin(), it_end = this->Exceptions->end(); it != it_end; ++it)
-		{
-			Exception *e = *it;
-			if (Anope::Match(host, e->mask))
-				return e;
+		if (this->Exceptions->empty())
+			return NULL;
 
-			if (cidr(e->mask).match(sockaddrs(host)))
-				return e;
-		}
+		std::vector<Exception *> candidates;
+		this->exception_cidrs.Find(sockaddrs(host), candidates);
 
-		return NULL;
+		Exception *e = NULL;
+		if (this->exception_masks.FindOldest(host, e))
+			candidates.push_back(e);
+
+		return this->First(candidates);
 	}
 
 	ExceptionVector &GetExceptions() anope_override
@@ -95,15 +298,16 @@ class MySessionService : public SessionService
 
 	void DelSession(Session *s)
 	{
-		this->Sessions.erase(s->addr);
+		this->Sessions.erase(s->key);
 	}
 
 	Session *FindSession(const Anope::string &ip) anope_override
 	{
-		cidr c(ip, ip.find(':') != Anope::string::npos ? ipv6_cidr : ipv4_cidr);
-		if (!c.valid())
+		sockaddrs addr(ip);
+		SessionKey key(addr, addr.ipv6() ? ipv6_cidr : ipv4_cidr);
+		if (!key.valid())
 			return NULL;
-		SessionMap::iterator it = this->Sessions.find(c);
+		SessionMap::iterator it = this->Sessions.find(key);
 		if (it != this->Sessions.end())
 			return it->second;
 		return NULL;
@@ -111,15 +315,15 @@ class MySessionService : public SessionService
 
 	SessionMap::iterator FindSessionIterator(const sockaddrs &ip)
 	{
-		cidr c(ip, ip.ipv6() ? ipv6_cidr : ipv4_cidr);
-		if (!c.valid())
+		SessionKey key(ip, ip.ipv6() ? ipv6_cidr : ipv4_cidr);
+		if (!key.valid())
 			return this->Sessions.end();
-		return this->Sessions.find(c);
+		return this->Sessions.find(key);
 	}
 
-	Session* &FindOrCreateSession(const cidr &ip)
+	Session* &FindOrCreateSession(const SessionKey &key)
 	{
-		return this->Sessions[ip];
+		return this->Sessions[key];
 	}
 
 	SessionMap &GetSessions() anope_override
@@ -239,22 +443,61 @@ class CommandOSSession : public Command
 		else
 			source.Reply(_("The host \002%s\002 currently has \002%d\002 sessions with a limit of \002%d\002 because it matches entry: \002%s\002."), session->addr.mask().c_str(), session->count, limit, entry.c_str());
 	}
+
+	void DoStats(CommandSource &source)
+	{
+		if (!storm.Active())
+		{
+			source.Reply(_("No session limits have been exceeded recently."));
+			return;
+		}
+
+		std::vector<std::pair<unsigned long, Anope::string> > top;
+		for (std::map<Anope::string, unsigned long>::const_iterator it = storm.cidrs.begin(), it_end = storm.cidrs.end(); it != it_end; ++it)
+			top.push_back(std::make_pair(it->second, it->first));
+		std::sort(top.rbegin(), top.rend());
+		if (top.size() > 10)
+			top.resize(10);
+
+		ListFormatter list(source.GetAccount());
+		list.AddColumn(_("Kills")).AddColumn(_("Host"));
+		for (unsigned i = 0; i < top.size(); ++i)
+		{
+			ListFormatter::ListEntry entry;
+			entry["Kills"] = stringify(top[i].first);
+			entry["Host"] = top[i].second;
+			list.AddEntry(entry);
+		}
+
+		source.Reply(_("Session limits have been exceeded \002%lu\002 times by \002%lu\002 hosts since %s:"), storm.kills, static_cast<unsigned long>(storm.cidrs.size()), Anope::strftime(storm.start, source.GetAccount()).c_str());
+
+		std::vector<Anope::string> replies;
+		list.Process(replies);
+
+		for (unsigned i = 0; i < replies.size(); ++i)
+			source.Reply(replies[i]);
+	}
  public:
-	CommandOSSession(Module *creator) : Command(creator, "operserv/session", 2, 2)
+	CommandOSSession(Module *creator) : Command(creator, "operserv/session", 1, 2)
 	{
 		this->SetDesc(_("View the list of host sessions"));
 		this->SetSyntax(_("LIST \037threshold\037"));
 		this->SetSyntax(_("VIEW \037host\037"));
+		this->SetSyntax("STATS");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
 		const Anope::string &cmd = params[0];
 
-		Log(LOG_ADMIN, source, this) << cmd << " " << params[1];
+		Log(LOG_ADMIN, source, this) << cmd << (params.size() > 1 ? " " + params[1] : "");
 
 		if (!session_limit)
 			source.Reply(_("Session limiting is disabled."));
+		else if (cmd.equals_ci("STATS"))
+			return this->DoStats(source);
+		else if (params.size() < 2)
+			this->OnSyntaxError(source, cmd);
 		else if (cmd.equals_ci("LIST"))
 			return this->DoList(source, params);
 		else if (cmd.equals_ci("VIEW"))
@@ -278,6 +521,10 @@ class CommandOSSession : public Command
 				"host - including the current session count and session limit.\n"
 				"The \037host\037 value may not include wildcards.\n"
 				" \n"
+				"\002SESSION STATS\002 shows the hosts which exceeded their session\n"
+				"limit most often during the current connection storm. A storm\n"
+				"ends once no session limit has been exceeded for five minutes.\n"
+				" \n"
 				"See the \002EXCEPTION\002 help for more information about session\n"
 				"limiting and how to set session limits specific to certain\n"
 				"hosts and groups thereof."));
@@ -627,11 +874,11 @@ class OSSession : public Module
 		if (u->Quitting() || !session_limit || exempt || !u->server || u->server->IsULined())
 			return;
 
-		cidr u_ip(u->ip, u->ip.ipv6() ? ipv6_cidr : ipv4_cidr);
-		if (!u_ip.valid())
+		SessionKey key(u->ip, u->ip.ipv6() ? ipv6_cidr : ipv4_cidr);
+		if (!key.valid())
 			return;
 
-		Session* &session = this->ss.FindOrCreateSession(u_ip);
+		Session* &session = this->ss.FindOrCreateSession(key);
 
 		if (session)
 		{
@@ -672,6 +919,7 @@ class OSSession : public Module
 				}
 
 				++session->hits;
+				storm.Hit(session->addr.mask());
 
 				const Anope::string &akillmask = "*@" + session->addr.mask();
 				if (max_session_kill && session->hits >= max_session_kill && akills && !akills->HasEntry(akillmask))
@@ -11,6 +11,9 @@
 
 #include "module.h"
 #include "modules/os_session.h"
+#include "modules/sql.h"
+#include "modules/ldap.h"
+#include "modules/auth_cache.h"
 
 struct Stats : Serializable
 {
@@ -153,6 +156,10 @@ class CommandOSStats : public Command
 		source.Reply(_("Uplink server: %s"), Me->GetLinks().front()->GetName().c_str());
 		source.Reply(_("Uplink capab: %s"), buf.c_str());
 		source.Reply(_("Servers found: %d"), stats_count_servers(Me->GetLinks().front()));
+
+		const Uplink::OutputStats o = Uplink::GetOutputStats();
+		source.Reply(_("Uplink sendq: %d bytes"), UplinkSock ? UplinkSock->WriteBufferLen() : 0);
+		source.Reply(_("Replies: %lu lines (%lu bytes) queued for %lu users, %llu lines delayed, %llu dropped"), o.lines, o.bytes, o.targets, o.delayed, o.dropped);
 		return;
 	}
 
@@ -164,6 +171,81 @@ class CommandOSStats : public Command
 				max_chain = map.bucket_size(i);
 	}
 
+	void DoStatsDatabase(CommandSource &source)
+	{
+		const Serialize::Counters &c = Serialize::Stats;
+		source.Reply(_("Object updates: %llu queued, %llu skipped as already queued"), static_cast<unsigned long long>(c.updates), static_cast<unsigned long long>(c.updates_skipped));
+		source.Reply(_("Type checks: %llu run, %llu skipped as already run"), static_cast<unsigned long long>(c.checks), static_cast<unsigned long long>(c.checks_skipped));
+
+		std::vector<Anope::string> providers = Service::GetServiceKeys("SQL::Provider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+		{
+			ServiceReference<SQL::Provider> sql("SQL::Provider", providers[i]);
+			if (!sql)
+				continue;
+
+			const SQL::QueueStats s = sql->GetStats();
+			if (!s.queued && !s.queries[SQL::QueueStats::LANE_SYNC] && !s.queries[SQL::QueueStats::LANE_BACKGROUND])
+				continue;
+
+			source.Reply(_("SQL %s: %lu queries queued"), providers[i].c_str(), s.queued);
+			for (int lane = 0; lane < SQL::QueueStats::LANE_SIZE; ++lane)
+				if (s.queries[lane])
+					source.Reply(lane == SQL::QueueStats::LANE_SYNC ? _("SQL %s: %llu immediate queries, average %llums, longest %llums") : _("SQL %s: %llu queued queries, average %llums, longest %llums"),
+						providers[i].c_str(), s.queries[lane], s.total_ms[lane] / s.queries[lane], s.max_ms[lane]);
+		}
+
+		static const char *ldap_types[] = { "other", "bind", "search", "add", "delete", "modify" };
+		providers = Service::GetServiceKeys("LDAPProvider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+		{
+			ServiceReference<LDAPProvider> ldap("LDAPProvider", providers[i]);
+			if (!ldap)
+				continue;
+
+			const LDAPStats s = ldap->GetStats();
+			if (!s.connections)
+				continue;
+
+			source.Reply(_("LDAP %s: %u of %u connections up, %lu requests queued, %lu in progress, %llu reconnects"), providers[i].c_str(), s.connected, s.connections, s.queued, s.active, s.reconnects);
+			for (int t = 0; t <= QUERY_MODIFY; ++t)
+				if (s.requests[t])
+					source.Reply(_("LDAP %s: %llu %s requests, %llu failed, average %llums, longest %llums"), providers[i].c_str(), s.requests[t], ldap_types[t], s.errors[t], s.total_ms[t] / s.requests[t], s.max_ms[t]);
+		}
+	}
+
+	void DoStatsMail(CommandSource &source)
+	{
+		const Mail::Counters c = Mail::GetStats();
+		source.Reply(_("Mail: %lu queued, %lu waiting to be retried"), c.queued, c.retrying);
+		source.Reply(_("Mail: %llu sent, %llu failed, %llu retries, %llu dropped as the queue was full"), c.sent, c.failed, c.retried, c.dropped);
+	}
+
+	void DoStatsAuth(CommandSource &source)
+	{
+		std::vector<Anope::string> caches = Service::GetServiceKeys("ExternalAuth::Cache");
+		for (unsigned i = 0; i < caches.size(); ++i)
+		{
+			ServiceReference<ExternalAuth::Cache> cache("ExternalAuth::Cache", caches[i]);
+			if (!cache)
+				continue;
+
+			const ExternalAuth::Stats &s = cache->stats;
+			source.Reply(_("%s: %llu lookups, %llu answered from the cache, %llu waited on another lookup"), caches[i].c_str(), s.lookups, s.cache_hits, s.coalesced);
+
+			Anope::string buf;
+			for (unsigned j = 0; j < ExternalAuth::LatencyBuckets; ++j)
+			{
+				if (j + 1 < ExternalAuth::LatencyBuckets)
+					buf += " <" + stringify(ExternalAuth::LatencyLimits[j]) + "ms:";
+				else
+					buf += " >=" + stringify(ExternalAuth::LatencyLimits[j - 1]) + "ms:";
+				buf += stringify(s.latency[j]);
+			}
+			source.Reply(_("%s lookup times:%s"), caches[i].c_str(), buf.c_str());
+		}
+	}
+
 	void DoStatsHash(CommandSource &source)
 	{
 		size_t entries, buckets, max_chain;
@@ -171,11 +253,8 @@ class CommandOSStats : public Command
 		GetHashStats(UserListByNick, entries, buckets, max_chain);
 		source.Reply(_("Users (nick): %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
 
-		if (!UserListByUID.empty())
-		{
-			GetHashStats(UserListByUID, entries, buckets, max_chain);
-			source.Reply(_("Users (uid): %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
-		}
+		if (!UserListByUID.Empty())
+			source.Reply(_("Users (uid): %lu entries, %lu slots, longest probe is %lu"), static_cast<unsigned long>(UserListByUID.Size()), static_cast<unsigned long>(UserListByUID.Capacity()), static_cast<unsigned long>(UserListByUID.LongestProbe()));
 
 		GetHashStats(ChannelList, entries, buckets, max_chain);
 		source.Reply(_("Channels: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
@@ -194,6 +273,9 @@ class CommandOSStats : public Command
 			GetHashStats(session_service->GetSessions(), entries, buckets, max_chain);
 			source.Reply(_("Sessions: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
 		}
+
+		const Anope::RegexCacheCounters &rc = Anope::RegexCacheStats;
+		source.Reply(_("Regex cache: %llu entries, %llu hits, %llu misses"), static_cast<unsigned long long>(rc.entries), static_cast<unsigned long long>(rc.hits), static_cast<unsigned long long>(rc.misses));
 	}
 
  public:
@@ -201,7 +283,7 @@ class CommandOSStats : public Command
 		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline")
 	{
 		this->SetDesc(_("Show status of Services and network"));
-		this->SetSyntax("[AKILL | HASH | UPLINK | UPTIME | ALL | RESET]");
+		this->SetSyntax("[AKILL | AUTH | DATABASE | HASH | MAIL | UPLINK | UPTIME | ALL | RESET]");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -216,16 +298,25 @@ class CommandOSStats : public Command
 		if (extra.equals_ci("ALL") || extra.equals_ci("AKILL"))
 			this->DoStatsAkill(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("AUTH"))
+			this->DoStatsAuth(source);
+
+		if (extra.equals_ci("ALL") || extra.equals_ci("DATABASE"))
+			this->DoStatsDatabase(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("HASH"))
 			this->DoStatsHash(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("MAIL"))
+			this->DoStatsMail(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("UPLINK"))
 			this->DoStatsUplink(source);
 
 		if (extra.empty() || extra.equals_ci("ALL") || extra.equals_ci("UPTIME"))
 			this->DoStatsUptime(source);
 
-		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
+		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("AUTH") && !extra.equals_ci("DATABASE") && !extra.equals_ci("HASH") && !extra.equals_ci("MAIL") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
 			source.Reply(_("Unknown STATS option: \002%s\002"), extra.c_str());
 	}
 
@@ -244,9 +335,22 @@ class CommandOSStats : public Command
 				"to the number of users currently present on the network.\n"
 				" \n"
 				"The \002UPLINK\002 option displays information about the current\n"
-				"server Anope uses as an uplink to the network.\n"
+				"server Anope uses as an uplink to the network, and how much\n"
+				"output is waiting to be sent to it.\n"
+				" \n"
+				"The \002DATABASE\002 option displays how many database update\n"
+				"notifications were sent and how many were skipped because\n"
+				"the object had already been queued, and the queue lengths\n"
+				"and query times of the SQL and LDAP servers.\n"
+				" \n"
+				"The \002HASH\002 option displays information about the hash maps\n"
+				"and the cache of compiled regular expressions.\n"
+				" \n"
+				"The \002AUTH\002 option displays how many external authentication\n"
+				"lookups were made or avoided, and how long they took.\n"
 				" \n"
-				"The \002HASH\002 option displays information about the hash maps.\n"
+				"The \002MAIL\002 option displays how much e-mail is waiting\n"
+				"to be sent and how much was sent or failed.\n"
 				" \n"
 				"The \002ALL\002 option displays all of the above statistics."));
 		return true;
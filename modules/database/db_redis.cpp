@@ -71,6 +71,23 @@ class ObjectLoader : public Interface
 	void OnResult(const Reply &r) anope_override;
 };
 
+/* Loads a batch of objects of one type using a server side script, instead of one HGETALL per object */
+class BatchLoader : public Interface
+{
+	Anope::string type;
+	std::vector<Anope::string> ids;
+
+ public:
+	BatchLoader(Module *creator, const Anope::string &t) : Interface(creator), type(t) { }
+
+	void Add(const Anope::string &id) { ids.push_back(id); }
+	size_t Size() const { return ids.size(); }
+	void Send();
+
+	void OnResult(const Reply &r) anope_override;
+	void OnError(const Anope::string &error) anope_override;
+};
+
 class IDInterface : public Interface
 {
 	Reference<Serializable> o;
@@ -123,15 +140,70 @@ class DatabaseRedis : public Module, public Pipe
 	SubscriptionListener sl;
 	std::set<Serializable *> updated_items;
 
+	/* Batches waiting to be sent, and the number sent but not yet answered */
+	std::deque<BatchLoader *> batches;
+	unsigned batches_in_flight;
+
+	/* Load progress */
+	unsigned long objects_loaded;
+	time_t load_start, last_progress;
+
  public:
 	ServiceReference<Provider> redis;
+	unsigned batch_size, batch_window;
 
-	DatabaseRedis(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sl(this)
+	DatabaseRedis(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sl(this),
+		batches_in_flight(0), objects_loaded(0), load_start(0), last_progress(0), batch_size(1000), batch_window(4)
 	{
 		me = this;
 
 	}
 
+	~DatabaseRedis()
+	{
+		for (unsigned i = 0; i < batches.size(); ++i)
+			delete batches[i];
+	}
+
+	void QueueBatch(BatchLoader *b)
+	{
+		batches.push_back(b);
+		this->SendBatches();
+	}
+
+	void OnBatchDone()
+	{
+		--batches_in_flight;
+		this->SendBatches();
+	}
+
+	void SendBatches()
+	{
+		while (batches_in_flight < batch_window && !batches.empty())
+		{
+			BatchLoader *b = batches.front();
+			batches.pop_front();
+
+			++batches_in_flight;
+			b->Send();
+		}
+	}
+
+	void OnObjectLoaded()
+	{
+		++objects_loaded;
+
+		if (objects_loaded % 100000)
+			return;
+
+		time_t now = time(NULL);
+		if (now - last_progress < 5)
+			return;
+		last_progress = now;
+
+		Log(this) << "Loaded " << objects_loaded << " objects so far (" << objects_loaded / std::max<time_t>(now - load_start, 1) << " objects/second)";
+	}
+
 	/* Insert or update an object */
 	void InsertObject(Serializable *obj)
 	{
@@ -169,12 +241,16 @@ class DatabaseRedis : public Module, public Pipe
 		}
 
 		this->updated_items.clear();
+		/* Objects changed from now on need to be queued again */
+		Serialize::NewGeneration();
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
 		Configuration::Block *block = conf->GetModule(this);
 		this->redis = ServiceReference<Provider>("Redis::Provider", block->Get<const Anope::string>("engine", "redis/main"));
+		this->batch_size = std::max(block->Get<unsigned>("loadbatch", "1000"), 1U);
+		this->batch_window = std::max(block->Get<unsigned>("loadwindow", "4"), 1U);
 	}
 
 	EventReturn OnLoadDatabase() anope_override
@@ -185,6 +261,9 @@ class DatabaseRedis : public Module, public Pipe
 			return EVENT_CONTINUE;
 		}
 
+		load_start = last_progress = time(NULL);
+		objects_loaded = 0;
+
 		const std::vector<Anope::string> type_order = Serialize::Type::GetTypeOrder();
 		for (unsigned i = 0; i < type_order.size(); ++i)
 		{
@@ -200,6 +279,9 @@ class DatabaseRedis : public Module, public Pipe
 			return EVENT_CONTINUE;
 		}
 
+		time_t took = time(NULL) - load_start;
+		Log(this) << "Loaded " << objects_loaded << " objects in " << took << " seconds (" << objects_loaded / std::max<time_t>(took, 1) << " objects/second)";
+
 		redis->Subscribe(&this->sl, "__keyspace@*__:hash:*");
 
 		return EVENT_STOP;
@@ -258,6 +340,30 @@ class DatabaseRedis : public Module, public Pipe
 	}
 };
 
+/* Loads one object from a flattened HGETALL reply */
+static void LoadObject(Serialize::Type *st, int64_t id, const Reply &r, unsigned start, unsigned count)
+{
+	Data data;
+
+	for (unsigned i = start; i + 1 < start + count; i += 2)
+	{
+		const Reply *key = r.multi_bulk[i],
+			*value = r.multi_bulk[i + 1];
+
+		data[key->bulk] << value->bulk;
+	}
+
+	Serializable* &obj = st->objects[id];
+	obj = st->Unserialize(obj, data);
+	if (obj)
+	{
+		obj->id = id;
+		obj->UpdateCache(data);
+	}
+
+	me->OnObjectLoaded();
+}
+
 void TypeLoader::OnResult(const Reply &r)
 {
 	if (r.type != Reply::MULTI_BULK || !me->redis)
@@ -266,6 +372,8 @@ void TypeLoader::OnResult(const Reply &r)
 		return;
 	}
 
+	BatchLoader *batch = NULL;
+
 	for (unsigned i = 0; i < r.multi_bulk.size(); ++i)
 	{
 		const Reply *reply = r.multi_bulk[i];
@@ -273,54 +381,141 @@ void TypeLoader::OnResult(const Reply &r)
 		if (reply->type != Reply::BULK)
 			continue;
 
-		int64_t id;
 		try
 		{
-			id = convertTo<int64_t>(reply->bulk);
+			convertTo<int64_t>(reply->bulk);
 		}
 		catch (const ConvertException &)
 		{
 			continue;
 		}
 
-		std::vector<Anope::string> args;
-		args.push_back("HGETALL");
-		args.push_back("hash:" + this->type + ":" + stringify(id));
+		if (batch == NULL)
+			batch = new BatchLoader(me, this->type);
+
+		batch->Add(reply->bulk);
 
-		me->redis->SendCommand(new ObjectLoader(me, this->type, id), args);
+		if (batch->Size() >= me->batch_size)
+		{
+			me->QueueBatch(batch);
+			batch = NULL;
+		}
 	}
 
+	if (batch != NULL)
+		me->QueueBatch(batch);
+
 	delete this;
 }
 
-void ObjectLoader::OnResult(const Reply &r)
+/* For each id given after the key prefix, returns the id, the number of
+ * fields in its hash and then the hash's fields and values. Flattening the
+ * reply like this keeps it a single level multi bulk.
+ */
+static const char *batch_script =
+	"local r = {} "
+	"for i = 2, #ARGV do "
+		"local h = redis.call('HGETALL', ARGV[1] .. ARGV[i]) "
+		"r[#r + 1] = ARGV[i] "
+		"r[#r + 1] = #h "
+		"for j = 1, #h do r[#r + 1] = h[j] end "
+	"end "
+	"return r";
+
+void BatchLoader::Send()
+{
+	std::vector<Anope::string> args;
+	args.reserve(ids.size() + 4);
+	args.push_back("EVAL");
+	args.push_back(batch_script);
+	args.push_back("0");
+	args.push_back("hash:" + this->type + ":");
+	args.insert(args.end(), ids.begin(), ids.end());
+
+	me->redis->SendCommand(this, args);
+}
+
+void BatchLoader::OnResult(const Reply &r)
 {
 	Serialize::Type *st = Serialize::Type::Find(this->type);
 
-	if (r.type != Reply::MULTI_BULK || r.multi_bulk.empty() || !me->redis || !st)
+	me->OnBatchDone();
+
+	if (r.type != Reply::MULTI_BULK || !me->redis || !st)
 	{
 		delete this;
 		return;
 	}
 
-	Data data;
+	for (unsigned i = 0; i + 1 < r.multi_bulk.size();)
+	{
+		const Reply *id_reply = r.multi_bulk[i], *count_reply = r.multi_bulk[i + 1];
+		i += 2;
 
-	for (unsigned i = 0; i + 1 < r.multi_bulk.size(); i += 2)
+		if (count_reply->type != Reply::INT || count_reply->i < 0 || i + static_cast<uint64_t>(count_reply->i) > r.multi_bulk.size())
+			break;
+
+		unsigned count = count_reply->i;
+
+		int64_t id;
+		try
+		{
+			id = convertTo<int64_t>(id_reply->bulk);
+		}
+		catch (const ConvertException &)
+		{
+			i += count;
+			continue;
+		}
+
+		/* Objects which have since been deleted */
+		if (count)
+			LoadObject(st, id, r, i, count);
+
+		i += count;
+	}
+
+	delete this;
+}
+
+void BatchLoader::OnError(const Anope::string &error)
+{
+	me->OnBatchDone();
+
+	/* Scripting is unavailable (redis older than 2.6), fall back to loading each object on its own.
+	 * Other errors are the connection or a module going away, and there is nothing to fall back to.
+	 */
+	if (error.find("ERR") == 0 && me->redis && !me->redis->IsSocketDead())
 	{
-		const Reply *key = r.multi_bulk[i],
-			*value = r.multi_bulk[i + 1];
+		Log(LOG_DEBUG) << "redis: unable to batch load " << this->type << " objects, loading them individually: " << error;
 
-		data[key->bulk] << value->bulk;
+		for (unsigned i = 0; i < ids.size(); ++i)
+		{
+			std::vector<Anope::string> args;
+			args.push_back("HGETALL");
+			args.push_back("hash:" + this->type + ":" + ids[i]);
+
+			me->redis->SendCommand(new ObjectLoader(me, this->type, convertTo<int64_t>(ids[i])), args);
+		}
 	}
+	else
+		Interface::OnError(error);
 
-	Serializable* &obj = st->objects[this->id];
-	obj = st->Unserialize(obj, data);
-	if (obj)
+	delete this;
+}
+
+void ObjectLoader::OnResult(const Reply &r)
+{
+	Serialize::Type *st = Serialize::Type::Find(this->type);
+
+	if (r.type != Reply::MULTI_BULK || r.multi_bulk.empty() || !me->redis || !st)
 	{
-		obj->id = this->id;
-		obj->UpdateCache(data);
+		delete this;
+		return;
 	}
 
+	LoadObject(st, this->id, r, 0, r.multi_bulk.size());
+
 	delete this;
 }
 
@@ -12,6 +12,10 @@
 #include "module.h"
 #include "modules/sql.h"
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 using namespace SQL;
 
 class SQLSQLInterface : public Interface
@@ -55,19 +59,66 @@ public:
 	}
 };
 
+/* Reports how long a flush took once its COMMIT has completed */
+class FlushSQLInterface : public SQLSQLInterface
+{
+	struct timeval started;
+	unsigned rows, statements;
+
+ public:
+	FlushSQLInterface(Module *o, const struct timeval &s, unsigned r, unsigned st) : SQLSQLInterface(o), started(s), rows(r), statements(st) { }
+
+	void OnResult(const Result &r) anope_override
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		long ms = (now.tv_sec - started.tv_sec) * 1000 + (now.tv_usec - started.tv_usec) / 1000;
+
+		Log(LOG_DEBUG) << "db_sql: Committed " << rows << " row(s) in " << statements << " statement(s) in " << ms << "ms";
+		delete this;
+	}
+
+	void OnError(const Result &r) anope_override
+	{
+		SQLSQLInterface::OnError(r);
+		delete this;
+	}
+};
+
 class DBSQL : public Module, public Pipe
 {
 	ServiceReference<Provider> sql;
 	SQLSQLInterface sqlinterface;
 	Anope::string prefix;
 	bool import;
+	unsigned batch_size;
 
 	std::set<Serializable *> updated_items;
+	/* Ids of deleted objects waiting to be removed, by table */
+	std::map<Anope::string, std::vector<uint64_t> > deleted_items;
+	/* Columns we have already made sure exist, by table */
+	std::map<Anope::string, std::set<Anope::string> > known_columns;
 	bool shutting_down;
 	bool loading_databases;
 	bool loaded;
 	bool imported;
 
+	/* Returns the queries needed to make table able to hold data, if any */
+	std::vector<Query> CheckSchema(const Anope::string &table, const Data &data)
+	{
+		std::set<Anope::string> &columns = this->known_columns[table];
+
+		for (Data::Map::const_iterator it = data.data.begin(), it_end = data.data.end(); it != it_end; ++it)
+			if (!columns.count(it->first))
+			{
+				for (it = data.data.begin(); it != it_end; ++it)
+					columns.insert(it->first);
+				return this->sql->CreateTable(table, data);
+			}
+
+		return std::vector<Query>();
+	}
+
 	void RunBackground(const Query &q, Interface *iface = NULL)
 	{
 		if (!this->sql)
@@ -90,7 +141,7 @@ class DBSQL : public Module, public Pipe
 	}
 
  public:
-	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), shutting_down(false), loading_databases(false), loaded(false), imported(false)
+	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), import(false), batch_size(100), shutting_down(false), loading_databases(false), loaded(false), imported(false)
 	{
 
 
@@ -100,37 +151,69 @@ class DBSQL : public Module, public Pipe
 
 	void OnNotify() anope_override
 	{
+		struct timeval started;
+		gettimeofday(&started, NULL);
+
+		/* Everything to run for this flush, in order, and the objects new rows are inserted for */
+		std::vector<std::pair<Query, Serializable *> > queries;
+		/* Rows of objects which already have an id, by table */
+		std::map<Anope::string, std::vector<std::pair<unsigned int, Data *> > > rows;
+		unsigned row_count = 0;
+
+		if (this->sql)
+			for (std::map<Anope::string, std::vector<uint64_t> >::iterator it = this->deleted_items.begin(), it_end = this->deleted_items.end(); it != it_end; ++it)
+				for (unsigned i = 0; i < it->second.size(); i += this->batch_size)
+				{
+					Anope::string ids;
+					for (unsigned j = i; j < it->second.size() && j < i + this->batch_size; ++j)
+						ids += (ids.empty() ? "" : ",") + stringify(it->second[j]);
+
+					queries.push_back(std::make_pair(Query("DELETE FROM `" + it->first + "` WHERE `id` IN (" + ids + ")"), static_cast<Serializable *>(NULL)));
+				}
+		this->deleted_items.clear();
+
 		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
 		{
 			Serializable *obj = *it;
 
 			if (this->sql)
 			{
-				Data data;
-				obj->Serialize(data);
+				Data *data = new Data();
+				obj->Serialize(*data);
 
-				if (obj->IsCached(data))
+				if (obj->IsCached(*data))
+				{
+					delete data;
 					continue;
+				}
 
-				obj->UpdateCache(data);
+				obj->UpdateCache(*data);
 
 				/* If we didn't load these objects and we don't want to import just update the cache and continue */
-				if (!this->loaded && !this->imported && !this->import)
-					continue;
-
 				Serialize::Type *s_type = obj->GetSerializableType();
-				if (!s_type)
+				if ((!this->loaded && !this->imported && !this->import) || !s_type)
+				{
+					delete data;
 					continue;
+				}
 
-				std::vector<Query> create = this->sql->CreateTable(this->prefix + s_type->GetName(), data);
-				Query insert = this->sql->BuildInsert(this->prefix + s_type->GetName(), obj->id, data);
+				const Anope::string table = this->prefix + s_type->GetName();
+				std::vector<Query> create = this->CheckSchema(table, *data);
 
 				if (this->imported)
 				{
 					for (unsigned i = 0; i < create.size(); ++i)
-						this->RunBackground(create[i]);
+						queries.push_back(std::make_pair(create[i], static_cast<Serializable *>(NULL)));
+
+					++row_count;
+					if (obj->id > 0)
+					{
+						rows[table].push_back(std::make_pair(obj->id, data));
+						continue;
+					}
 
-					this->RunBackground(insert, new ResultSQLSQLInterface(this, obj));
+					/* New objects are inserted on their own to learn their id */
+					queries.push_back(std::make_pair(this->sql->BuildInsert(table, obj->id, *data), obj));
 				}
 				else
 				{
@@ -140,14 +223,49 @@ class DBSQL : public Module, public Pipe
 					/* We are importing objects from another database module, so don't do asynchronous
 					 * queries in case the core has to shut down, it will cut short the import
 					 */
-					Result r = this->sql->RunQuery(insert);
+					Result r = this->sql->RunQuery(this->sql->BuildInsert(table, obj->id, *data));
 					if (r.GetID() > 0)
 						obj->id = r.GetID();
 				}
+
+				delete data;
 			}
 		}
 
 		this->updated_items.clear();
+
+		for (std::map<Anope::string, std::vector<std::pair<unsigned int, Data *> > >::iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it)
+		{
+			std::vector<std::pair<unsigned int, Data *> > &table_rows = it->second;
+
+			for (unsigned i = 0; i < table_rows.size(); i += this->batch_size)
+			{
+				std::vector<std::pair<unsigned int, Data *> > batch(table_rows.begin() + i, table_rows.begin() + std::min<size_t>(i + this->batch_size, table_rows.size()));
+				queries.push_back(std::make_pair(this->sql->BuildInsert(it->first, batch), static_cast<Serializable *>(NULL)));
+			}
+
+			for (unsigned i = 0; i < table_rows.size(); ++i)
+				delete table_rows[i].second;
+		}
+
+		if (!queries.empty())
+		{
+			/* Group everything in one transaction so the server only syncs to disk once */
+			bool transaction = queries.size() > 1;
+			if (transaction)
+				this->RunBackground(Query("BEGIN"));
+
+			for (unsigned i = 0; i < queries.size(); ++i)
+				this->RunBackground(queries[i].first, queries[i].second ? new ResultSQLSQLInterface(this, queries[i].second) : NULL);
+
+			if (transaction)
+				this->RunBackground(Query("COMMIT"), new FlushSQLInterface(this, started, row_count, queries.size()));
+
+			Log(LOG_DEBUG) << "db_sql: Flushing " << row_count << " row(s) in " << queries.size() << " statement(s)";
+		}
+
+		/* Objects changed from now on need to be queued again */
+		Serialize::NewGeneration();
 		this->imported = true;
 	}
 
@@ -157,6 +275,8 @@ class DBSQL : public Module, public Pipe
 		this->sql = ServiceReference<Provider>("SQL::Provider", block->Get<const Anope::string>("engine"));
 		this->prefix = block->Get<const Anope::string>("prefix", "anope_db_");
 		this->import = block->Get<bool>("import");
+		this->batch_size = std::max(block->Get<unsigned>("batchsize", "100"), 1U);
+		this->known_columns.clear();
 	}
 
 	void OnShutdown() anope_override
@@ -208,7 +328,10 @@ class DBSQL : public Module, public Pipe
 			return;
 		Serialize::Type *s_type = obj->GetSerializableType();
 		if (s_type && obj->id > 0)
-			this->RunBackground("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = " + stringify(obj->id));
+		{
+			this->deleted_items[this->prefix + s_type->GetName()].push_back(obj->id);
+			this->Notify();
+		}
 		this->updated_items.erase(obj);
 	}
 
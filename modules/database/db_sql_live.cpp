@@ -21,6 +21,15 @@ class DBMySQL : public Module, public Pipe
 	bool init;
 	std::set<Serializable *> updated_items;
 
+	/* Whether to tail the trigger populated change log instead of polling tables by timestamp */
+	bool changelog;
+	bool changelog_open;
+	time_t changelog_read;
+	/* Types whose tables have change log triggers */
+	std::set<Anope::string> logged_types;
+	/* Ids of changed objects not fetched yet, by type */
+	std::map<Anope::string, std::set<unsigned int> > changed;
+
 	bool CheckSQL()
 	{
 		if (SQL)
@@ -71,13 +80,185 @@ class DBMySQL : public Module, public Pipe
 		throw SQL::Exception("No SQL!");
 	}
 
+	/* Deletes our copy of the object with the given id, if we have one */
+	void DeleteObject(Serialize::Type *obj, unsigned int id)
+	{
+		std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
+		if (it != obj->objects.end())
+			delete it->second; // This also removes this object from the map
+	}
+
+	/* Creates or updates our copy of the object with the given id from its row */
+	void UpdateObject(Serialize::Type *obj, unsigned int id, const std::map<Anope::string, Anope::string> &row)
+	{
+		Data data;
+
+		for (std::map<Anope::string, Anope::string>::const_iterator it = row.begin(), it_end = row.end(); it != it_end; ++it)
+			data[it->first] << it->second;
+
+		Serializable *s = NULL;
+		std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
+		if (it != obj->objects.end())
+			s = it->second;
+
+		Serializable *new_s = obj->Unserialize(s, data);
+		if (new_s)
+		{
+			// If s == new_s then s->id == new_s->id
+			if (s != new_s)
+			{
+				new_s->id = id;
+				obj->objects[id] = new_s;
+
+				/* The Unserialize operation is destructive so rebuild the data for UpdateCache.
+				 * Also the old data may contain columns that we don't use, so we reserialize the
+				 * object to know for sure our cache is consistent
+				 */
+
+				Data data2;
+				new_s->Serialize(data2);
+				new_s->UpdateCache(data2); /* We know this is the most up to date copy */
+			}
+		}
+		else
+		{
+			if (!s)
+				this->RunQuery("UPDATE `" + prefix + obj->GetName() + "` SET `timestamp` = " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " WHERE `id` = " + stringify(id));
+			else
+				delete s;
+		}
+	}
+
+	/* Creates the change log triggers on the table of a type, returns true if changes to it are logged */
+	bool LogChanges(Serialize::Type *obj)
+	{
+		if (this->logged_types.count(obj->GetName()))
+			return true;
+
+		std::vector<Query> create = this->SQL->CreateChangeLog(this->prefix + "changelog", this->prefix + obj->GetName(), obj->GetName());
+		for (unsigned i = 0; i < create.size(); ++i)
+		{
+			Result res = this->RunQueryResult(create[i]);
+			if (!res.GetError().empty())
+			{
+				/* Most likely the table does not exist yet, this is retried when we create it */
+				Log(LOG_DEBUG) << "SQL-live: Unable to log changes to " << obj->GetName() << ", polling it instead";
+				return false;
+			}
+		}
+
+		this->logged_types.insert(obj->GetName());
+		return true;
+	}
+
+	/* Starts reading the change log, if it can be read. Rows left in it from before are read once
+	 * too, which only fetches those objects again.
+	 */
+	void OpenChangeLog()
+	{
+		if (this->changelog_open)
+			return;
+
+		Result res = this->RunQueryResult("SELECT `id` FROM `" + this->prefix + "changelog` LIMIT 1");
+		if (!res.GetError().empty())
+			return;
+
+		this->changelog_open = true;
+	}
+
+	/* Reads new change log rows into changed, at most once a second. Returns false if the log can not be read. */
+	bool ReadChangeLog()
+	{
+		if (this->changelog_read == Anope::CurTime)
+			return true;
+
+		/* Ids are not committed in order, so rather than tailing the log past the highest id read,
+		 * every row in it is read and then exactly those rows are deleted
+		 */
+		Result res = this->RunQueryResult("SELECT `id`, `type`, `object_id` FROM `" + this->prefix + "changelog`");
+		if (!res.GetError().empty())
+			return false;
+
+		this->changelog_read = Anope::CurTime;
+
+		Anope::string ids;
+		for (int i = 0; i < res.Rows(); ++i)
+		{
+			try
+			{
+				ids += (ids.empty() ? "" : ",") + stringify(convertTo<uint64_t>(res.Get(i, "id")));
+				this->changed[res.Get(i, "type")].insert(convertTo<unsigned int>(res.Get(i, "object_id")));
+			}
+			catch (const ConvertException &) { }
+		}
+
+		/* Everything read has been queued, so the log does not need it anymore */
+		if (!ids.empty())
+			this->RunQuery("DELETE FROM `" + this->prefix + "changelog` WHERE `id` IN (" + ids + ")");
+
+		return true;
+	}
+
+	/* Fetches the objects of a type which the change log says were changed */
+	void FetchChanges(Serialize::Type *obj)
+	{
+		std::map<Anope::string, std::set<unsigned int> >::iterator cit = this->changed.find(obj->GetName());
+		if (cit == this->changed.end())
+			return;
+
+		Anope::string ids;
+		for (std::set<unsigned int>::iterator it = cit->second.begin(), it_end = cit->second.end(); it != it_end; ++it)
+			ids += (ids.empty() ? "" : ",") + stringify(*it);
+
+		Result res = this->RunQueryResult("SELECT * FROM `" + this->prefix + obj->GetName() + "` WHERE `id` IN (" + ids + ")");
+		if (!res.GetError().empty())
+			return;
+
+		std::set<unsigned int> gone;
+		gone.swap(cit->second);
+		this->changed.erase(cit);
+
+		bool clear_null = false;
+		for (int i = 0; i < res.Rows(); ++i)
+		{
+			unsigned int id;
+			try
+			{
+				id = convertTo<unsigned int>(res.Get(i, "id"));
+			}
+			catch (const ConvertException &)
+			{
+				Log(LOG_DEBUG) << "Unable to convert id from " << obj->GetName();
+				continue;
+			}
+
+			gone.erase(id);
+
+			if (res.Get(i, "timestamp").empty())
+			{
+				clear_null = true;
+				this->DeleteObject(obj, id);
+			}
+			else
+				this->UpdateObject(obj, id, res.Row(i));
+		}
+
+		/* Rows which were logged but no longer exist have been deleted */
+		for (std::set<unsigned int>::iterator it = gone.begin(), it_end = gone.end(); it != it_end; ++it)
+			this->DeleteObject(obj, *it);
+
+		if (clear_null)
+			this->RunQuery("DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL");
+	}
+
  public:
 	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", "")
 	{
 		this->lastwarn = 0;
 		this->ro = false;
 		this->init = false;
-
+		this->changelog = this->changelog_open = false;
+		this->changelog_read = 0;
 
 		if (ModuleManager::FindFirstOf(DATABASE) != this)
 			throw ModuleException("If db_sql_live is loaded it must be the first database module loaded.");
@@ -110,6 +291,9 @@ class DBMySQL : public Module, public Pipe
 				for (unsigned i = 0; i < create.size(); ++i)
 					this->RunQueryResult(create[i]);
 
+				if (this->changelog && !create.empty() && this->LogChanges(s_type))
+					this->OpenChangeLog();
+
 				Result res = this->RunQueryResult(this->SQL->BuildInsert(this->prefix + s_type->GetName(), obj->id, data));
 				if (res.GetID() && obj->id != res.GetID())
 				{
@@ -121,6 +305,8 @@ class DBMySQL : public Module, public Pipe
 		}
 
 		this->updated_items.clear();
+		/* Objects changed from now on need to be queued again */
+		Serialize::NewGeneration();
 	}
 
 	EventReturn OnLoadDatabase() anope_override
@@ -144,6 +330,7 @@ class DBMySQL : public Module, public Pipe
 		Configuration::Block *block = conf->GetModule(this);
 		this->SQL = ServiceReference<Provider>("SQL::Provider", block->Get<const Anope::string>("engine"));
 		this->prefix = block->Get<const Anope::string>("prefix", "anope_db_");
+		this->changelog = block->Get<bool>("changelog");
 	}
 
 	void OnSerializableConstruct(Serializable *obj) anope_override
@@ -174,6 +361,17 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit() || obj->GetTimestamp() == Anope::CurTime)
 			return;
 
+		/* Once a type has been loaded, only fetch the rows the change log says were changed */
+		if (obj->GetTimestamp() && this->changelog_open && this->logged_types.count(obj->GetName()) && this->ReadChangeLog())
+		{
+			obj->UpdateTimestamp();
+			this->FetchChanges(obj);
+			return;
+		}
+
+		if (this->changelog && !obj->GetTimestamp() && this->LogChanges(obj))
+			this->OpenChangeLog();
+
 		Query query("SELECT * FROM `" + this->prefix + obj->GetName() + "` WHERE (`timestamp` >= " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " OR `timestamp` IS NULL)");
 
 		obj->UpdateTimestamp();
@@ -183,8 +381,6 @@ class DBMySQL : public Module, public Pipe
 		bool clear_null = false;
 		for (int i = 0; i < res.Rows(); ++i)
 		{
-			const std::map<Anope::string, Anope::string> &row = res.Row(i);
-
 			unsigned int id;
 			try
 			{
@@ -199,49 +395,10 @@ class DBMySQL : public Module, public Pipe
 			if (res.Get(i, "timestamp").empty())
 			{
 				clear_null = true;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					delete it->second; // This also removes this object from the map
+				this->DeleteObject(obj, id);
 			}
 			else
-			{
-				Data data;
-
-				for (std::map<Anope::string, Anope::string>::const_iterator it = row.begin(), it_end = row.end(); it != it_end; ++it)
-					data[it->first] << it->second;
-
-				Serializable *s = NULL;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					s = it->second;
-
-				Serializable *new_s = obj->Unserialize(s, data);
-				if (new_s)
-				{
-					// If s == new_s then s->id == new_s->id
-					if (s != new_s)
-					{
-						new_s->id = id;
-						obj->objects[id] = new_s;
-
-						/* The Unserialize operation is destructive so rebuild the data for UpdateCache.
-						 * Also the old data may contain columns that we don't use, so we reserialize the
-						 * object to know for sure our cache is consistent
-						 */
-
-						Data data2;
-						new_s->Serialize(data2);
-						new_s->UpdateCache(data2); /* We know this is the most up to date copy */
-					}
-				}
-				else
-				{
-					if (!s)
-						this->RunQuery("UPDATE `" + prefix + obj->GetName() + "` SET `timestamp` = " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " WHERE `id` = " + stringify(id));
-					else
-						delete s;
-				}
-			}
+				this->UpdateObject(obj, id, res.Row(i));
 		}
 
 		if (clear_null)
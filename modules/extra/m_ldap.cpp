@@ -16,8 +16,12 @@
 #include "modules/ldap.h"
 #include <ldap.h>
 
+#ifndef _WIN32
+# include <sys/time.h>
+#endif
+
 class LDAPService;
-static Pipe *me;
+static Notifier *me;
 
 class LDAPRequest
 {
@@ -26,18 +30,35 @@ class LDAPRequest
 	LDAPInterface *inter;
 	LDAPMessage *message; /* message returned by ldap_ */
 	LDAPResult *result; /* final result */
-	struct timeval tv;
 	QueryType type;
+	/* Who was last bound as when the request was queued. Binds are made as this,
+	 * and other requests are sent on a connection bound as this.
+	 */
+	Anope::string who, pass;
+	/* The id of the request on its connection, or -1 if it has not been sent */
+	int msgid;
+	/* When the request was queued, and when it was sent */
+	struct timeval queued, sent;
+	/* Whether the request is being sent again after its connection was lost */
+	bool retried;
+	/* Whether the connection was already bound again for this request */
+	bool rebound;
+	/* Whether the request was made by the connection itself, so has no result */
+	bool internal;
 
 	LDAPRequest(LDAPService *s, LDAPInterface *i)
 		: service(s)
 		, inter(i)
 		, message(NULL)
 		, result(NULL)
+		, msgid(-1)
+		, retried(false)
+		, rebound(false)
+		, internal(false)
 	{
 		type = QUERY_UNKNOWN;
-		tv.tv_sec = 0;
-		tv.tv_usec = 100000;
+		gettimeofday(&queued, NULL);
+		sent = queued;
 	}
 
 	virtual ~LDAPRequest()
@@ -49,40 +70,44 @@ class LDAPRequest
 			ldap_msgfree(message);
 	}
 
-	virtual int run() = 0;
+	/** Send the request without waiting for the answer, which is matched to it by msgid
+	 * @param con The connection to send it on
+	 * @return An LDAP error code
+	 */
+	virtual int send(LDAP *con) = 0;
 };
 
 class LDAPBind : public LDAPRequest
 {
-	Anope::string who, pass;
-
  public:
 	LDAPBind(LDAPService *s, LDAPInterface *i, const Anope::string &w, const Anope::string &p)
 		: LDAPRequest(s, i)
-		, who(w)
-		, pass(p)
 	{
 		type = QUERY_BIND;
+		who = w;
+		pass = p;
 	}
 
-	int run() anope_override;
+	int send(LDAP *con) anope_override;
 };
 
 class LDAPSearch : public LDAPRequest
 {
 	Anope::string base;
 	Anope::string filter;
+	int scope;
 
  public:
-	LDAPSearch(LDAPService *s, LDAPInterface *i, const Anope::string &b, const Anope::string &f)
+	LDAPSearch(LDAPService *s, LDAPInterface *i, const Anope::string &b, const Anope::string &f, int sc = LDAP_SCOPE_SUBTREE)
 		: LDAPRequest(s, i)
 		, base(b)
 		, filter(f)
+		, scope(sc)
 	{
 		type = QUERY_SEARCH;
 	}
 
-	int run() anope_override;
+	int send(LDAP *con) anope_override;
 };
 
 class LDAPAdd : public LDAPRequest
@@ -99,7 +124,7 @@ class LDAPAdd : public LDAPRequest
 		type = QUERY_ADD;
 	}
 
-	int run() anope_override;
+	int send(LDAP *con) anope_override;
 };
 
 class LDAPDel : public LDAPRequest
@@ -114,7 +139,7 @@ class LDAPDel : public LDAPRequest
 		type = QUERY_DELETE;
 	}
 
-	int run() anope_override;
+	int send(LDAP *con) anope_override;
 };
 
 class LDAPModify : public LDAPRequest
@@ -131,18 +156,87 @@ class LDAPModify : public LDAPRequest
 		type = QUERY_MODIFY;
 	}
 
-	int run() anope_override;
+	int send(LDAP *con) anope_override;
+};
+
+/** A connection to the LDAP server with its own thread. Several requests are in
+ * flight on it at once, except binds, which change who the connection is bound
+ * as and so are only sent when nothing else is.
+ */
+class LDAPConnection : public Thread
+{
+	LDAPService *service;
+	LDAP *con;
+
+	/* Who the connection is bound as */
+	Anope::string who, pass;
+	/* Whether a bind is in flight, nothing else is sent until it is answered */
+	bool binding;
+	/* When the connection may be made again, and how long to wait if that fails too */
+	time_t retry, backoff;
+	/* When something was last received, the connection is checked if this was long ago */
+	time_t last_activity;
+	/* Whether the connection was lost, so the next one made is a reconnect */
+	bool lost;
+	/* Whether results were added for the main thread */
+	bool notify;
+
+	void Connect();
+
+	/** Close the connection after an error. Requests in flight are sent again on
+	 * another connection if they have not been already.
+	 */
+	void Reset(const Anope::string &error);
+
+	/** Take requests from the queue of the service */
+	void Take();
+
+	/** Send the requests taken which can be sent now */
+	void Send();
+
+	/** Read the answers which have arrived, and give up on requests which waited too long */
+	void Read();
+
+	/** Finish a request taken by this connection */
+	void Complete(LDAPRequest *req, int res);
+
+	void BuildReply(int res, LDAPRequest *req);
+
+ public:
+	/* Requests taken from the queue, sent or not. Changed with the service lock held */
+	std::vector<LDAPRequest *> active;
+	/* Whether the connection is up. Changed with the service lock held */
+	bool connected;
+
+	LDAPConnection(LDAPService *s) : service(s), con(NULL), binding(false), retry(0), backoff(1), last_activity(0), lost(false), notify(false), connected(false) { }
+
+	~LDAPConnection()
+	{
+		if (this->con)
+			ldap_unbind_ext(this->con, NULL, NULL);
+	}
+
+	/** Open the connection
+	 * @throws LDAPException if the server can not be used
+	 */
+	void Open();
+
+	void Run() anope_override;
 };
 
-class LDAPService : public LDAPProvider, public Thread, public Condition
+class LDAPService : public LDAPProvider, public Condition
 {
-	Anope::string server;
 	Anope::string admin_binddn;
 	Anope::string admin_pass;
 
-	LDAP *con;
+	/* Who was last bound as, requests queued after the bind are made as this */
+	Anope::string bound_who, bound_pass;
+	/* Credentials which were refused, requests made as them are sent anonymously
+	 * instead of binding as them again on every connection
+	 */
+	std::set<std::pair<Anope::string, Anope::string> > refused;
 
-	time_t last_connect;
+	LDAPStats stats;
 
  public:
 	static LDAPMod **BuildMods(const LDAPMods &attributes)
@@ -185,64 +279,85 @@ class LDAPService : public LDAPProvider, public Thread, public Condition
 	}
 
  private:
-	void Connect()
-	{
-		int i = ldap_initialize(&this->con, this->server.c_str());
-		if (i != LDAP_SUCCESS)
-			throw LDAPException("Unable to connect to LDAP service " + this->name + ": " + ldap_err2string(i));
-
-		const int version = LDAP_VERSION3;
-		i = ldap_set_option(this->con, LDAP_OPT_PROTOCOL_VERSION, &version);
-		if (i != LDAP_OPT_SUCCESS)
-			throw LDAPException("Unable to set protocol version for " + this->name + ": " + ldap_err2string(i));
-
-		const struct timeval tv = { 0, 0 };
-		i = ldap_set_option(this->con, LDAP_OPT_NETWORK_TIMEOUT, &tv);
-		if (i != LDAP_OPT_SUCCESS)
-			throw LDAPException("Unable to set timeout for " + this->name + ": " + ldap_err2string(i));
-	}
-
-	void Reconnect()
-	{
-		/* Only try one connect a minute. It is an expensive blocking operation */
-		if (last_connect > Anope::CurTime - 60)
-			throw LDAPException("Unable to connect to LDAP service " + this->name + ": reconnecting too fast");
-		last_connect = Anope::CurTime;
-
-		ldap_unbind_ext(this->con, NULL, NULL);
-
-		Connect();
-	}
-
 	void QueueRequest(LDAPRequest *r)
 	{
 		this->Lock();
+		if (r->type == QUERY_BIND)
+		{
+			this->bound_who = r->who;
+			this->bound_pass = r->pass;
+		}
+		else
+		{
+			r->who = this->bound_who;
+			r->pass = this->bound_pass;
+		}
 		this->queries.push_back(r);
-		this->Wakeup();
+		this->WakeAll();
 		this->Unlock();
 	}
 
  public:
-	typedef std::vector<LDAPRequest *> query_queue;
-	query_queue queries, results;
-	Mutex process_mutex; /* held when processing requests not in either queue */
-
-	LDAPService(Module *o, const Anope::string &n, const Anope::string &s, const Anope::string &b, const Anope::string &p) : LDAPProvider(o, n), server(s), admin_binddn(b), admin_pass(p), last_connect(0)
+	typedef std::deque<LDAPRequest *> query_queue;
+	/* Requests waiting for a connection */
+	query_queue queries;
+	/* Finished requests waiting for the main thread */
+	MPSCQueue<LDAPRequest *> results;
+	std::vector<LDAPConnection *> connections;
+
+	const Anope::string server;
+	/* How many requests may be in flight on one connection */
+	const unsigned pipeline;
+	/* How long a request may wait for a connection, and then for its answer */
+	const time_t timeout;
+
+	LDAPService(Module *o, const Anope::string &n, const Anope::string &s, const Anope::string &b, const Anope::string &p, unsigned conns, unsigned pl, time_t t)
+		: LDAPProvider(o, n), admin_binddn(b), admin_pass(p), server(s), pipeline(std::max(pl, 1U)), timeout(std::max<time_t>(t, 1))
 	{
-		Connect();
+		for (unsigned i = 0; i < std::max(conns, 1U); ++i)
+			this->connections.push_back(new LDAPConnection(this));
+
+		try
+		{
+			for (unsigned i = 0; i < this->connections.size(); ++i)
+				this->connections[i]->Open();
+		}
+		catch (const LDAPException &)
+		{
+			for (unsigned i = 0; i < this->connections.size(); ++i)
+				delete this->connections[i];
+			throw;
+		}
+
+		this->stats.connections = this->connections.size();
 	}
 
 	~LDAPService()
 	{
-		/* At this point the thread has stopped so we don't need to hold process_mutex */
-
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			this->connections[i]->SetExitState();
 		this->Lock();
+		this->WakeAll();
+		this->Unlock();
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			this->connections[i]->Join();
+
+		/* At this point the threads have stopped so we don't need to hold the lock */
+
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+		{
+			LDAPConnection *c = this->connections[i];
+			this->queries.insert(this->queries.end(), c->active.begin(), c->active.end());
+			c->active.clear();
+			delete c;
+		}
 
 		for (unsigned int i = 0; i < this->queries.size(); ++i)
 		{
 			LDAPRequest *req = this->queries[i];
 
 			/* queries have no results yet */
+			delete req->result;
 			req->result = new LDAPResult();
 			req->result->type = req->type;
 			req->result->error = "LDAP Interface is going away";
@@ -253,9 +368,8 @@ class LDAPService : public LDAPProvider, public Thread, public Condition
 		}
 		this->queries.clear();
 
-		for (unsigned int i = 0; i < this->results.size(); ++i)
+		for (LDAPRequest *req; this->results.Pop(req);)
 		{
-			LDAPRequest *req = this->results[i];
 
 			/* even though this may have already finished successfully we return that it didn't */
 			req->result->error = "LDAP Interface is going away";
@@ -264,10 +378,123 @@ class LDAPService : public LDAPProvider, public Thread, public Condition
 
 			delete req;
 		}
+	}
+
+	void Start()
+	{
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			this->connections[i]->Start();
+	}
+
+	/** Wake every connection waiting for requests. The lock must be held */
+	void WakeAll()
+	{
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			this->Wakeup();
+	}
 
+	/** Count a finished request and pass it to the main thread, or delete it if it
+	 * was made by a connection itself. The lock must be held.
+	 */
+	void Finished(LDAPRequest *req)
+	{
+		if (req->internal)
+		{
+			delete req;
+			return;
+		}
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		unsigned long long ms = std::max<long long>((now.tv_sec - req->queued.tv_sec) * 1000LL + (now.tv_usec - req->queued.tv_usec) / 1000, 0);
+
+		++this->stats.requests[req->type];
+		if (!req->result->getError().empty())
+			++this->stats.errors[req->type];
+		this->stats.total_ms[req->type] += ms;
+		if (ms > this->stats.max_ms[req->type])
+			this->stats.max_ms[req->type] = ms;
+
+		this->results.Push(req);
+	}
+
+	/** Record the answer to a bind. The lock must be held
+	 * @param who The dn bound as
+	 * @param pass The password bound with
+	 * @param success Whether the bind was accepted
+	 */
+	void BindAnswered(const Anope::string &who, const Anope::string &pass, bool success)
+	{
+		std::pair<Anope::string, Anope::string> creds(who, pass);
+		if (success)
+		{
+			this->refused.erase(creds);
+			return;
+		}
+
+		if (this->refused.size() >= 100)
+			this->refused.clear();
+		this->refused.insert(creds);
+
+		/* A failed bind left the single connection anonymous, so requests queued after it are made anonymously */
+		if (this->bound_who == who && this->bound_pass == pass)
+		{
+			this->bound_who.clear();
+			this->bound_pass.clear();
+		}
+	}
+
+	/** Make a request which was to be sent as refused credentials anonymous. The lock must be held */
+	void CheckCredentials(LDAPRequest *req)
+	{
+		if (req->type == QUERY_BIND || (req->who.empty() && req->pass.empty()))
+			return;
+
+		if (this->refused.count(std::make_pair(req->who, req->pass)))
+		{
+			req->who.clear();
+			req->pass.clear();
+		}
+	}
+
+	/** Count a connection made again after one was lost. The lock must be held */
+	void Reconnected()
+	{
+		++this->stats.reconnects;
+	}
+
+	/** Give up on requests which waited too long for a connection, and wake the
+	 * connections so they are retried and checked
+	 */
+	void Tick()
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		bool expired = false;
+
+		this->Lock();
+		for (query_queue::iterator it = this->queries.begin(); it != this->queries.end();)
+		{
+			LDAPRequest *req = *it;
+			if (now.tv_sec - req->queued.tv_sec < this->timeout)
+			{
+				++it;
+				continue;
+			}
+
+			it = this->queries.erase(it);
+			delete req->result;
+			req->result = new LDAPResult();
+			req->result->type = req->type;
+			req->result->error = "No connection to LDAP service " + this->name + " is available";
+			this->Finished(req);
+			expired = true;
+		}
+		this->WakeAll();
 		this->Unlock();
 
-		ldap_unbind_ext(this->con, NULL, NULL);
+		if (expired)
+			me->Notify();
 	}
 
 	void BindAsAdmin(LDAPInterface *i) anope_override
@@ -308,134 +535,422 @@ class LDAPService : public LDAPProvider, public Thread, public Condition
 		QueueRequest(mod);
 	}
 
- private:
-	void BuildReply(int res, LDAPRequest *req)
+	LDAPStats GetStats() anope_override
 	{
-		LDAPResult *ldap_result = req->result = new LDAPResult();
-		req->result->type = req->type;
-
-		if (res != LDAP_SUCCESS)
+		this->Lock();
+		LDAPStats s = this->stats;
+		s.queued = this->queries.size();
+		for (unsigned i = 0; i < this->connections.size(); ++i)
 		{
-			ldap_result->error = ldap_err2string(res);
-			return;
+			if (this->connections[i]->connected)
+				++s.connected;
+			s.active += this->connections[i]->active.size();
 		}
+		this->Unlock();
+		return s;
+	}
+};
+
+void LDAPConnection::Open()
+{
+	int i = ldap_initialize(&this->con, this->service->server.c_str());
+	if (i != LDAP_SUCCESS)
+	{
+		this->con = NULL;
+		throw LDAPException("Unable to connect to LDAP service " + this->service->name + ": " + ldap_err2string(i));
+	}
+
+	const int version = LDAP_VERSION3;
+	i = ldap_set_option(this->con, LDAP_OPT_PROTOCOL_VERSION, &version);
+	if (i != LDAP_OPT_SUCCESS)
+	{
+		ldap_unbind_ext(this->con, NULL, NULL);
+		this->con = NULL;
+		throw LDAPException("Unable to set protocol version for " + this->service->name + ": " + ldap_err2string(i));
+	}
+
+	/* Connecting only blocks this connection's thread, so can take as long as a request may */
+	const struct timeval tv = { static_cast<long>(this->service->timeout), 0 };
+	i = ldap_set_option(this->con, LDAP_OPT_NETWORK_TIMEOUT, &tv);
+	if (i != LDAP_OPT_SUCCESS)
+	{
+		ldap_unbind_ext(this->con, NULL, NULL);
+		this->con = NULL;
+		throw LDAPException("Unable to set timeout for " + this->service->name + ": " + ldap_err2string(i));
+	}
+
+	/* A new connection is not bound as anyone */
+	this->who.clear();
+	this->pass.clear();
+	this->binding = false;
+	this->last_activity = time(NULL);
+
+	this->service->Lock();
+	this->connected = true;
+	if (this->lost)
+		this->service->Reconnected();
+	this->service->Unlock();
+	this->lost = false;
+}
 
-		if (req->message == NULL)
+void LDAPConnection::Connect()
+{
+	if (time(NULL) < this->retry)
+		return;
+
+	try
+	{
+		this->Open();
+	}
+	catch (const LDAPException &)
+	{
+		this->retry = time(NULL) + this->backoff;
+		this->backoff = std::min<time_t>(this->backoff * 2, 60);
+	}
+}
+
+void LDAPConnection::Reset(const Anope::string &error)
+{
+	ldap_unbind_ext(this->con, NULL, NULL);
+	this->con = NULL;
+	this->binding = false;
+	this->lost = true;
+
+	/* Wait longer after each failure, up to a minute, until an answer is received again */
+	this->retry = time(NULL) + this->backoff;
+	this->backoff = std::min<time_t>(this->backoff * 2, 60);
+
+	this->service->Lock();
+	this->connected = false;
+	for (unsigned i = this->active.size(); i > 0; --i)
+	{
+		LDAPRequest *req = this->active[i - 1];
+
+		if (req->internal)
+			delete req;
+		else if (!req->retried)
 		{
-			return;
+			req->retried = true;
+			req->rebound = false;
+			req->msgid = -1;
+			if (req->message != NULL)
+			{
+				ldap_msgfree(req->message);
+				req->message = NULL;
+			}
+			this->service->queries.push_front(req);
+		}
+		else
+		{
+			delete req->result;
+			req->result = new LDAPResult();
+			req->result->type = req->type;
+			req->result->error = error;
+			this->service->Finished(req);
+			this->notify = true;
 		}
+	}
+	this->active.clear();
+	/* Another connection may be able to send them */
+	this->service->WakeAll();
+	this->service->Unlock();
+}
+
+void LDAPConnection::Take()
+{
+	this->service->Lock();
 
-		/* a search result */
+	LDAPService::query_queue &q = this->service->queries;
+	for (LDAPService::query_queue::iterator it = q.begin(); it != q.end() && !this->binding && this->active.size() < this->service->pipeline;)
+	{
+		LDAPRequest *req = *it;
+		this->service->CheckCredentials(req);
 
-		for (LDAPMessage *cur = ldap_first_message(this->con, req->message); cur; cur = ldap_next_message(this->con, cur))
+		/* Binds, and requests which need the connection bound as someone else first, need the connection to themselves */
+		if (req->type == QUERY_BIND || req->who != this->who || req->pass != this->pass)
 		{
-			LDAPAttributes attributes;
+			/* Let the connection empty so it is not passed over for long */
+			if (!this->active.empty())
+				break;
 
-			char *dn = ldap_get_dn(this->con, cur);
-			if (dn != NULL)
-			{
-				attributes["dn"].push_back(dn);
-				ldap_memfree(dn);
-				dn = NULL;
-			}
+			this->active.push_back(req);
+			q.erase(it);
+			break;
+		}
 
-			BerElement *ber = NULL;
+		this->active.push_back(req);
+		it = q.erase(it);
+	}
 
-			for (char *attr = ldap_first_attribute(this->con, cur, &ber); attr; attr = ldap_next_attribute(this->con, cur, ber))
-			{
-				berval **vals = ldap_get_values_len(this->con, cur, attr);
-				int count = ldap_count_values_len(vals);
+	/* Check a connection which has been quiet for a while, the server may have closed it */
+	if (this->active.empty() && time(NULL) - this->last_activity >= 60)
+	{
+		LDAPSearch *check = new LDAPSearch(this->service, NULL, "", "(objectClass=*)", LDAP_SCOPE_BASE);
+		check->internal = true;
+		check->who = this->who;
+		check->pass = this->pass;
+		this->active.push_back(check);
+		this->last_activity = time(NULL);
+	}
 
-				std::vector<Anope::string> attrs;
-				for (int j = 0; j < count; ++j)
-					attrs.push_back(vals[j]->bv_val);
-				attributes[attr] = attrs;
+	this->service->Unlock();
+}
 
-				ldap_value_free_len(vals);
-				ldap_memfree(attr);
-			}
+void LDAPConnection::Send()
+{
+	for (unsigned i = 0; i < this->active.size() && !this->binding; ++i)
+	{
+		LDAPRequest *req = this->active[i];
+		if (req->msgid != -1)
+			continue;
+
+		if (req->type != QUERY_BIND && !req->rebound && (req->who != this->who || req->pass != this->pass))
+		{
+			/* The credentials may have been refused since the request was taken */
+			this->service->Lock();
+			this->service->CheckCredentials(req);
+			this->service->Unlock();
+		}
+
+		if (req->type != QUERY_BIND && !req->rebound && (req->who != this->who || req->pass != this->pass))
+		{
+			/* Bind as who the request was made as first, it is sent once that is answered */
+			req->rebound = true;
+
+			LDAPBind *b = new LDAPBind(this->service, NULL, req->who, req->pass);
+			b->internal = true;
+			this->service->Lock();
+			this->active.insert(this->active.begin() + i, b);
+			this->service->Unlock();
+			req = b;
+		}
+
+		gettimeofday(&req->sent, NULL);
+		int ret = req->send(this->con);
 
-			if (ber != NULL)
-				ber_free(ber, 0);
+		if (ret == LDAP_SERVER_DOWN || ret == LDAP_CONNECT_ERROR)
+		{
+			this->Reset(ldap_err2string(ret));
+			return;
+		}
 
-			ldap_result->messages.push_back(attributes);
+		if (ret != LDAP_SUCCESS)
+		{
+			this->Complete(req, ret);
+			--i;
+			continue;
 		}
+
+		if (req->type == QUERY_BIND)
+			this->binding = true;
 	}
+}
 
-	void SendRequests()
-	{
-		process_mutex.Lock();
+void LDAPConnection::Read()
+{
+	/* Wait a little for the first answer, then take any others which have arrived */
+	struct timeval tv = { 0, 50000 };
 
-		query_queue q;
-		this->Lock();
-		queries.swap(q);
-		this->Unlock();
+	for (;;)
+	{
+		LDAPMessage *msg = NULL;
+		int type = ldap_result(this->con, LDAP_RES_ANY, LDAP_MSG_ALL, &tv, &msg);
 
-		if (q.empty())
+		if (type < 0)
 		{
-			process_mutex.Unlock();
+			int err = LDAP_SERVER_DOWN;
+			ldap_get_option(this->con, LDAP_OPT_RESULT_CODE, &err);
+			this->Reset(ldap_err2string(err));
 			return;
 		}
+		else if (type == 0)
+			break;
+
+		tv.tv_usec = 0;
+		this->last_activity = time(NULL);
+		this->backoff = 1;
 
-		for (unsigned int i = 0; i < q.size(); ++i)
+		int msgid = ldap_msgid(msg);
+		LDAPRequest *req = NULL;
+		for (unsigned i = 0; i < this->active.size(); ++i)
+			if (this->active[i]->msgid == msgid)
+				req = this->active[i];
+
+		/* An answer to a request which was given up on */
+		if (req == NULL)
 		{
-			LDAPRequest *req = q[i];
-			int ret = req->run();
+			ldap_msgfree(msg);
+			continue;
+		}
 
-			if (ret == LDAP_SERVER_DOWN || ret == LDAP_TIMEOUT)
-			{
-				/* try again */
-				try
-				{
-					Reconnect();
-				}
-				catch (const LDAPException &)
-				{
-				}
+		int err = LDAP_SUCCESS;
+		int ret = ldap_parse_result(this->con, msg, &err, NULL, NULL, NULL, NULL, 0);
+		if (ret != LDAP_SUCCESS)
+			err = ret;
 
-				ret = req->run();
-			}
+		if (req->type == QUERY_SEARCH)
+			req->message = msg;
+		else
+			ldap_msgfree(msg);
 
-			BuildReply(ret, req);
+		if (req->type == QUERY_BIND)
+		{
+			/* A failed bind leaves the connection anonymous */
+			this->binding = false;
+			this->who = err == LDAP_SUCCESS ? req->who : "";
+			this->pass = err == LDAP_SUCCESS ? req->pass : "";
+
+			this->service->Lock();
+			this->service->BindAnswered(req->who, req->pass, err == LDAP_SUCCESS);
+			this->service->Unlock();
+		}
+
+		this->Complete(req, err);
+	}
 
-			this->Lock();
-			results.push_back(req);
-			this->Unlock();
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	for (unsigned i = this->active.size(); i > 0; --i)
+	{
+		LDAPRequest *req = this->active[i - 1];
+		if (req->msgid == -1 || now.tv_sec - req->sent.tv_sec < this->service->timeout)
+			continue;
+
+		/* Without an answer to a bind who the connection is bound as is not known, and
+		 * without an answer to a check the connection is assumed to be dead
+		 */
+		if (req->type == QUERY_BIND || req->internal)
+		{
+			this->Reset("Timed out waiting for LDAP service " + this->service->name);
+			return;
 		}
 
-		me->Notify();
+		ldap_abandon_ext(this->con, req->msgid, NULL, NULL);
+		this->Complete(req, LDAP_TIMEOUT);
+	}
+}
+
+void LDAPConnection::Complete(LDAPRequest *req, int res)
+{
+	this->BuildReply(res, req);
 
-		process_mutex.Unlock();
+	this->service->Lock();
+	this->active.erase(std::find(this->active.begin(), this->active.end(), req));
+	this->service->Finished(req);
+	this->service->Unlock();
+
+	this->notify = true;
+}
+
+void LDAPConnection::BuildReply(int res, LDAPRequest *req)
+{
+	LDAPResult *ldap_result = req->result = new LDAPResult();
+	req->result->type = req->type;
+
+	if (res != LDAP_SUCCESS)
+	{
+		ldap_result->error = ldap_err2string(res);
+		return;
 	}
 
- public:
-	void Run() anope_override
+	if (req->message == NULL)
+	{
+		return;
+	}
+
+	/* a search result */
+
+	for (LDAPMessage *cur = ldap_first_message(this->con, req->message); cur; cur = ldap_next_message(this->con, cur))
 	{
-		while (!this->GetExitState())
+		LDAPAttributes attributes;
+
+		char *dn = ldap_get_dn(this->con, cur);
+		if (dn != NULL)
 		{
-			this->Lock();
-			/* Queries can be non empty if one is pushed during SendRequests() */
-			if (queries.empty())
-				this->Wait();
-			this->Unlock();
+			attributes["dn"].push_back(dn);
+			ldap_memfree(dn);
+			dn = NULL;
+		}
+
+		BerElement *ber = NULL;
+
+		for (char *attr = ldap_first_attribute(this->con, cur, &ber); attr; attr = ldap_next_attribute(this->con, cur, ber))
+		{
+			berval **vals = ldap_get_values_len(this->con, cur, attr);
+			int count = ldap_count_values_len(vals);
 
-			SendRequests();
+			std::vector<Anope::string> attrs;
+			for (int j = 0; j < count; ++j)
+				attrs.push_back(vals[j]->bv_val);
+			attributes[attr] = attrs;
+
+			ldap_value_free_len(vals);
+			ldap_memfree(attr);
 		}
+
+		if (ber != NULL)
+			ber_free(ber, 0);
+
+		ldap_result->messages.push_back(attributes);
 	}
+}
 
-	LDAP* GetConnection()
+void LDAPConnection::Run()
+{
+	while (!this->GetExitState())
 	{
-		return con;
+		if (!this->con)
+			this->Connect();
+
+		if (this->con)
+		{
+			this->Take();
+			this->Send();
+		}
+
+		if (this->con && !this->active.empty())
+			this->Read();
+
+		if (this->notify)
+		{
+			this->notify = false;
+			me->Notify();
+		}
+
+		if (this->con && !this->active.empty())
+			continue;
+
+		this->service->Lock();
+		/* Woken by new requests, and every second by the module so lost connections are retried */
+		if (!this->GetExitState() && (!this->con || this->service->queries.empty()))
+			this->service->Wait();
+		this->service->Unlock();
 	}
-};
+}
 
-class ModuleLDAP : public Module, public Pipe
+class ModuleLDAP : public Module, public Notifier
 {
 	std::map<Anope::string, LDAPService *> LDAPServices;
 
+	/** Retries lost connections, and gives up on requests which waited too long for one */
+	class LDAPTimer : public Timer
+	{
+		std::map<Anope::string, LDAPService *> &services;
+
+	 public:
+		LDAPTimer(Module *m, std::map<Anope::string, LDAPService *> &s) : Timer(m, 1, Anope::CurTime, true), services(s) { }
+
+		void Tick(time_t) anope_override
+		{
+			for (std::map<Anope::string, LDAPService *>::iterator it = this->services.begin(); it != this->services.end(); ++it)
+				it->second->Tick();
+		}
+	} timer;
+
  public:
 
-	ModuleLDAP(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	ModuleLDAP(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR), timer(this, LDAPServices)
 	{
 		me = this;
 	}
@@ -443,12 +958,7 @@ class ModuleLDAP : public Module, public Pipe
 	~ModuleLDAP()
 	{
 		for (std::map<Anope::string, LDAPService *>::iterator it = this->LDAPServices.begin(); it != this->LDAPServices.end(); ++it)
-		{
-			it->second->SetExitState();
-			it->second->Wakeup();
-			it->second->Join();
 			delete it->second;
-		}
 		LDAPServices.clear();
 	}
 
@@ -472,9 +982,6 @@ class ModuleLDAP : public Module, public Pipe
 			{
 				Log(LOG_NORMAL, "ldap") << "LDAP: Removing server connection " << cname;
 
-				s->SetExitState();
-				s->Wakeup();
-				s->Join();
 				delete s;
 				this->LDAPServices.erase(cname);
 			}
@@ -491,14 +998,17 @@ class ModuleLDAP : public Module, public Pipe
 				const Anope::string &server = ldap->Get<const Anope::string>("server", "127.0.0.1");
 				const Anope::string &admin_binddn = ldap->Get<const Anope::string>("admin_binddn");
 				const Anope::string &admin_password = ldap->Get<const Anope::string>("admin_password");
+				unsigned connections = ldap->Get<unsigned>("connections", "2");
+				unsigned pipeline = ldap->Get<unsigned>("pipeline", "16");
+				time_t timeout = ldap->Get<time_t>("timeout", "10s");
 
 				try
 				{
-					LDAPService *ss = new LDAPService(this, connname, server, admin_binddn, admin_password);
+					LDAPService *ss = new LDAPService(this, connname, server, admin_binddn, admin_password, connections, pipeline, timeout);
 					ss->Start();
 					this->LDAPServices.insert(std::make_pair(connname, ss));
 
-					Log(LOG_NORMAL, "ldap") << "LDAP: Successfully initialized server " << connname << " (" << server << ")";
+					Log(LOG_NORMAL, "ldap") << "LDAP: Successfully initialized server " << connname << " (" << server << ") with " << ss->connections.size() << " connection(s)";
 				}
 				catch (const LDAPException &ex)
 				{
@@ -514,7 +1024,6 @@ class ModuleLDAP : public Module, public Pipe
 		{
 			LDAPService *s = it->second;
 
-			s->process_mutex.Lock();
 			s->Lock();
 
 			for (unsigned int i = s->queries.size(); i > 0; --i)
@@ -528,20 +1037,37 @@ class ModuleLDAP : public Module, public Pipe
 					delete req;
 				}
 			}
-			for (unsigned int i = s->results.size(); i > 0; --i)
+			/* Only the main thread pops results, so the others can be pushed back */
+			std::vector<LDAPRequest *> keep;
+			for (LDAPRequest *req; s->results.Pop(req);)
 			{
-				LDAPRequest *req = s->results[i - 1];
 				LDAPInterface *li = req->inter;
 
 				if (li && li->owner == m)
-				{
-					s->results.erase(s->results.begin() + i - 1);
 					delete req;
+				else
+					keep.push_back(req);
+			}
+			for (unsigned int i = 0; i < keep.size(); ++i)
+				s->results.Push(keep[i]);
+			/* Requests on a connection belong to its thread, so are only detached from the module */
+			for (unsigned int i = 0; i < s->connections.size(); ++i)
+			{
+				LDAPConnection *c = s->connections[i];
+				for (unsigned int j = 0; j < c->active.size(); ++j)
+				{
+					LDAPRequest *req = c->active[j];
+					LDAPInterface *li = req->inter;
+
+					if (li && li->owner == m)
+					{
+						req->inter = NULL;
+						li->OnDelete();
+					}
 				}
 			}
 
 			s->Unlock();
-			s->process_mutex.Unlock();
 		}
 	}
 
@@ -551,14 +1077,8 @@ class ModuleLDAP : public Module, public Pipe
 		{
 			LDAPService *s = it->second;
 
-			LDAPService::query_queue results;
-			s->Lock();
-			results.swap(s->results);
-			s->Unlock();
-
-			for (unsigned int i = 0; i < results.size(); ++i)
+			for (LDAPRequest *req; s->results.Pop(req);)
 			{
-				LDAPRequest *req = results[i];
 				LDAPInterface *li = req->inter;
 				LDAPResult *r = req->result;
 
@@ -579,41 +1099,44 @@ class ModuleLDAP : public Module, public Pipe
 	}
 };
 
-int LDAPBind::run()
+int LDAPBind::send(LDAP *con)
 {
 	berval cred;
 	cred.bv_val = strdup(pass.c_str());
 	cred.bv_len = pass.length();
 
-	int i = ldap_sasl_bind_s(service->GetConnection(), who.c_str(), LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
+	int i = ldap_sasl_bind(con, who.c_str(), LDAP_SASL_SIMPLE, &cred, NULL, NULL, &msgid);
 
 	free(cred.bv_val);
 
 	return i;
 }
 
-int LDAPSearch::run()
+int LDAPSearch::send(LDAP *con)
 {
-	return ldap_search_ext_s(service->GetConnection(), base.c_str(), LDAP_SCOPE_SUBTREE, filter.c_str(), NULL, 0, NULL, NULL, &tv, 0, &message);
+	/* Also asks the server to give up after this long */
+	struct timeval tv = { static_cast<long>(service->timeout), 0 };
+	char *attrs[] = { const_cast<char *>(LDAP_NO_ATTRS), NULL };
+	return ldap_search_ext(con, base.c_str(), scope, filter.c_str(), internal ? attrs : NULL, 0, NULL, NULL, &tv, 0, &msgid);
 }
 
-int LDAPAdd::run()
+int LDAPAdd::send(LDAP *con)
 {
 	LDAPMod **mods = LDAPService::BuildMods(attributes);
-	int i = ldap_add_ext_s(service->GetConnection(), dn.c_str(), mods, NULL, NULL);
+	int i = ldap_add_ext(con, dn.c_str(), mods, NULL, NULL, &msgid);
 	LDAPService::FreeMods(mods);
 	return i;
 }
 
-int LDAPDel::run()
+int LDAPDel::send(LDAP *con)
 {
-	return ldap_delete_ext_s(service->GetConnection(), dn.c_str(), NULL, NULL);
+	return ldap_delete_ext(con, dn.c_str(), NULL, NULL, &msgid);
 }
 
-int LDAPModify::run()
+int LDAPModify::send(LDAP *con)
 {
 	LDAPMod **mods = LDAPService::BuildMods(attributes);
-	int i = ldap_modify_ext_s(service->GetConnection(), base.c_str(), mods, NULL, NULL);
+	int i = ldap_modify_ext(con, base.c_str(), mods, NULL, NULL, &msgid);
 	LDAPService::FreeMods(mods);
 	return i;
 }
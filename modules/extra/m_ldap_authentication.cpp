@@ -8,8 +8,10 @@
 
 #include "module.h"
 #include "modules/ldap.h"
+#include "modules/auth_cache.h"
 
 static Module *me;
+static ExternalAuth::Cache *cache;
 
 static Anope::string basedn;
 static Anope::string search_filter;
@@ -24,14 +26,19 @@ struct IdentifyInfo
 	ServiceReference<LDAPProvider> lprov;
 	bool admin_bind;
 	Anope::string dn;
+	Anope::string key;
+	unsigned long long lookup_id;
+	bool success;
 
-	IdentifyInfo(User *u, IdentifyRequest *r, ServiceReference<LDAPProvider> &lp) : user(u), req(r), lprov(lp), admin_bind(true)
+	IdentifyInfo(User *u, IdentifyRequest *r, ServiceReference<LDAPProvider> &lp, const Anope::string &k, unsigned long long id) : user(u), req(r), lprov(lp), admin_bind(true), key(k), lookup_id(id), success(false)
 	{
 		req->Hold(me);
 	}
 
 	~IdentifyInfo()
 	{
+		/* Attempts with the same credentials which arrived during the lookup get the same answer */
+		cache->Finish(key, lookup_id, success);
 		req->Release(me);
 	}
 };
@@ -114,6 +121,7 @@ class IdentifyInterface : public LDAPInterface
 
 					na->nc->Extend<Anope::string>("m_ldap_authentication_dn", ii->dn);
 					ii->req->Success(me);
+					ii->success = true;
 				}
 				break;
 			}
@@ -194,6 +202,7 @@ class ModuleLDAPAuthentication : public Module
 	OnRegisterInterface orinterface;
 
 	PrimitiveExtensibleItem<Anope::string> dn;
+	ExternalAuth::Cache authcache;
 
 	Anope::string password_attribute;
 	Anope::string disable_register_reason;
@@ -201,9 +210,10 @@ class ModuleLDAPAuthentication : public Module
  public:
 	ModuleLDAPAuthentication(const Anope::string &modname, const Anope::string &creator) :
 		Module(modname, creator, EXTRA | VENDOR), ldap("LDAPProvider", "ldap/main"), orinterface(this),
-		dn(this, "m_ldap_authentication_dn")
+		dn(this, "m_ldap_authentication_dn"), authcache(this, "ldap_authentication")
 	{
 		me = this;
+		cache = &authcache;
 	}
 
 	void Prioritize() anope_override
@@ -223,6 +233,8 @@ class ModuleLDAPAuthentication : public Module
 		email_attribute = conf->Get<const Anope::string>("email_attribute");
 		this->disable_register_reason = conf->Get<const Anope::string>("disable_register_reason");
 		this->disable_email_reason = conf->Get<const Anope::string>("disable_email_reason");
+		this->authcache.ttl = conf->Get<time_t>("cache_time", "2m");
+		this->authcache.Clear();
 
 		if (!email_attribute.empty())
 			/* Don't complain to users about how they need to update their email, we will do it for them */
@@ -254,7 +266,12 @@ class ModuleLDAPAuthentication : public Module
 		if (!this->ldap)
 			return;
 
-		IdentifyInfo *ii = new IdentifyInfo(u, req, this->ldap);
+		Anope::string key;
+		unsigned long long lookup_id;
+		if (this->authcache.Check(req, key, lookup_id))
+			return;
+
+		IdentifyInfo *ii = new IdentifyInfo(u, req, this->ldap, key, lookup_id);
 		this->ldap->BindAsAdmin(new IdentifyInterface(this, ii));
 	}
 
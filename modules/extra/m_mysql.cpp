@@ -16,34 +16,57 @@
 # include <mysql.h>
 #else
 # include <mysql/mysql.h>
+# include <sys/time.h>
 #endif
 
 using namespace SQL;
 
 /** Non blocking threaded MySQL API, based loosely from InspIRCd's m_mysql.cpp
  *
- * This module spawns a single thread that is used to execute blocking MySQL queries.
- * When a module requests a query to be executed it is added to a list for the thread
- * (which never stops looping and sleeing) to pick up and execute, the result of which
- * is inserted in to another queue to be picked up by the main thread. The main thread
- * uses Pipe to become notified through the socket engine when there are results waiting
- * to be sent back to the modules requesting the query
+ * Every MySQL service spawns a pool of threads, each with its own connection to the
+ * server, that are used to execute blocking MySQL queries. When a module requests a
+ * query to be executed it is added to the list of one of the threads (which never stop
+ * looping and sleeping) to pick up and execute, the result of which is inserted in to
+ * another queue to be picked up by the main thread. The main thread uses Pipe to become
+ * notified through the socket engine when there are results waiting to be sent back to
+ * the modules requesting the query.
+ *
+ * All queries of a module go to the same thread, so they are still executed in the order
+ * they were requested. Queries run synchronously with RunQuery use a connection of their
+ * own, so they never wait behind queries queued in the background.
+ *
+ * Queries with escaped parameters are executed as server side prepared statements, which
+ * every connection caches by the text of the statement.
  */
 
 class MySQLService;
 
+/** Milliseconds passed since a time */
+static unsigned long long MillisecondsSince(const struct timeval &then)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	long long ms = (now.tv_sec - then.tv_sec) * 1000LL + (now.tv_usec - then.tv_usec) / 1000;
+	return ms > 0 ? ms : 0;
+}
+
 /** A query request
  */
 struct QueryRequest
 {
-	/* The connection to the database */
-	MySQLService *service;
 	/* The interface to use once we have the result to send the data back */
 	Interface *sqlinterface;
 	/* The actual query */
 	Query query;
+	/* Identifies this request in the queue of its thread */
+	unsigned long id;
+	/* When the request was queued */
+	struct timeval queued;
 
-	QueryRequest(MySQLService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), query(q) { }
+	QueryRequest(Interface *i, const Query &q, unsigned long n) : sqlinterface(i), query(q), id(n)
+	{
+		gettimeofday(&queued, NULL);
+	}
 };
 
 /** A query result */
@@ -54,6 +77,7 @@ struct QueryResult
 	/* The result */
 	Result result;
 
+	QueryResult() : sqlinterface(NULL) { }
 	QueryResult(Interface *i, Result &r) : sqlinterface(i), result(r) { }
 };
 
@@ -94,6 +118,11 @@ class MySQLResult : public Result
 		}
 	}
 
+	MySQLResult(unsigned int i, const Query &q, const Anope::string &fq, std::vector<std::map<Anope::string, Anope::string> > &rows) : Result(i, q, fq), res(NULL)
+	{
+		this->entries.swap(rows);
+	}
+
 	MySQLResult(const Query &q, const Anope::string &fq, const Anope::string &err) : Result(0, q, fq, err), res(NULL)
 	{
 	}
@@ -105,86 +134,158 @@ class MySQLResult : public Result
 	}
 };
 
-/** A MySQL connection, there can be multiple
+/** A connection to a MySQL server, and the statements prepared on it
  */
-class MySQLService : public Provider
+class MySQLConnection
 {
-	std::map<Anope::string, std::set<Anope::string> > active_schema;
+	/* How many prepared statements are kept per connection */
+	static const unsigned MaxStatements = 64;
 
-	Anope::string database;
-	Anope::string server;
-	Anope::string user;
-	Anope::string password;
-	int port;
+	typedef std::list<std::pair<Anope::string, MYSQL_STMT *> > StatementList;
 
+	MySQLService *service;
 	MYSQL *sql;
 
+	/* Prepared statements, the most recently used first. Statements which can not
+	 * be prepared are kept with a NULL handle, so they are not tried again.
+	 */
+	StatementList statements;
+	/* Prepared statements by their text */
+	std::map<Anope::string, StatementList::iterator> statement_index;
+
 	/** Escape a query.
 	 * Note the mutex must be held!
 	 */
 	Anope::string Escape(const Anope::string &query);
 
- public:
-	/* Locked by the SQL thread when a query is pending on this database,
-	 * prevents us from deleting a connection while a query is executing
-	 * in the thread
+	/** Build the text of a query with every escaped parameter replaced by a placeholder
+	 * @param q The query
+	 * @param statement Set to the text of the statement
+	 * @param params Filled with the values of the placeholders, in order
+	 * @return false if the query has no escaped parameters
 	 */
-	Mutex Lock;
+	bool BuildStatement(const Query &q, Anope::string &statement, std::vector<const Anope::string *> &params);
 
-	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po);
+	/** Find a prepared statement, or prepare it
+	 * @return The statement, or NULL if it can not be prepared
+	 */
+	MYSQL_STMT *GetStatement(const Anope::string &statement, unsigned long params);
 
-	~MySQLService();
+	Result RunStatement(const Query &query, const Anope::string &statement, MYSQL_STMT *stmt, const std::vector<const Anope::string *> &params);
 
-	void Run(Interface *i, const Query &query) anope_override;
-
-	Result RunQuery(const Query &query) anope_override;
+	Result RunText(const Query &query);
 
-	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
+ public:
+	/* Held while a query is executing on this connection */
+	Mutex Lock;
 
-	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
+	MySQLConnection(MySQLService *s) : service(s), sql(NULL) { }
 
-	Query GetTables(const Anope::string &prefix) anope_override;
+	~MySQLConnection() { this->Close(); }
 
 	void Connect();
 
 	bool CheckConnection();
 
-	Anope::string BuildQuery(const Query &q);
+	void Close();
+
+	Result RunQuery(const Query &query);
 
-	Anope::string FromUnixtime(time_t);
+	Anope::string BuildQuery(const Query &q);
 };
 
-/** The SQL thread used to execute queries
+/** A thread used to execute queries, with its own connection
  */
 class DispatcherThread : public Thread, public Condition
 {
+	MySQLService *service;
+
  public:
-	DispatcherThread() : Thread() { }
+	/* The connection used by this thread */
+	MySQLConnection conn;
+	/* Pending query requests, the first is the one executing now */
+	std::deque<QueryRequest> QueryRequests;
+
+	DispatcherThread(MySQLService *s) : Thread(), service(s), conn(s) { }
 
 	void Run() anope_override;
 };
 
+/** A MySQL connection, there can be multiple
+ */
+class MySQLService : public Provider
+{
+	std::map<Anope::string, std::set<Anope::string> > active_schema;
+
+	/* The connection used by RunQuery */
+	MySQLConnection sync;
+
+	/* The thread each module's queries are sent to */
+	std::map<Module *, DispatcherThread *> assigned;
+	/* The thread the next module is assigned to */
+	unsigned next_thread;
+	/* The id of the last queued request */
+	unsigned long last_id;
+
+	/* Held while accessing stats */
+	Mutex StatsLock;
+	QueueStats stats;
+
+ public:
+	const Anope::string database;
+	const Anope::string server;
+	const Anope::string user;
+	const Anope::string password;
+	const int port;
+
+	/* The threads executing queued queries */
+	std::vector<DispatcherThread *> threads;
+
+	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned connections);
+
+	~MySQLService();
+
+	void Run(Interface *i, const Query &query) anope_override;
+
+	Result RunQuery(const Query &query) anope_override;
+
+	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
+
+	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
+
+	Query BuildInsert(const Anope::string &table, const std::vector<std::pair<unsigned int, Data *> > &rows) anope_override;
+
+	Query GetTables(const Anope::string &prefix) anope_override;
+
+	std::vector<Query> CreateChangeLog(const Anope::string &log_table, const Anope::string &table, const Anope::string &type_name) anope_override;
+
+	Anope::string FromUnixtime(time_t) anope_override;
+
+	QueueStats GetStats() anope_override;
+
+	/** Count a query which has finished. May be called from any thread.
+	 * @param lane Whether the query was synchronous or queued
+	 * @param started When the query was run or queued
+	 */
+	void AddLatency(QueueStats::Lane lane, const struct timeval &started);
+
+	/** Forget which thread the queries of a module were sent to */
+	void Unassign(Module *m);
+};
+
 class ModuleSQL;
 static ModuleSQL *me;
-class ModuleSQL : public Module, public Pipe
+class ModuleSQL : public Module, public Notifier
 {
 	/* SQL connections */
 	std::map<Anope::string, MySQLService *> MySQLServices;
- public:
-	/* Pending query requests */
-	std::deque<QueryRequest> QueryRequests;
 	/* Pending finished requests with results */
-	std::deque<QueryResult> FinishedRequests;
-	/* The thread used to execute queries */
-	DispatcherThread *DThread;
+	MPSCQueue<QueryResult> FinishedRequests;
 
+ public:
 	ModuleSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
 	{
 		me = this;
-
-
-		DThread = new DispatcherThread();
-		DThread->Start();
 	}
 
 	~ModuleSQL()
@@ -192,11 +293,14 @@ class ModuleSQL : public Module, public Pipe
 		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
 			delete it->second;
 		MySQLServices.clear();
+	}
 
-		DThread->SetExitState();
-		DThread->Wakeup();
-		DThread->Join();
-		delete DThread;
+	/** Queue a result to be sent back by the main thread. Called from the query threads.
+	 */
+	void AddResult(const QueryResult &qr)
+	{
+		this->FinishedRequests.Push(qr);
+		this->Notify();
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -236,10 +340,11 @@ class ModuleSQL : public Module, public Pipe
 				const Anope::string &user = block->Get<const Anope::string>("username", "anope");
 				const Anope::string &password = block->Get<const Anope::string>("password");
 				int port = block->Get<int>("port", "3306");
+				unsigned connections = std::max(block->Get<unsigned>("connections", "1"), 1U);
 
 				try
 				{
-					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port);
+					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port, connections);
 					this->MySQLServices.insert(std::make_pair(connname, ss));
 
 					Log(LOG_NORMAL, "mysql") << "MySQL: Successfully connected to server " << connname << " (" << server << ")";
@@ -254,40 +359,47 @@ class ModuleSQL : public Module, public Pipe
 
 	void OnModuleUnload(User *, Module *m) anope_override
 	{
-		this->DThread->Lock();
-
-		for (unsigned i = this->QueryRequests.size(); i > 0; --i)
+		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
 		{
-			QueryRequest &r = this->QueryRequests[i - 1];
+			MySQLService *s = it->second;
 
-			if (r.sqlinterface && r.sqlinterface->owner == m)
+			for (unsigned j = 0; j < s->threads.size(); ++j)
 			{
-				if (i == 1)
+				DispatcherThread *t = s->threads[j];
+
+				t->Lock();
+
+				for (unsigned i = t->QueryRequests.size(); i > 0; --i)
 				{
-					r.service->Lock.Lock();
-					r.service->Lock.Unlock();
+					QueryRequest &r = t->QueryRequests[i - 1];
+
+					if (r.sqlinterface && r.sqlinterface->owner == m)
+					{
+						if (i == 1)
+						{
+							/* Wait for it to finish, the thread drops the result once it sees the request is gone */
+							t->conn.Lock.Lock();
+							t->conn.Lock.Unlock();
+						}
+
+						t->QueryRequests.erase(t->QueryRequests.begin() + i - 1);
+					}
 				}
 
-				this->QueryRequests.erase(this->QueryRequests.begin() + i - 1);
+				t->Unlock();
 			}
-		}
 
-		this->DThread->Unlock();
+			s->Unassign(m);
+		}
 
 		this->OnNotify();
 	}
 
 	void OnNotify() anope_override
 	{
-		this->DThread->Lock();
-		std::deque<QueryResult> finishedRequests = this->FinishedRequests;
-		this->FinishedRequests.clear();
-		this->DThread->Unlock();
-
-		for (std::deque<QueryResult>::const_iterator it = finishedRequests.begin(), it_end = finishedRequests.end(); it != it_end; ++it)
+		QueryResult qr;
+		while (this->FinishedRequests.Pop(qr))
 		{
-			const QueryResult &qr = *it;
-
 			if (!qr.sqlinterface)
 				throw SQL::Exception("NULL qr.sqlinterface in MySQLPipe::OnNotify() ?");
 
@@ -299,71 +411,110 @@ class ModuleSQL : public Module, public Pipe
 	}
 };
 
-MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po)
-: Provider(o, n), database(d), server(s), user(u), password(p), port(po), sql(NULL)
+MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned connections)
+: Provider(o, n), sync(this), next_thread(0), last_id(0), database(d), server(s), user(u), password(p), port(po)
 {
-	Connect();
+	sync.Connect();
+
+	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << this->name << " at " << this->server << ":" << this->port;
+
+	/* The threads connect once they have something to execute */
+	for (unsigned i = 0; i < connections; ++i)
+	{
+		DispatcherThread *t = new DispatcherThread(this);
+		this->threads.push_back(t);
+		t->Start();
+	}
 }
 
 MySQLService::~MySQLService()
 {
-	me->DThread->Lock();
-	this->Lock.Lock();
-	mysql_close(this->sql);
-	this->sql = NULL;
+	std::deque<QueryRequest> pending;
 
-	for (unsigned i = me->QueryRequests.size(); i > 0; --i)
+	for (unsigned i = 0; i < this->threads.size(); ++i)
 	{
-		QueryRequest &r = me->QueryRequests[i - 1];
+		DispatcherThread *t = this->threads[i];
+
+		t->Lock();
+		pending.insert(pending.end(), t->QueryRequests.begin(), t->QueryRequests.end());
+		t->QueryRequests.clear();
+		t->SetExitState();
+		t->Wakeup();
+		t->Unlock();
+	}
 
-		if (r.service == this)
-		{
-			if (r.sqlinterface)
-				r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
-			me->QueryRequests.erase(me->QueryRequests.begin() + i - 1);
-		}
+	for (unsigned i = 0; i < this->threads.size(); ++i)
+	{
+		this->threads[i]->Join();
+		delete this->threads[i];
+	}
+	this->threads.clear();
+
+	for (unsigned i = 0; i < pending.size(); ++i)
+	{
+		QueryRequest &r = pending[i];
+
+		if (r.sqlinterface)
+			r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
 	}
-	this->Lock.Unlock();
-	me->DThread->Unlock();
 }
 
 void MySQLService::Run(Interface *i, const Query &query)
 {
-	me->DThread->Lock();
-	me->QueryRequests.push_back(QueryRequest(this, i, query));
-	me->DThread->Unlock();
-	me->DThread->Wakeup();
+	Module *m = i ? i->owner : NULL;
+
+	DispatcherThread *&t = this->assigned[m];
+	if (!t)
+		t = this->threads[this->next_thread++ % this->threads.size()];
+
+	t->Lock();
+	t->QueryRequests.push_back(QueryRequest(i, query, ++this->last_id));
+	t->Unlock();
+	t->Wakeup();
 }
 
 Result MySQLService::RunQuery(const Query &query)
 {
-	this->Lock.Lock();
+	struct timeval started;
+	gettimeofday(&started, NULL);
 
-	Anope::string real_query = this->BuildQuery(query);
-
-	if (this->CheckConnection() && !mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
-	{
-		MYSQL_RES *res = mysql_store_result(this->sql);
-		unsigned int id = mysql_insert_id(this->sql);
+	Result result = this->sync.RunQuery(query);
 
-		/* because we enabled CLIENT_MULTI_RESULTS in our options
-		 * a multiple statement or a procedure call can return
-		 * multiple result sets.
-		 * we must process them all before the next query.
-		 */
+	this->AddLatency(QueueStats::LANE_SYNC, started);
+	return result;
+}
 
-		while (!mysql_next_result(this->sql))
-			mysql_free_result(mysql_store_result(this->sql));
+QueueStats MySQLService::GetStats()
+{
+	this->StatsLock.Lock();
+	QueueStats s = this->stats;
+	this->StatsLock.Unlock();
 
-		this->Lock.Unlock();
-		return MySQLResult(id, query, real_query, res);
-	}
-	else
+	for (unsigned i = 0; i < this->threads.size(); ++i)
 	{
-		Anope::string error = mysql_error(this->sql);
-		this->Lock.Unlock();
-		return MySQLResult(query, real_query, error);
+		this->threads[i]->Lock();
+		s.queued += this->threads[i]->QueryRequests.size();
+		this->threads[i]->Unlock();
 	}
+
+	return s;
+}
+
+void MySQLService::AddLatency(QueueStats::Lane lane, const struct timeval &started)
+{
+	unsigned long long ms = MillisecondsSince(started);
+
+	this->StatsLock.Lock();
+	++this->stats.queries[lane];
+	this->stats.total_ms[lane] += ms;
+	if (ms > this->stats.max_ms[lane])
+		this->stats.max_ms[lane] = ms;
+	this->StatsLock.Unlock();
+}
+
+void MySQLService::Unassign(Module *m)
+{
+	this->assigned.erase(m);
 }
 
 std::vector<Query> MySQLService::CreateTable(const Anope::string &table, const Data &data)
@@ -460,28 +611,107 @@ Query MySQLService::BuildInsert(const Anope::string &table, unsigned int id, Dat
 	return query;
 }
 
+Query MySQLService::BuildInsert(const Anope::string &table, const std::vector<std::pair<unsigned int, Data *> > &rows)
+{
+	/* Every row has to list the same columns, so pad them all to every known column */
+	std::set<Anope::string> columns;
+	const std::set<Anope::string> &known_cols = this->active_schema[table];
+	for (std::set<Anope::string>::iterator it = known_cols.begin(), it_end = known_cols.end(); it != it_end; ++it)
+		if (*it != "id" && *it != "timestamp")
+			columns.insert(*it);
+	for (unsigned i = 0; i < rows.size(); ++i)
+		for (Data::Map::const_iterator it = rows[i].second->data.begin(), it_end = rows[i].second->data.end(); it != it_end; ++it)
+			columns.insert(it->first);
+
+	Anope::string query_text = "INSERT INTO `" + table + "` (`id`";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += ",`" + *it + "`";
+	query_text += ") VALUES ";
+
+	for (unsigned i = 0; i < rows.size(); ++i)
+	{
+		query_text += (i ? ",(" : "(") + stringify(rows[i].first);
+		for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+			query_text += ",@" + *it + "#" + stringify(i) + "@";
+		query_text += ")";
+	}
+
+	query_text += " ON DUPLICATE KEY UPDATE ";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += "`" + *it + "`=VALUES(`" + *it + "`),";
+	query_text.erase(query_text.end() - 1);
+
+	Query query(query_text);
+	for (unsigned i = 0; i < rows.size(); ++i)
+	{
+		Data &data = *rows[i].second;
+
+		for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		{
+			Anope::string buf;
+			data[*it] >> buf;
+
+			bool escape = true;
+			if (buf.empty())
+			{
+				buf = "NULL";
+				escape = false;
+			}
+
+			query.SetValue(*it + "#" + stringify(i), buf, escape);
+		}
+	}
+
+	return query;
+}
+
 Query MySQLService::GetTables(const Anope::string &prefix)
 {
 	return Query("SHOW TABLES LIKE '" + prefix + "%';");
 }
 
-void MySQLService::Connect()
+std::vector<Query> MySQLService::CreateChangeLog(const Anope::string &log_table, const Anope::string &table, const Anope::string &type_name)
+{
+	std::vector<Query> queries;
+
+	queries.push_back(Query("CREATE TABLE IF NOT EXISTS `" + log_table + "` (`id` bigint(20) unsigned NOT NULL AUTO_INCREMENT,"
+		" `type` varchar(64) NOT NULL, `object_id` int(10) unsigned NOT NULL, PRIMARY KEY (`id`))"));
+
+	/* MySQL can not replace a trigger in place, and one query may only hold one statement */
+	static const char *events[] = { "INSERT", "UPDATE", "DELETE" };
+	for (unsigned i = 0; i < 3; ++i)
+	{
+		const Anope::string event = events[i], trigger = table + "_log_" + event.lower();
+		const Anope::string row = event == "DELETE" ? "OLD" : "NEW";
+
+		queries.push_back(Query("DROP TRIGGER IF EXISTS `" + trigger + "`"));
+		queries.push_back(Query("CREATE TRIGGER `" + trigger + "` AFTER " + event + " ON `" + table + "` FOR EACH ROW"
+			" INSERT INTO `" + log_table + "` (`type`, `object_id`) VALUES ('" + type_name + "', " + row + ".`id`)"));
+	}
+
+	return queries;
+}
+
+Anope::string MySQLService::FromUnixtime(time_t t)
 {
-	this->sql = mysql_init(this->sql);
+	return "FROM_UNIXTIME(" + stringify(t) + ")";
+}
+
+void MySQLConnection::Connect()
+{
+	this->Close();
+	this->sql = mysql_init(NULL);
 
 	const unsigned int timeout = 1;
 	mysql_options(this->sql, MYSQL_OPT_CONNECT_TIMEOUT, reinterpret_cast<const char *>(&timeout));
 
-	bool connect = mysql_real_connect(this->sql, this->server.c_str(), this->user.c_str(), this->password.c_str(), this->database.c_str(), this->port, NULL, CLIENT_MULTI_RESULTS);
+	bool connect = mysql_real_connect(this->sql, this->service->server.c_str(), this->service->user.c_str(), this->service->password.c_str(), this->service->database.c_str(), this->service->port, NULL, CLIENT_MULTI_RESULTS);
 
 	if (!connect)
-		throw SQL::Exception("Unable to connect to MySQL service " + this->name + ": " + mysql_error(this->sql));
-
-	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << this->name << " at " << this->server << ":" << this->port;
+		throw SQL::Exception("Unable to connect to MySQL service " + this->service->name + ": " + mysql_error(this->sql));
 }
 
-
-bool MySQLService::CheckConnection()
+bool MySQLConnection::CheckConnection()
 {
 	if (!this->sql || mysql_ping(this->sql))
 	{
@@ -498,26 +728,287 @@ bool MySQLService::CheckConnection()
 	return true;
 }
 
-Anope::string MySQLService::Escape(const Anope::string &query)
+void MySQLConnection::Close()
+{
+	/* Statements belong to the connection they were prepared on */
+	for (StatementList::iterator it = this->statements.begin(), it_end = this->statements.end(); it != it_end; ++it)
+		if (it->second)
+			mysql_stmt_close(it->second);
+	this->statements.clear();
+	this->statement_index.clear();
+
+	if (this->sql)
+	{
+		mysql_close(this->sql);
+		this->sql = NULL;
+	}
+}
+
+Result MySQLConnection::RunQuery(const Query &query)
+{
+	this->Lock.Lock();
+
+	Result result;
+	if (!this->CheckConnection())
+		result = MySQLResult(query, query.query, this->sql ? mysql_error(this->sql) : "Not connected");
+	else
+	{
+		Anope::string statement;
+		std::vector<const Anope::string *> params;
+		MYSQL_STMT *stmt = this->BuildStatement(query, statement, params) ? this->GetStatement(statement, params.size()) : NULL;
+
+		if (stmt)
+			result = this->RunStatement(query, statement, stmt, params);
+		else
+			result = this->RunText(query);
+	}
+
+	this->Lock.Unlock();
+	return result;
+}
+
+Result MySQLConnection::RunText(const Query &query)
+{
+	Anope::string real_query = this->BuildQuery(query);
+
+	if (!mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
+	{
+		MYSQL_RES *res = mysql_store_result(this->sql);
+		unsigned int id = mysql_insert_id(this->sql);
+
+		/* because we enabled CLIENT_MULTI_RESULTS in our options
+		 * a multiple statement or a procedure call can return
+		 * multiple result sets.
+		 * we must process them all before the next query.
+		 */
+
+		while (!mysql_next_result(this->sql))
+			mysql_free_result(mysql_store_result(this->sql));
+
+		return MySQLResult(id, query, real_query, res);
+	}
+	else
+		return MySQLResult(query, real_query, mysql_error(this->sql));
+}
+
+MYSQL_STMT *MySQLConnection::GetStatement(const Anope::string &statement, unsigned long params)
+{
+	std::map<Anope::string, StatementList::iterator>::iterator it = this->statement_index.find(statement);
+	if (it != this->statement_index.end())
+	{
+		this->statements.splice(this->statements.begin(), this->statements, it->second);
+		return it->second->second;
+	}
+
+	MYSQL_STMT *stmt = mysql_stmt_init(this->sql);
+	/* The statement may not be preparable, or a literal ? in the query may have been taken as another placeholder */
+	if (stmt && (mysql_stmt_prepare(stmt, statement.c_str(), statement.length()) || mysql_stmt_param_count(stmt) != params))
+	{
+		mysql_stmt_close(stmt);
+		stmt = NULL;
+	}
+
+	this->statements.push_front(std::make_pair(statement, stmt));
+	this->statement_index[statement] = this->statements.begin();
+
+	if (this->statements.size() > MaxStatements)
+	{
+		if (this->statements.back().second)
+			mysql_stmt_close(this->statements.back().second);
+		this->statement_index.erase(this->statements.back().first);
+		this->statements.pop_back();
+	}
+
+	return stmt;
+}
+
+Result MySQLConnection::RunStatement(const Query &query, const Anope::string &statement, MYSQL_STMT *stmt, const std::vector<const Anope::string *> &params)
+{
+	std::vector<MYSQL_BIND> binds(params.size());
+	std::vector<unsigned long> lengths(params.size());
+	memset(&binds[0], 0, sizeof(MYSQL_BIND) * binds.size());
+
+	for (unsigned i = 0; i < params.size(); ++i)
+	{
+		lengths[i] = params[i]->length();
+		binds[i].buffer_type = MYSQL_TYPE_STRING;
+		binds[i].buffer = const_cast<char *>(params[i]->c_str());
+		binds[i].buffer_length = lengths[i];
+		binds[i].length = &lengths[i];
+	}
+
+	if (mysql_stmt_bind_param(stmt, &binds[0]) || mysql_stmt_execute(stmt))
+		return MySQLResult(query, statement, mysql_stmt_error(stmt));
+
+	std::vector<std::map<Anope::string, Anope::string> > rows;
+
+	MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+	if (meta)
+	{
+		/* Have the longest value of every column measured, so the buffers can be sized to fit */
+		const char update_max_length = 1;
+		mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+		if (mysql_stmt_store_result(stmt))
+		{
+			mysql_free_result(meta);
+			return MySQLResult(query, statement, mysql_stmt_error(stmt));
+		}
+
+		unsigned num_fields = mysql_num_fields(meta);
+		MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+		std::vector<MYSQL_BIND> columns(num_fields);
+		std::vector<std::vector<char> > buffers(num_fields);
+		std::vector<unsigned long> column_lengths(num_fields);
+		if (num_fields)
+			memset(&columns[0], 0, sizeof(MYSQL_BIND) * columns.size());
+
+		for (unsigned i = 0; i < num_fields; ++i)
+		{
+			/* max_length is the binary size of numeric columns, which is less than their text */
+			buffers[i].resize(std::max<unsigned long>(fields[i].max_length, 32) + 1);
+			columns[i].buffer_type = MYSQL_TYPE_STRING;
+			columns[i].buffer = &buffers[i][0];
+			columns[i].buffer_length = buffers[i].size();
+			columns[i].length = &column_lengths[i];
+		}
+
+		if (num_fields && mysql_stmt_bind_result(stmt, &columns[0]))
+		{
+			mysql_free_result(meta);
+			mysql_stmt_free_result(stmt);
+			return MySQLResult(query, statement, mysql_stmt_error(stmt));
+		}
+
+		for (;;)
+		{
+			/* The length of NULL values is not set */
+			std::fill(column_lengths.begin(), column_lengths.end(), 0);
+
+			int rc = mysql_stmt_fetch(stmt);
+			if (rc != 0 && rc != MYSQL_DATA_TRUNCATED)
+				break;
+
+			std::map<Anope::string, Anope::string> items;
+
+			for (unsigned i = 0; i < num_fields; ++i)
+			{
+				Anope::string column = (fields[i].name ? fields[i].name : "");
+
+				if (column_lengths[i] < buffers[i].size())
+					items[column] = Anope::string(&buffers[i][0], column_lengths[i]);
+				else
+				{
+					/* Fetch the whole of a value which did not fit */
+					std::vector<char> buffer(column_lengths[i]);
+					unsigned long length = 0;
+					MYSQL_BIND bind;
+					memset(&bind, 0, sizeof(bind));
+					bind.buffer_type = MYSQL_TYPE_STRING;
+					bind.buffer = &buffer[0];
+					bind.buffer_length = buffer.size();
+					bind.length = &length;
+
+					if (!mysql_stmt_fetch_column(stmt, &bind, i, 0))
+						items[column] = Anope::string(&buffer[0], std::min(length, static_cast<unsigned long>(buffer.size())));
+				}
+			}
+
+			rows.push_back(items);
+		}
+
+		mysql_free_result(meta);
+	}
+
+	unsigned int id = mysql_stmt_insert_id(stmt);
+	mysql_stmt_free_result(stmt);
+
+	/* A CALL returns a status result after any result sets of the procedure, and
+	 * all of them must be consumed before the connection can run anything else
+	 */
+	while (!mysql_stmt_next_result(stmt))
+		mysql_stmt_free_result(stmt);
+
+	return MySQLResult(id, query, statement, rows);
+}
+
+Anope::string MySQLConnection::Escape(const Anope::string &query)
 {
 	std::vector<char> buffer(query.length() * 2 + 1);
 	mysql_real_escape_string(this->sql, &buffer[0], query.c_str(), query.length());
 	return &buffer[0];
 }
 
-Anope::string MySQLService::BuildQuery(const Query &q)
+bool MySQLConnection::BuildStatement(const Query &q, Anope::string &statement, std::vector<const Anope::string *> &params)
 {
-	Anope::string real_query = q.query;
+	if (q.parameters.empty())
+		return false;
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+	size_t pos = 0;
+	for (size_t start; (start = q.query.find('@', pos)) != Anope::string::npos;)
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
 
-	return real_query;
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			statement.append(q.query.c_str() + pos, start + 1 - pos);
+			pos = start + 1;
+			continue;
+		}
+
+		statement.append(q.query.c_str() + pos, start - pos);
+		if (it->second.escape)
+		{
+			statement += "?";
+			params.push_back(&it->second.data);
+		}
+		else
+			statement += it->second.data;
+		pos = end + 1;
+	}
+	statement.append(q.query.c_str() + pos, q.query.length() - pos);
+
+	return !params.empty();
 }
 
-Anope::string MySQLService::FromUnixtime(time_t t)
+Anope::string MySQLConnection::BuildQuery(const Query &q)
 {
-	return "FROM_UNIXTIME(" + stringify(t) + ")";
+	if (q.parameters.empty())
+		return q.query;
+
+	/* Substitute every @name@ in one pass, so large multi row queries stay linear
+	 * and substituted values are never scanned for parameters themselves.
+	 */
+	Anope::string real_query;
+	size_t pos = 0;
+	for (size_t start; (start = q.query.find('@', pos)) != Anope::string::npos;)
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
+
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			real_query.append(q.query.c_str() + pos, start + 1 - pos);
+			pos = start + 1;
+			continue;
+		}
+
+		real_query.append(q.query.c_str() + pos, start - pos);
+		if (it->second.escape)
+			real_query += "'" + this->Escape(it->second.data) + "'";
+		else
+			real_query += it->second.data;
+		pos = end + 1;
+	}
+	real_query.append(q.query.c_str() + pos, q.query.length() - pos);
+
+	return real_query;
 }
 
 void DispatcherThread::Run()
@@ -526,30 +1017,30 @@ void DispatcherThread::Run()
 
 	while (!this->GetExitState())
 	{
-		if (!me->QueryRequests.empty())
+		if (!this->QueryRequests.empty())
 		{
-			QueryRequest &r = me->QueryRequests.front();
+			QueryRequest r = this->QueryRequests.front();
 			this->Unlock();
 
-			Result sresult = r.service->RunQuery(r.query);
+			Result sresult = this->conn.RunQuery(r.query);
 
 			this->Lock();
-			if (!me->QueryRequests.empty() && me->QueryRequests.front().query == r.query)
+			if (!this->QueryRequests.empty() && this->QueryRequests.front().id == r.id)
 			{
+				this->QueryRequests.pop_front();
+				this->service->AddLatency(QueueStats::LANE_BACKGROUND, r.queued);
 				if (r.sqlinterface)
-					me->FinishedRequests.push_back(QueryResult(r.sqlinterface, sresult));
-				me->QueryRequests.pop_front();
+					me->AddResult(QueryResult(r.sqlinterface, sresult));
 			}
 		}
 		else
-		{
-			if (!me->FinishedRequests.empty())
-				me->Notify();
 			this->Wait();
-		}
 	}
 
 	this->Unlock();
+
+	this->conn.Close();
+	mysql_thread_end();
 }
 
 MODULE_INIT(ModuleSQL)
@@ -15,6 +15,8 @@
 class PCRERegex : public Regex
 {
 	pcre *regex;
+	/* Study data, which holds the JIT compiled code if pcre supports it */
+	pcre_extra *extra;
 
  public:
 	PCRERegex(const Anope::string &expr) : Regex(expr)
@@ -24,16 +26,28 @@ class PCRERegex : public Regex
 		this->regex = pcre_compile(expr.c_str(), PCRE_CASELESS, &error, &erroffset, NULL);
 		if (!this->regex)
 			throw RegexException("Error in regex " + expr + " at offset " + stringify(erroffset) + ": " + error);
+
+		/* Failing to study only makes matching slower, so errors are ignored */
+#ifdef PCRE_STUDY_JIT_COMPILE
+		this->extra = pcre_study(this->regex, PCRE_STUDY_JIT_COMPILE, &error);
+#else
+		this->extra = pcre_study(this->regex, 0, &error);
+#endif
 	}
 
 	~PCRERegex()
 	{
+#ifdef PCRE_STUDY_JIT_COMPILE
+		pcre_free_study(this->extra);
+#else
+		pcre_free(this->extra);
+#endif
 		pcre_free(this->regex);
 	}
 
 	bool Matches(const Anope::string &str)
 	{
-		return pcre_exec(this->regex, NULL, str.c_str(), str.length(), 0, 0, NULL, 0) > -1;
+		return pcre_exec(this->regex, this->extra, str.c_str(), str.length(), 0, 0, NULL, 0) > -1;
 	}
 };
 
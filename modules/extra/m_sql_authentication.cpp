@@ -8,22 +8,29 @@
 
 #include "module.h"
 #include "modules/sql.h"
+#include "modules/auth_cache.h"
 
 static Module *me;
+static ExternalAuth::Cache *cache;
 
 class SQLAuthenticationResult : public SQL::Interface
 {
 	Reference<User> user;
 	IdentifyRequest *req;
+	Anope::string key;
+	unsigned long long lookup_id;
+	bool success;
 
  public:
-	SQLAuthenticationResult(User *u, IdentifyRequest *r) : SQL::Interface(me), user(u), req(r)
+	SQLAuthenticationResult(User *u, IdentifyRequest *r, const Anope::string &k, unsigned long long id) : SQL::Interface(me), user(u), req(r), key(k), lookup_id(id), success(false)
 	{
 		req->Hold(me);
 	}
 
 	~SQLAuthenticationResult()
 	{
+		/* Attempts with the same credentials which arrived during the query get the same answer */
+		cache->Finish(key, lookup_id, success);
 		req->Release(me);
 	}
 
@@ -63,6 +70,7 @@ class SQLAuthenticationResult : public SQL::Interface
 		}
 
 		req->Success(me);
+		success = true;
 		delete this;
 	}
 
@@ -80,12 +88,14 @@ class ModuleSQLAuthentication : public Module
 	Anope::string disable_reason, disable_email_reason;
 
 	ServiceReference<SQL::Provider> SQL;
+	ExternalAuth::Cache authcache;
 
  public:
-	ModuleSQLAuthentication(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	ModuleSQLAuthentication(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR),
+		authcache(this, "sql_authentication")
 	{
 		me = this;
-
+		cache = &authcache;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -95,6 +105,8 @@ class ModuleSQLAuthentication : public Module
 		this->query =  config->Get<const Anope::string>("query");
 		this->disable_reason = config->Get<const Anope::string>("disable_reason");
 		this->disable_email_reason = config->Get<Anope::string>("disable_email_reason");
+		this->authcache.ttl = config->Get<time_t>("cache_time", "2m");
+		this->authcache.Clear();
 
 		this->SQL = ServiceReference<SQL::Provider>("SQL::Provider", this->engine);
 	}
@@ -124,6 +136,14 @@ class ModuleSQLAuthentication : public Module
 			return;
 		}
 
+		Anope::string key;
+		unsigned long long lookup_id;
+		if (this->authcache.Check(req, key, lookup_id))
+		{
+			Log(LOG_DEBUG) << "m_sql_authentication: Using cached or pending authentication for " << req->GetAccount();
+			return;
+		}
+
 		SQL::Query q(this->query);
 		q.SetValue("a", req->GetAccount());
 		q.SetValue("p", req->GetPassword());
@@ -139,7 +159,7 @@ class ModuleSQLAuthentication : public Module
 		}
 
 
-		this->SQL->Run(new SQLAuthenticationResult(u, req), q);
+		this->SQL->Run(new SQLAuthenticationResult(u, req, key, lookup_id), q);
 
 		Log(LOG_DEBUG) << "m_sql_authentication: Checking authentication for " << req->GetAccount();
 	}
@@ -61,8 +61,12 @@ class SQLiteService : public Provider
 
 	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data);
 
+	Query BuildInsert(const Anope::string &table, const std::vector<std::pair<unsigned int, Data *> > &rows) anope_override;
+
 	Query GetTables(const Anope::string &prefix);
 
+	std::vector<Query> CreateChangeLog(const Anope::string &log_table, const Anope::string &table, const Anope::string &type_name) anope_override;
+
 	Anope::string BuildQuery(const Query &q);
 
 	Anope::string FromUnixtime(time_t);
@@ -303,11 +307,71 @@ Query SQLiteService::BuildInsert(const Anope::string &table, unsigned int id, Da
 	return query;
 }
 
+Query SQLiteService::BuildInsert(const Anope::string &table, const std::vector<std::pair<unsigned int, Data *> > &rows)
+{
+	/* Every row has to list the same columns, so pad them all to every known column */
+	std::set<Anope::string> columns;
+	const std::set<Anope::string> &known_cols = this->active_schema[table];
+	for (std::set<Anope::string>::iterator it = known_cols.begin(), it_end = known_cols.end(); it != it_end; ++it)
+		if (*it != "id" && *it != "timestamp")
+			columns.insert(*it);
+	for (unsigned i = 0; i < rows.size(); ++i)
+		for (Data::Map::const_iterator it = rows[i].second->data.begin(), it_end = rows[i].second->data.end(); it != it_end; ++it)
+			columns.insert(it->first);
+
+	Anope::string query_text = "REPLACE INTO `" + table + "` (`id`";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += ",`" + *it + "`";
+	query_text += ") VALUES ";
+
+	for (unsigned i = 0; i < rows.size(); ++i)
+	{
+		query_text += (i ? ",(" : "(") + stringify(rows[i].first);
+		for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+			query_text += ",@" + *it + "#" + stringify(i) + "@";
+		query_text += ")";
+	}
+
+	Query query(query_text);
+	for (unsigned i = 0; i < rows.size(); ++i)
+	{
+		Data &data = *rows[i].second;
+
+		for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		{
+			Anope::string buf;
+			data[*it] >> buf;
+			query.SetValue(*it + "#" + stringify(i), buf);
+		}
+	}
+
+	return query;
+}
+
 Query SQLiteService::GetTables(const Anope::string &prefix)
 {
 	return Query("SELECT name FROM sqlite_master WHERE type='table' AND name LIKE '" + prefix + "%';");
 }
 
+std::vector<Query> SQLiteService::CreateChangeLog(const Anope::string &log_table, const Anope::string &table, const Anope::string &type_name)
+{
+	std::vector<Query> queries;
+
+	queries.push_back(Query("CREATE TABLE IF NOT EXISTS `" + log_table + "` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `type` text NOT NULL, `object_id` int(10) NOT NULL)"));
+
+	static const char *events[] = { "INSERT", "UPDATE", "DELETE" };
+	for (unsigned i = 0; i < 3; ++i)
+	{
+		const Anope::string event = events[i];
+		const Anope::string row = event == "DELETE" ? "old" : "new";
+
+		queries.push_back(Query("CREATE TRIGGER IF NOT EXISTS `" + table + "_log_" + event.lower() + "` AFTER " + event + " ON `" + table + "` FOR EACH ROW"
+			" BEGIN INSERT INTO `" + log_table + "` (`type`, `object_id`) VALUES ('" + type_name + "', " + row + ".`id`); END;"));
+	}
+
+	return queries;
+}
+
 Anope::string SQLiteService::Escape(const Anope::string &query)
 {
 	char *e = sqlite3_mprintf("%q", query.c_str());
@@ -318,10 +382,36 @@ Anope::string SQLiteService::Escape(const Anope::string &query)
 
 Anope::string SQLiteService::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
+	if (q.parameters.empty())
+		return q.query;
+
+	/* Substitute every @name@ in one pass, so large multi row queries stay linear
+	 * and substituted values are never scanned for parameters themselves.
+	 */
+	Anope::string real_query;
+	size_t pos = 0;
+	for (size_t start; (start = q.query.find('@', pos)) != Anope::string::npos;)
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			real_query.append(q.query.c_str() + pos, start + 1 - pos);
+			pos = start + 1;
+			continue;
+		}
+
+		real_query.append(q.query.c_str() + pos, start - pos);
+		if (it->second.escape)
+			real_query += "'" + this->Escape(it->second.data) + "'";
+		else
+			real_query += it->second.data;
+		pos = end + 1;
+	}
+	real_query.append(q.query.c_str() + pos, q.query.length() - pos);
 
 	return real_query;
 }
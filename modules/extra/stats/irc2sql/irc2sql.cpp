@@ -14,6 +14,8 @@ void IRC2SQL::OnShutdown()
 	// (sometimes m_mysql get unloaded before the other thread executed all queries)
 	if (this->sql)
 		SQL::Result r = this->sql->RunQuery(SQL::Query("CALL " + prefix + "OnShutdown()"));
+	/* Everything is cleared from the database at shutdown */
+	journal.Clear();
 	quitting = true;
 }
 
@@ -24,6 +26,9 @@ void IRC2SQL::OnReload(Configuration::Conf *conf)
 	GeoIPDB = block->Get<const Anope::string>("geoip_database");
 	ctcpuser = block->Get<bool>("ctcpuser", "no");
 	ctcpeob = block->Get<bool>("ctcpeob", "yes");
+	flush_size = block->Get<size_t>("flush_size", "5000");
+	time_t flush_interval = block->Get<time_t>("flush_interval", "2s");
+	flush_timer.SetSecs(flush_interval > 0 ? flush_interval : 1);
 	Anope::string engine = block->Get<const Anope::string>("engine");
 	this->sql = ServiceReference<SQL::Provider>("SQL::Provider", engine);
 	if (sql)
@@ -84,6 +89,9 @@ void IRC2SQL::OnServerQuit(Server *server)
 	if (quitting)
 		return;
 
+	/* The procedure works on the users of the server, so they must be written first */
+	this->Flush();
+
 	query = "CALL " + prefix + "ServerQuit(@name@)";
 	query.SetValue("name", server->GetName());
 	this->RunQuery(query);
@@ -97,25 +105,8 @@ void IRC2SQL::OnUserConnect(User *u, bool &exempt)
 		introduced_myself = true;
 	}
 
-	query = "CALL " + prefix + "UserConnect(@nick@,@host@,@vhost@,@chost@,@realname@,@ip@,@ident@,@vident@,"
-			"@account@,@secure@,@fingerprint@,@signon@,@server@,@uuid@,@modes@,@oper@)";
-	query.SetValue("nick", u->nick);
-	query.SetValue("host", u->host);
-	query.SetValue("vhost", u->vhost);
-	query.SetValue("chost", u->chost);
-	query.SetValue("realname", u->realname);
-	query.SetValue("ip", u->ip.addr());
-	query.SetValue("ident", u->GetIdent());
-	query.SetValue("vident", u->GetVIdent());
-	query.SetValue("secure", u->HasMode("SSL") || u->HasExt("ssl") ? "Y" : "N");
-	query.SetValue("account", u->Account() ? u->Account()->display : "");
-	query.SetValue("fingerprint", u->fingerprint);
-	query.SetValue("signon", u->signon);
-	query.SetValue("server", u->server->GetName());
-	query.SetValue("uuid", u->GetUID());
-	query.SetValue("modes", u->GetModes());
-	query.SetValue("oper", u->HasMode("OPER") ? "Y" : "N");
-	this->RunQuery(query);
+	GetPending(u, u->nick).connected = true;
+	this->CheckFlush();
 
 	if (ctcpuser && (Me->IsSynced() || ctcpeob) && u->server != Me)
 		IRCD->SendPrivmsg(StatServ, u->GetUID(), "\1VERSION\1");
@@ -124,47 +115,54 @@ void IRC2SQL::OnUserConnect(User *u, bool &exempt)
 
 void IRC2SQL::OnUserQuit(User *u, const Anope::string &msg)
 {
+	/* Memberships of the user end with it, which we do not need to remove on their own */
+	std::map<std::pair<User *, Channel *>, bool>::iterator mit = journal.members.lower_bound(std::make_pair(u, static_cast<Channel *>(NULL)));
+	while (mit != journal.members.end() && mit->first.first == u)
+		journal.members.erase(mit++);
+
+	std::map<User *, Journal::PendingUser>::iterator it = journal.users.find(u);
+	Anope::string db_nick = u->nick;
+	if (it != journal.users.end())
+	{
+		bool connected = it->second.connected;
+		db_nick = it->second.db_nick;
+		journal.users.erase(it);
+		/* Never written, so there is nothing to remove */
+		if (connected)
+			return;
+	}
+
 	if (quitting || u->server->IsQuitting())
 		return;
 
-	query = "CALL " + prefix + "UserQuit(@nick@)";
-	query.SetValue("nick", u->nick);
-	this->RunQuery(query);
+	journal.quits.push_back(std::make_pair(db_nick, u->server->GetName()));
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnUserNickChange(User *u, const Anope::string &oldnick)
 {
-	query = "UPDATE `" + prefix + "user` SET nick=@newnick@ WHERE nick=@oldnick@";
-	query.SetValue("newnick", u->nick);
-	query.SetValue("oldnick", oldnick);
-	this->RunQuery(query);
+	GetPending(u, oldnick);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnUserAway(User *u, const Anope::string &message)
 {
-	query = "UPDATE `" + prefix + "user` SET away=@away@, awaymsg=@awaymsg@ WHERE nick=@nick@";
-	query.SetValue("away", (!message.empty()) ? "Y" : "N");
-	query.SetValue("awaymsg", message);
-	query.SetValue("nick", u->nick);
-	this->RunQuery(query);
+	Journal::PendingUser &p = GetPending(u, u->nick);
+	p.away_changed = true;
+	p.awaymsg = message;
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnFingerprint(User *u)
 {
-	query = "UPDATE `" + prefix + "user` SET secure=@secure@, fingerprint=@fingerprint@ WHERE nick=@nick@";
-	query.SetValue("secure", u->HasMode("SSL") || u->HasExt("ssl") ? "Y" : "N");
-	query.SetValue("fingerprint", u->fingerprint);
-	query.SetValue("nick", u->nick);
-	this->RunQuery(query);
+	GetPending(u, u->nick);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnUserModeSet(const MessageSource &setter, User *u, const Anope::string &mname)
 {
-	query = "UPDATE `" + prefix + "user` SET modes=@modes@, oper=@oper@ WHERE nick=@nick@";
-	query.SetValue("nick", u->nick);
-	query.SetValue("modes", u->GetModes());
-	query.SetValue("oper", u->HasMode("OPER") ? "Y" : "N");
-	this->RunQuery(query);
+	GetPending(u, u->nick);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnUserModeUnset(const MessageSource &setter, User *u, const Anope::string &mname)
@@ -174,10 +172,8 @@ void IRC2SQL::OnUserModeUnset(const MessageSource &setter, User *u, const Anope:
 
 void IRC2SQL::OnUserLogin(User *u)
 {
-	query = "UPDATE `" + prefix + "user` SET account=@account@ WHERE nick=@nick@";
-	query.SetValue("nick", u->nick);
-	query.SetValue("account", u->Account() ? u->Account()->display : "");
-	this->RunQuery(query);
+	GetPending(u, u->nick);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnNickLogout(User *u)
@@ -187,50 +183,32 @@ void IRC2SQL::OnNickLogout(User *u)
 
 void IRC2SQL::OnSetDisplayedHost(User *u)
 {
-	query = "UPDATE `" + prefix + "user` "
-		"SET vhost=@vhost@ "
-		"WHERE nick=@nick@";
-	query.SetValue("vhost", u->GetDisplayedHost());
-	query.SetValue("nick", u->nick);
-	this->RunQuery(query);
+	GetPending(u, u->nick);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnChannelCreate(Channel *c)
 {
-	query = "INSERT INTO `" + prefix + "chan` (channel, topic, topicauthor, topictime, modes) "
-		"VALUES (@channel@,@topic@,@topicauthor@,@topictime@,@modes@) "
-		"ON DUPLICATE KEY UPDATE channel=VALUES(channel), topic=VALUES(topic),"
-			"topicauthor=VALUES(topicauthor), topictime=VALUES(topictime), modes=VALUES(modes)";
-	query.SetValue("channel", c->name);
-	query.SetValue("topic", c->topic);
-	query.SetValue("topicauthor", c->topic_setter);
-	if (c->topic_ts > 0)
-		query.SetValue("topictime", c->topic_ts);
-	else
-		query.SetValue("topictime", "NULL", false);
-	query.SetValue("modes", c->GetModes(true,true));
-	this->RunQuery(query);
+	journal.chans[c] = true;
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnChannelDelete(Channel *c)
 {
-	query = "DELETE FROM `" + prefix + "chan` WHERE channel=@channel@";
-	query.SetValue("channel",  c->name);
-	this->RunQuery(query);
+	std::map<Channel *, bool>::iterator it = journal.chans.find(c);
+	bool chan_created = it != journal.chans.end() && it->second;
+	if (it != journal.chans.end())
+		journal.chans.erase(it);
+
+	if (!chan_created)
+		journal.deleted_chans.insert(c->name);
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnJoinChannel(User *u, Channel *c)
 {
-	Anope::string modes;
-	ChanUserContainer *cu = u->FindChannel(c);
-	if (cu)
-		modes = cu->status.Modes();
-
-	query = "CALL " + prefix + "JoinUser(@nick@,@channel@,@modes@)";
-	query.SetValue("nick", u->nick);
-	query.SetValue("channel", c->name);
-	query.SetValue("modes", modes);
-	this->RunQuery(query);
+	journal.members[std::make_pair(u, c)] = true;
+	this->CheckFlush();
 }
 
 EventReturn IRC2SQL::OnChannelModeSet(Channel *c, MessageSource &setter, ChannelMode *mode, const Anope::string &param)
@@ -238,29 +216,15 @@ EventReturn IRC2SQL::OnChannelModeSet(Channel *c, MessageSource &setter, Channel
 	if (mode->type == MODE_STATUS)
 	{
 		User *u = User::Find(param);
-		if (u == NULL)
-			return EVENT_CONTINUE;
-
-		ChanUserContainer *cc = u->FindChannel(c);
-		if (cc == NULL)
+		if (u == NULL || u->FindChannel(c) == NULL)
 			return EVENT_CONTINUE;
 
-		query = "UPDATE `" + prefix + "user` AS u, `" + prefix + "ison` AS i, `" + prefix + "chan` AS c"
-				" SET i.modes=@modes@"
-				" WHERE u.nick=@nick@ AND c.channel=@channel@"
-				" AND u.nickid = i.nickid AND c.chanid = i.chanid";
-		query.SetValue("nick", u->nick);
-		query.SetValue("modes", cc->status.Modes());
-		query.SetValue("channel", c->name);
-		this->RunQuery(query);
+		/* Keeps a new membership new */
+		journal.members.insert(std::make_pair(std::make_pair(u, c), false));
 	}
 	else
-	{
-		query = "UPDATE `" + prefix + "chan` SET modes=@modes@ WHERE channel=@channel@";
-		query.SetValue("channel", c->name);
-		query.SetValue("modes", c->GetModes(true,true));
-		this->RunQuery(query);
-	}
+		journal.chans.insert(std::make_pair(c, false));
+	this->CheckFlush();
 	return EVENT_CONTINUE;
 }
 
@@ -280,22 +244,30 @@ void IRC2SQL::OnLeaveChannel(User *u, Channel *c)
 	 */
 	if (u->Quitting())
 		return;
-	query = "CALL " + prefix + "PartUser(@nick@,@channel@)";
-	query.SetValue("nick", u->nick);
-	query.SetValue("channel", c->name);
-	this->RunQuery(query);
+
+	std::map<std::pair<User *, Channel *>, bool>::iterator it = journal.members.find(std::make_pair(u, c));
+	bool joined = it != journal.members.end() && it->second;
+	if (it != journal.members.end())
+		journal.members.erase(it);
+
+	/* Memberships, users and channels which were never written have nothing to remove */
+	if (joined)
+		return;
+	std::map<User *, Journal::PendingUser>::iterator uit = journal.users.find(u);
+	if (uit != journal.users.end() && uit->second.connected)
+		return;
+	std::map<Channel *, bool>::iterator cit = journal.chans.find(c);
+	if (cit != journal.chans.end() && cit->second)
+		return;
+
+	journal.parts.push_back(std::make_pair(uit != journal.users.end() ? uit->second.db_nick : u->nick, c->name));
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnTopicUpdated(User *source, Channel *c, const Anope::string &user, const Anope::string &topic)
 {
-	query = "UPDATE `" + prefix + "chan` "
-		"SET topic=@topic@, topicauthor=@author@, topictime=FROM_UNIXTIME(@time@) "
-		"WHERE channel=@channel@";
-	query.SetValue("topic", c->topic);
-	query.SetValue("author", c->topic_setter);
-	query.SetValue("time", c->topic_ts);
-	query.SetValue("channel", c->name);
-	this->RunQuery(query);
+	journal.chans.insert(std::make_pair(c, false));
+	this->CheckFlush();
 }
 
 void IRC2SQL::OnBotNotice(User *u, BotInfo *bi, Anope::string &message)
@@ -314,12 +286,8 @@ void IRC2SQL::OnBotNotice(User *u, BotInfo *bi, Anope::string &message)
 			versionstr = Anope::NormalizeBuffer(message.substr(9, message.length() - 10));
 			if (versionstr.empty())
 				return;
-			query = "UPDATE `" + prefix + "user` "
-				"SET version=@version@ "
-				"WHERE nick=@nick@";
-			query.SetValue("version", versionstr);
-			query.SetValue("nick", u->nick);
-			this->RunQuery(query);
+			GetPending(u, u->nick).version = versionstr;
+			this->CheckFlush();
 		}
 	}
 }
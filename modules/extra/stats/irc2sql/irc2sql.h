@@ -27,6 +27,68 @@ class MySQLInterface : public SQL::Interface
 	}
 };
 
+/* Changes not yet written to the database. Events are collected here and
+ * written with a few multi row queries when the journal is flushed, with
+ * later changes to a user or channel replacing earlier ones.
+ */
+struct Journal
+{
+	struct PendingUser
+	{
+		/* Set if the user connected since the last flush, so is not in the database yet */
+		bool connected;
+		/* The nick the user has in the database */
+		Anope::string db_nick;
+		/* Set if the user went away or came back */
+		bool away_changed;
+		Anope::string awaymsg;
+		/* The reply to our CTCP VERSION, if one arrived */
+		Anope::string version;
+
+		PendingUser() : connected(false), away_changed(false) { }
+	};
+
+	/* Users to write the current state of */
+	std::map<User *, PendingUser> users;
+	/* Users which quit, by their nick in the database, and the server they were on */
+	std::vector<std::pair<Anope::string, Anope::string> > quits;
+	/* Channels to write the current state of, and whether they were created since the last flush */
+	std::map<Channel *, bool> chans;
+	/* Channels which were deleted */
+	std::set<Anope::string> deleted_chans;
+	/* Memberships to write the current state of, and whether they are new since the last flush */
+	std::map<std::pair<User *, Channel *>, bool> members;
+	/* Memberships which ended, by the nick of the user in the database and the channel */
+	std::vector<std::pair<Anope::string, Anope::string> > parts;
+
+	size_t Size() const
+	{
+		return users.size() + quits.size() + chans.size() + deleted_chans.size() + members.size() + parts.size();
+	}
+
+	void Clear()
+	{
+		users.clear();
+		quits.clear();
+		chans.clear();
+		deleted_chans.clear();
+		members.clear();
+		parts.clear();
+	}
+};
+
+class IRC2SQL;
+
+class FlushTimer : public Timer
+{
+	IRC2SQL *module;
+
+ public:
+	FlushTimer(IRC2SQL *m);
+
+	void Tick(time_t) anope_override;
+};
+
 class IRC2SQL : public Module
 {
 	ServiceReference<SQL::Provider> sql;
@@ -38,9 +100,22 @@ class IRC2SQL : public Module
 	BotInfo *StatServ;
 	PrimitiveExtensibleItem<bool> versionreply;
 
+	Journal journal;
+	/* Flush the journal once it holds this many changes */
+	size_t flush_size;
+	FlushTimer flush_timer;
+
 	void RunQuery(const SQL::Query &q);
 	void GetTables();
 
+	/** Get the pending changes of a user, adding them if there are none
+	 * @param db_nick The nick the user has in the database, if there are none
+	 */
+	Journal::PendingUser &GetPending(User *u, const Anope::string &db_nick);
+
+	/** Flush the journal if it is full */
+	void CheckFlush();
+
 	bool HasTable(const Anope::string &table);
 	bool HasProcedure(const Anope::string &table);
 	bool HasEvent(const Anope::string &table);
@@ -49,13 +124,16 @@ class IRC2SQL : public Module
 
  public:
 	IRC2SQL(const Anope::string &modname, const Anope::string &creator) :
-		Module(modname, creator, EXTRA | VENDOR), sql("", ""), sqlinterface(this), versionreply(this, "CTCPVERSION")
+		Module(modname, creator, EXTRA | VENDOR), sql("", ""), sqlinterface(this), versionreply(this, "CTCPVERSION"), flush_size(5000), flush_timer(this)
 	{
 		firstrun = true;
 		quitting = false;
 		introduced_myself = false;
 	}
 
+	/** Write every change in the journal to the database */
+	void Flush();
+
 	void OnShutdown() anope_override;
 	void OnReload(Configuration::Conf *config) anope_override;
 	void OnNewServer(Server *server) anope_override;
@@ -0,0 +1,393 @@
+/*
+ *
+ * (C) 2013-2020 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#include "irc2sql.h"
+
+/* The most rows written by one query */
+static const size_t RowsPerQuery = 500;
+
+/** Build a list of parameters, @name0@,@name1@... for the rows from start to end */
+static Anope::string Parameters(const Anope::string &name, size_t start, size_t end)
+{
+	Anope::string list;
+	for (size_t i = start; i < end; ++i)
+		list += (i > start ? ",@" : "@") + name + stringify(i) + "@";
+	return list;
+}
+
+/** Build a CASE expression mapping each @key#@ to its @value#@ */
+static Anope::string Case(const Anope::string &column, const Anope::string &key, const Anope::string &value, size_t start, size_t end)
+{
+	Anope::string expr = "CASE " + column;
+	for (size_t i = start; i < end; ++i)
+		expr += " WHEN @" + key + stringify(i) + "@ THEN @" + value + stringify(i) + "@";
+	return expr + " END";
+}
+
+FlushTimer::FlushTimer(IRC2SQL *m) : Timer(m, 2, Anope::CurTime, true), module(m)
+{
+}
+
+void FlushTimer::Tick(time_t)
+{
+	module->Flush();
+}
+
+Journal::PendingUser &IRC2SQL::GetPending(User *u, const Anope::string &db_nick)
+{
+	std::map<User *, Journal::PendingUser>::iterator it = journal.users.find(u);
+	if (it == journal.users.end())
+	{
+		it = journal.users.insert(std::make_pair(u, Journal::PendingUser())).first;
+		it->second.db_nick = db_nick;
+	}
+	return it->second;
+}
+
+void IRC2SQL::CheckFlush()
+{
+	if (journal.Size() >= flush_size)
+		this->Flush();
+}
+
+void IRC2SQL::Flush()
+{
+	if (!journal.Size())
+		return;
+
+	/* Connected users less users which quit, by server */
+	std::map<Anope::string, int> server_delta;
+
+	/* Users which quit */
+	for (size_t start = 0; start < journal.quits.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, journal.quits.size());
+		const Anope::string list = Parameters("nick", start, end);
+
+		SQL::Query ison("DELETE i FROM `" + prefix + "ison` AS i "
+			"INNER JOIN `" + prefix + "user` AS u ON i.nickid = u.nickid "
+			"WHERE u.nick IN (" + list + ")");
+		SQL::Query user("DELETE FROM `" + prefix + "user` WHERE nick IN (" + list + ")");
+		for (size_t i = start; i < end; ++i)
+		{
+			ison.SetValue("nick" + stringify(i), journal.quits[i].first);
+			user.SetValue("nick" + stringify(i), journal.quits[i].first);
+			--server_delta[journal.quits[i].second];
+		}
+		this->RunQuery(ison);
+		this->RunQuery(user);
+	}
+
+	/* Parts, before any renames as they are by the nick in the database */
+	for (size_t start = 0; start < journal.parts.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, journal.parts.size());
+
+		Anope::string list;
+		for (size_t i = start; i < end; ++i)
+			list += Anope::string(i > start ? "," : "") + "(@nick" + stringify(i) + "@,@channel" + stringify(i) + "@)";
+
+		query = "DELETE i FROM `" + prefix + "ison` AS i "
+			"INNER JOIN `" + prefix + "user` AS u ON i.nickid = u.nickid "
+			"INNER JOIN `" + prefix + "chan` AS c ON i.chanid = c.chanid "
+			"WHERE (u.nick, c.channel) IN (" + list + ")";
+		for (size_t i = start; i < end; ++i)
+		{
+			query.SetValue("nick" + stringify(i), journal.parts[i].first);
+			query.SetValue("channel" + stringify(i), journal.parts[i].second);
+		}
+		this->RunQuery(query);
+	}
+
+	/* Deleted channels */
+	std::vector<Anope::string> deleted(journal.deleted_chans.begin(), journal.deleted_chans.end());
+	for (size_t start = 0; start < deleted.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, deleted.size());
+		const Anope::string list = Parameters("channel", start, end);
+
+		SQL::Query ison("DELETE i FROM `" + prefix + "ison` AS i "
+			"INNER JOIN `" + prefix + "chan` AS c ON i.chanid = c.chanid "
+			"WHERE c.channel IN (" + list + ")");
+		SQL::Query chan("DELETE FROM `" + prefix + "chan` WHERE channel IN (" + list + ")");
+		for (size_t i = start; i < end; ++i)
+		{
+			ison.SetValue("channel" + stringify(i), deleted[i]);
+			chan.SetValue("channel" + stringify(i), deleted[i]);
+		}
+		this->RunQuery(ison);
+		this->RunQuery(chan);
+	}
+
+	std::vector<User *> users, connected, away, versions;
+	std::vector<std::pair<Anope::string, Anope::string> > renames;
+	for (std::map<User *, Journal::PendingUser>::const_iterator it = journal.users.begin(), it_end = journal.users.end(); it != it_end; ++it)
+	{
+		User *u = it->first;
+		const Journal::PendingUser &p = it->second;
+
+		users.push_back(u);
+		if (p.connected)
+		{
+			connected.push_back(u);
+			++server_delta[u->server->GetName()];
+		}
+		else if (p.db_nick != u->nick)
+			renames.push_back(std::make_pair(p.db_nick, u->nick));
+		if (p.away_changed)
+			away.push_back(u);
+		if (!p.version.empty())
+			versions.push_back(u);
+	}
+
+	/* Renames go through temporary nicks first, so users swapping nicks
+	 * never collide on the unique key of the nick column
+	 */
+	for (int phase = 0; phase < 2; ++phase)
+		for (size_t start = 0; start < renames.size(); start += RowsPerQuery)
+		{
+			size_t end = std::min(start + RowsPerQuery, renames.size());
+
+			query = "UPDATE `" + prefix + "user` SET nick = " + Case("nick", "from", "to", start, end) + " WHERE nick IN (" + Parameters("from", start, end) + ")";
+			for (size_t i = start; i < end; ++i)
+			{
+				const Anope::string temp = "#" + stringify(i);
+				query.SetValue("from" + stringify(i), phase == 0 ? renames[i].first : temp);
+				query.SetValue("to" + stringify(i), phase == 0 ? temp : renames[i].second);
+			}
+			this->RunQuery(query);
+		}
+
+	/* The current state of every changed user, which also inserts new users */
+	for (size_t start = 0; start < users.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, users.size());
+
+		query = "INSERT INTO `" + prefix + "user` "
+			"(nick, host, vhost, chost, realname, ip, ident, vident, account, "
+			"secure, fingerprint, signon, server, uuid, modes, oper) VALUES ";
+		for (size_t i = start; i < end; ++i)
+		{
+			const Anope::string n = "#" + stringify(i) + "@";
+			query.query += Anope::string(i > start ? "," : "") + "(@nick" + n + ",@host" + n + ",@vhost" + n + ",@chost" + n + ",@realname" + n + ",@ip" + n +
+				",@ident" + n + ",@vident" + n + ",@account" + n + ",@secure" + n + ",@fingerprint" + n + ",FROM_UNIXTIME(@signon" + n + ")" +
+				",@server" + n + ",@uuid" + n + ",@modes" + n + ",@oper" + n + ")";
+		}
+		query.query += " ON DUPLICATE KEY UPDATE host=VALUES(host), vhost=VALUES(vhost), "
+				"chost=VALUES(chost), realname=VALUES(realname), ip=VALUES(ip), "
+				"ident=VALUES(ident), vident=VALUES(vident), account=VALUES(account), "
+				"secure=VALUES(secure), fingerprint=VALUES(fingerprint), signon=VALUES(signon), "
+				"server=VALUES(server), uuid=VALUES(uuid), modes=VALUES(modes), "
+				"oper=VALUES(oper)";
+
+		for (size_t i = start; i < end; ++i)
+		{
+			User *u = users[i];
+			const Anope::string n = "#" + stringify(i);
+
+			query.SetValue("nick" + n, u->nick);
+			query.SetValue("host" + n, u->host);
+			query.SetValue("vhost" + n, journal.users[u].connected ? u->vhost : u->GetDisplayedHost());
+			query.SetValue("chost" + n, u->chost);
+			query.SetValue("realname" + n, u->realname);
+			query.SetValue("ip" + n, u->ip.addr());
+			query.SetValue("ident" + n, u->GetIdent());
+			query.SetValue("vident" + n, u->GetVIdent());
+			query.SetValue("account" + n, u->Account() ? u->Account()->display : "");
+			query.SetValue("secure" + n, u->HasMode("SSL") || u->HasExt("ssl") ? "Y" : "N");
+			query.SetValue("fingerprint" + n, u->fingerprint);
+			query.SetValue("signon" + n, u->signon);
+			query.SetValue("server" + n, u->server->GetName());
+			query.SetValue("uuid" + n, u->GetUID());
+			query.SetValue("modes" + n, u->GetModes());
+			query.SetValue("oper" + n, u->HasMode("OPER") ? "Y" : "N");
+		}
+		this->RunQuery(query);
+	}
+
+	/* Link new users to their server, and look up where they are */
+	for (size_t start = 0; start < connected.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, connected.size());
+		const Anope::string list = Parameters("nick", start, end);
+
+		std::vector<SQL::Query> queries;
+		queries.push_back(SQL::Query("UPDATE `" + prefix + "user` AS u "
+			"INNER JOIN `" + prefix + "server` AS s ON s.name = u.server "
+			"SET u.servid = s.id WHERE u.nick IN (" + list + ")"));
+
+		/* The ranges do not overlap, so the one holding an address is the first to end after it */
+		if (GeoIPDB.equals_ci("country"))
+			queries.push_back(SQL::Query("UPDATE `" + prefix + "user` AS u "
+				"INNER JOIN `" + prefix + "geoip_country` AS c "
+					"ON c.`end` = (SELECT MIN(g.`end`) FROM `" + prefix + "geoip_country` AS g WHERE g.`end` >= INET_ATON(u.ip)) "
+					"AND c.`start` <= INET_ATON(u.ip) "
+				"SET u.geocode = c.countrycode, u.geocountry = c.countryname "
+				"WHERE u.nick IN (" + list + ")"));
+		else if (GeoIPDB.equals_ci("city"))
+			queries.push_back(SQL::Query("UPDATE `" + prefix + "user` AS u "
+				"INNER JOIN `" + prefix + "geoip_city_blocks` AS b "
+					"ON b.`end` = (SELECT MIN(g.`end`) FROM `" + prefix + "geoip_city_blocks` AS g WHERE g.`end` >= INET_ATON(u.ip)) "
+					"AND b.`start` <= INET_ATON(u.ip) "
+				"INNER JOIN `" + prefix + "geoip_city_location` AS l ON l.locId = b.locId "
+				"LEFT JOIN `" + prefix + "geoip_city_region` AS r ON r.country = l.country AND r.region = l.region "
+				"SET u.geocode = l.country, u.geocity = l.city, u.locID = l.locId, u.georegion = IFNULL(r.regionname, '') "
+				"WHERE u.nick IN (" + list + ")"));
+
+		for (unsigned j = 0; j < queries.size(); ++j)
+		{
+			for (size_t i = start; i < end; ++i)
+				queries[j].SetValue("nick" + stringify(i), connected[i]->nick);
+			this->RunQuery(queries[j]);
+		}
+	}
+
+	for (size_t start = 0; start < away.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, away.size());
+
+		query = "UPDATE `" + prefix + "user` SET away = " + Case("nick", "nick", "away", start, end) + ", "
+			"awaymsg = " + Case("nick", "nick", "awaymsg", start, end) + " WHERE nick IN (" + Parameters("nick", start, end) + ")";
+		for (size_t i = start; i < end; ++i)
+		{
+			const Anope::string &msg = journal.users[away[i]].awaymsg;
+			query.SetValue("nick" + stringify(i), away[i]->nick);
+			query.SetValue("away" + stringify(i), !msg.empty() ? "Y" : "N");
+			query.SetValue("awaymsg" + stringify(i), msg);
+		}
+		this->RunQuery(query);
+	}
+
+	for (size_t start = 0; start < versions.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, versions.size());
+
+		query = "UPDATE `" + prefix + "user` SET version = " + Case("nick", "nick", "version", start, end) + " WHERE nick IN (" + Parameters("nick", start, end) + ")";
+		for (size_t i = start; i < end; ++i)
+		{
+			query.SetValue("nick" + stringify(i), versions[i]->nick);
+			query.SetValue("version" + stringify(i), journal.users[versions[i]].version);
+		}
+		this->RunQuery(query);
+	}
+
+	/* User counts of servers, and their records */
+	std::vector<Anope::string> grown;
+	for (std::map<Anope::string, int>::const_iterator it = server_delta.begin(), it_end = server_delta.end(); it != it_end; ++it)
+	{
+		if (!it->second)
+			continue;
+
+		query = "UPDATE `" + prefix + "server` SET currentusers = currentusers + @delta@ WHERE name = @name@";
+		query.SetValue("delta", it->second);
+		query.SetValue("name", it->first);
+		this->RunQuery(query);
+
+		if (it->second > 0)
+			grown.push_back(it->first);
+	}
+	if (!grown.empty())
+	{
+		query = "INSERT INTO `" + prefix + "maxusers` (name, maxusers, maxtime, lastused) "
+			"SELECT name, currentusers, now(), now() FROM `" + prefix + "server` WHERE name IN (" + Parameters("name", 0, grown.size()) + ") "
+			"ON DUPLICATE KEY UPDATE maxtime=IF(VALUES(maxusers) > maxusers, VALUES(maxtime), maxtime), "
+				"maxusers=GREATEST(maxusers, VALUES(maxusers)), lastused=VALUES(lastused)";
+		for (size_t i = 0; i < grown.size(); ++i)
+			query.SetValue("name" + stringify(i), grown[i]);
+		this->RunQuery(query);
+	}
+
+	/* The current state of every changed channel, which also inserts new channels */
+	std::vector<Channel *> chans;
+	for (std::map<Channel *, bool>::const_iterator it = journal.chans.begin(), it_end = journal.chans.end(); it != it_end; ++it)
+		chans.push_back(it->first);
+	for (size_t start = 0; start < chans.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, chans.size());
+
+		query = "INSERT INTO `" + prefix + "chan` (channel, topic, topicauthor, topictime, modes) VALUES ";
+		for (size_t i = start; i < end; ++i)
+		{
+			const Anope::string n = "#" + stringify(i) + "@";
+			query.query += Anope::string(i > start ? "," : "") + "(@channel" + n + ",@topic" + n + ",@topicauthor" + n + ",FROM_UNIXTIME(NULLIF(@topictime" + n + ", 0)),@modes" + n + ")";
+		}
+		query.query += " ON DUPLICATE KEY UPDATE channel=VALUES(channel), topic=VALUES(topic),"
+			"topicauthor=VALUES(topicauthor), topictime=VALUES(topictime), modes=VALUES(modes)";
+
+		for (size_t i = start; i < end; ++i)
+		{
+			Channel *c = chans[i];
+			const Anope::string n = "#" + stringify(i);
+
+			query.SetValue("channel" + n, c->name);
+			query.SetValue("topic" + n, c->topic);
+			query.SetValue("topicauthor" + n, c->topic_setter);
+			query.SetValue("topictime" + n, c->topic_ts > 0 ? c->topic_ts : 0);
+			query.SetValue("modes" + n, c->GetModes(true, true));
+		}
+		this->RunQuery(query);
+	}
+
+	/* The current status of every changed membership, which also inserts new ones */
+	std::vector<ChanUserContainer *> members;
+	std::set<Anope::string> joined;
+	for (std::map<std::pair<User *, Channel *>, bool>::const_iterator it = journal.members.begin(), it_end = journal.members.end(); it != it_end; ++it)
+	{
+		ChanUserContainer *cu = it->first.first->FindChannel(it->first.second);
+		if (!cu)
+			continue;
+
+		members.push_back(cu);
+		if (it->second)
+			joined.insert(cu->chan->name);
+	}
+	for (size_t start = 0; start < members.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, members.size());
+
+		Anope::string rows;
+		for (size_t i = start; i < end; ++i)
+		{
+			const Anope::string n = stringify(i) + "@";
+			rows += (i > start ? " UNION ALL SELECT @nick" : "SELECT @nick") + n + " AS nick, @channel" + n + " AS channel, @modes" + n + " AS modes";
+		}
+
+		query = "INSERT INTO `" + prefix + "ison` (nickid, chanid, modes) "
+			"SELECT u.nickid, c.chanid, m.modes FROM (" + rows + ") AS m "
+			"INNER JOIN `" + prefix + "user` AS u ON u.nick = m.nick "
+			"INNER JOIN `" + prefix + "chan` AS c ON c.channel = m.channel "
+			"ON DUPLICATE KEY UPDATE `" + prefix + "ison`.modes=VALUES(modes)";
+		for (size_t i = start; i < end; ++i)
+		{
+			query.SetValue("nick" + stringify(i), members[i]->user->nick);
+			query.SetValue("channel" + stringify(i), members[i]->chan->name);
+			query.SetValue("modes" + stringify(i), members[i]->status.Modes());
+		}
+		this->RunQuery(query);
+	}
+
+	/* Records of channels which were joined */
+	std::vector<Anope::string> grown_chans(joined.begin(), joined.end());
+	for (size_t start = 0; start < grown_chans.size(); start += RowsPerQuery)
+	{
+		size_t end = std::min(start + RowsPerQuery, grown_chans.size());
+
+		query = "INSERT INTO `" + prefix + "maxusers` (name, maxusers, maxtime, lastused) "
+			"SELECT c.channel, COUNT(i.chanid), now(), now() FROM `" + prefix + "chan` AS c "
+			"INNER JOIN `" + prefix + "ison` AS i ON i.chanid = c.chanid "
+			"WHERE c.channel IN (" + Parameters("channel", start, end) + ") GROUP BY c.channel "
+			"ON DUPLICATE KEY UPDATE maxtime=IF(VALUES(maxusers) > maxusers, VALUES(maxtime), maxtime), "
+				"maxusers=GREATEST(maxusers, VALUES(maxusers)), lastused=VALUES(lastused)";
+		for (size_t i = start; i < end; ++i)
+			query.SetValue("channel" + stringify(i), grown_chans[i]);
+		this->RunQuery(query);
+	}
+
+	Log(LOG_DEBUG_2) << "m_irc2sql: Flushed " << journal.Size() << " change(s)";
+	journal.Clear();
+}
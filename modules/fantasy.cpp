@@ -85,13 +85,19 @@ class Fantasy : public Module
 	SerializableExtensibleItem<bool> fantasy;
 
 	CommandBSSetFantasy commandbssetfantasy;
+	Configuration::Setting<Anope::string> fantasycharacter;
 
  public:
 	Fantasy(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
-		fantasy(this, "BS_FANTASY"), commandbssetfantasy(this)
+		fantasy(this, "BS_FANTASY"), commandbssetfantasy(this), fantasycharacter("fantasycharacter", "!")
 	{
 	}
 
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		fantasycharacter.Load(conf->GetModule(this));
+	}
+
 	void OnPrivmsg(User *u, Channel *c, Anope::string &msg) anope_override
 	{
 		if (!u || !c || !c->ci || !c->ci->bi || msg.empty() || msg[0] == '\1')
@@ -107,7 +113,7 @@ class Fantasy : public Module
 			return;
 
 		Anope::string normalized_param0 = Anope::NormalizeBuffer(params[0]);
-		Anope::string fantasy_chars = Config->GetModule(this)->Get<Anope::string>("fantasycharacter", "!");
+		const Anope::string &fantasy_chars = fantasycharacter;
 
 		if (!normalized_param0.find(c->ci->bi->nick))
 		{
@@ -141,7 +141,7 @@ class Packet : public Query
 		record.ttl = (input[pos] << 24) | (input[pos + 1] << 16) | (input[pos + 2] << 8) | input[pos + 3];
 		pos += 4;
 
-		//record.rdlength = input[pos] << 8 | input[pos + 1];
+		unsigned short rdlength = input[pos] << 8 | input[pos + 1];
 		pos += 2;
 
 		switch (record.type)
@@ -191,7 +191,28 @@ class Packet : public Query
 
 				break;
 			}
+			case QUERY_SOA:
+			{
+				record.rdata = this->UnpackName(input, input_size, pos); // primary nameserver
+				this->UnpackName(input, input_size, pos); // responsible mailbox
+
+				if (pos + 20 > input_size)
+					throw SocketException("Unable to unpack resource record");
+
+				/* Skip serial, refresh, retry and expire. Negative answers may be cached for
+				 * the lower of the SOA's TTL and minimum field (RFC 2308), so just keep that.
+				 */
+				unsigned int minimum = (input[pos + 16] << 24) | (input[pos + 17] << 16) | (input[pos + 18] << 8) | input[pos + 19];
+				pos += 20;
+
+				record.ttl = std::min(record.ttl, minimum);
+				break;
+			}
 			default:
+				if (pos + rdlength > input_size)
+					throw SocketException("Unable to unpack resource record");
+
+				pos += rdlength;
 				break;
 		}
 
@@ -649,8 +670,26 @@ class MyManager : public Manager, public Timer
 {
 	uint32_t serial;
 
-	typedef TR1NS::unordered_map<Question, Query, Question::hash> cache_map;
+	struct CacheEntry
+	{
+		Query query;
+		time_t expires;
+		size_t bytes;
+		std::list<Question>::iterator lru;
+	};
+
+	typedef TR1NS::unordered_map<Question, CacheEntry, Question::hash> cache_map;
 	cache_map cache;
+	/* Questions in the cache, most recently used first */
+	std::list<Question> lru;
+	size_t cache_bytes;
+
+	/* Requests waiting on the answer to an identical request that is already
+	 * outstanding, keyed by the id of the outstanding request
+	 */
+	std::map<unsigned short, std::vector<Request *> > waiting;
+	/* Outstanding questions and the id of the request that was sent for them */
+	TR1NS::unordered_map<Question, unsigned short, Question::hash> outstanding;
 
 	TCPSocket *tcpsock;
 	UDPSocket *udpsock;
@@ -662,8 +701,13 @@ class MyManager : public Manager, public Timer
  public:
 	std::map<unsigned short, Request *> requests;
 
-	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), tcpsock(NULL), udpsock(NULL),
-		listen(false), cur_id(rand())
+	/* Maximum memory used by the cache, in bytes */
+	size_t max_cache_bytes;
+	/* Counters for the cache and request coalescing */
+	unsigned long cache_hits, cache_negative_hits, cache_misses, cache_evictions, coalesced;
+
+	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), cache_bytes(0), tcpsock(NULL), udpsock(NULL),
+		listen(false), max_cache_bytes(0), cache_hits(0), cache_negative_hits(0), cache_misses(0), cache_evictions(0), coalesced(0), cur_id(rand())
 	{
 	}
 
@@ -672,20 +716,39 @@ class MyManager : public Manager, public Timer
 		delete udpsock;
 		delete tcpsock;
 
-		for (std::map<unsigned short, Request *>::iterator it = this->requests.begin(), it_end = this->requests.end(); it != it_end;)
+		this->CancelRequests(NULL, ERROR_UNKNOWN);
+
+		this->cache.clear();
+		this->lru.clear();
+	}
+
+	/** Fail and delete pending requests
+	 * @param m The module whose requests to cancel, or NULL for all requests
+	 * @param error The error to give them
+	 */
+	void CancelRequests(Module *m, Error error)
+	{
+		std::vector<Request *> cancel;
+
+		for (std::map<unsigned short, Request *>::iterator it = this->requests.begin(), it_end = this->requests.end(); it != it_end; ++it)
+			if (!m || it->second->creator == m)
+				cancel.push_back(it->second);
+
+		for (std::map<unsigned short, std::vector<Request *> >::iterator it = this->waiting.begin(), it_end = this->waiting.end(); it != it_end; ++it)
+			for (unsigned i = 0; i < it->second.size(); ++i)
+				if (!m || it->second[i]->creator == m)
+					cancel.push_back(it->second[i]);
+
+		for (unsigned i = 0; i < cancel.size(); ++i)
 		{
-			Request *request = it->second;
-			++it;
+			Request *request = cancel[i];
 
 			Query rr(*request);
-			rr.error = ERROR_UNKNOWN;
+			rr.error = error;
 			request->OnError(&rr);
 
 			delete request;
 		}
-		this->requests.clear();
-
-		this->cache.clear();
 	}
 
 	void SetIPPort(const Anope::string &nameserver, const Anope::string &ip, unsigned short port, std::vector<std::pair<Anope::string, short> > n)
@@ -747,10 +810,22 @@ class MyManager : public Manager, public Timer
 		if (!this->udpsock)
 			throw SocketException("No dns socket");
 
+		req->SetSecs(timeout);
+
+		/* If the same question has already been asked, wait for that answer instead of asking again */
+		TR1NS::unordered_map<Question, unsigned short, Question::hash>::iterator it = this->outstanding.find(*req);
+		if (it != this->outstanding.end())
+		{
+			Log(LOG_DEBUG_2) << "Resolver: Waiting on outstanding request " << it->second << " for " << req->name;
+			req->id = it->second;
+			this->waiting[req->id].push_back(req);
+			++coalesced;
+			return;
+		}
+
 		req->id = GetID();
 		this->requests[req->id] = req;
-
-		req->SetSecs(timeout);
+		this->outstanding[*req] = req->id;
 
 		Packet *p = new Packet(this, &this->addrs);
 		p->flags = QUERYFLAGS_RD;
@@ -762,7 +837,33 @@ class MyManager : public Manager, public Timer
 
 	void RemoveRequest(Request *req) anope_override
 	{
-		this->requests.erase(req->id);
+		std::map<unsigned short, Request *>::iterator it = this->requests.find(req->id);
+		std::map<unsigned short, std::vector<Request *> >::iterator wit = this->waiting.find(req->id);
+
+		if (it != this->requests.end() && it->second == req)
+		{
+			/* Let a request waiting on this one take its place, as the answer will still come */
+			if (wit != this->waiting.end())
+			{
+				it->second = wit->second.front();
+				wit->second.erase(wit->second.begin());
+				if (wit->second.empty())
+					this->waiting.erase(wit);
+			}
+			else
+			{
+				this->requests.erase(it);
+				this->outstanding.erase(*req);
+			}
+		}
+		else if (wit != this->waiting.end())
+		{
+			std::vector<Request *>::iterator it2 = std::find(wit->second.begin(), wit->second.end(), req);
+			if (it2 != wit->second.end())
+				wit->second.erase(it2);
+			if (wit->second.empty())
+				this->waiting.erase(wit);
+		}
 	}
 
 	bool HandlePacket(ReplySocket *s, const unsigned char *const packet_buffer, int length, sockaddrs *from) anope_override
@@ -862,13 +963,28 @@ class MyManager : public Manager, public Timer
 			Log(LOG_DEBUG_2) << "Resolver: Received an answer for something we didn't request";
 			return true;
 		}
-		Request *request = it->second;
+
+		/* Take the request, and everything waiting on it, out of the queue before
+		 * calling into them so they can safely make new requests
+		 */
+		std::vector<Request *> answered;
+		answered.push_back(it->second);
+
+		std::map<unsigned short, std::vector<Request *> >::iterator wit = this->waiting.find(recv_packet.id);
+		if (wit != this->waiting.end())
+		{
+			answered.insert(answered.end(), wit->second.begin(), wit->second.end());
+			this->waiting.erase(wit);
+		}
+
+		const Question question = *it->second;
+		this->requests.erase(it);
+		this->outstanding.erase(question);
 
 		if (recv_packet.flags & QUERYFLAGS_OPCODE)
 		{
 			Log(LOG_DEBUG_2) << "Resolver: Received a nonstandard query";
 			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.flags & QUERYFLAGS_RCODE)
 		{
@@ -901,22 +1017,30 @@ class MyManager : public Manager, public Timer
 			}
 
 			recv_packet.error = error;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.questions.empty() || recv_packet.answers.empty())
 		{
 			Log(LOG_DEBUG_2) << "Resolver: No resource records returned";
 			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
 		}
 		else
+			Log(LOG_DEBUG_2) << "Resolver: Lookup complete for " << question.name;
+
+		if (recv_packet.error == ERROR_NONE || recv_packet.error == ERROR_DOMAIN_NOT_FOUND || recv_packet.error == ERROR_NO_RECORDS)
+			this->AddCache(question, recv_packet);
+
+		for (unsigned i = 0; i < answered.size(); ++i)
 		{
-			Log(LOG_DEBUG_2) << "Resolver: Lookup complete for " << request->name;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
+			Request *request = answered[i];
+
+			if (recv_packet.error == ERROR_NONE)
+				request->OnLookupComplete(&recv_packet);
+			else
+				request->OnError(&recv_packet);
+
+			delete request;
 		}
 
-		delete request;
 		return true;
 	}
 
@@ -967,25 +1091,87 @@ class MyManager : public Manager, public Timer
 
 		for (cache_map::iterator it = this->cache.begin(), it_next; it != this->cache.end(); it = it_next)
 		{
-			const Query &q = it->second;
-			const ResourceRecord &req = q.answers[0];
 			it_next = it;
 			++it_next;
 
-			if (req.created + static_cast<time_t>(req.ttl) < now)
-				this->cache.erase(it);
+			if (it->second.expires <= now)
+				this->RemoveCache(it);
 		}
+
+		Log(LOG_DEBUG) << "Resolver: " << this->cache.size() << " cached answers using " << cache_bytes << " bytes, " << cache_hits << " hits (" << cache_negative_hits << " negative), "
+			<< cache_misses << " misses, " << cache_evictions << " evictions, " << coalesced << " coalesced requests";
 	}
 
  private:
-	/** Add a record to the dns cache
-	 * @param r The record
+	static size_t RecordBytes(const std::vector<ResourceRecord> &records)
+	{
+		size_t bytes = 0;
+		for (unsigned i = 0; i < records.size(); ++i)
+			bytes += sizeof(ResourceRecord) + records[i].name.length() + records[i].rdata.length();
+		return bytes;
+	}
+
+	void RemoveCache(cache_map::iterator it)
+	{
+		this->cache_bytes -= it->second.bytes;
+		this->lru.erase(it->second.lru);
+		this->cache.erase(it);
+	}
+
+	/** Add an answer to the dns cache. Failed lookups are cached too if the
+	 * nameserver said for how long (RFC 2308).
+	 * @param q The question that was asked
+	 * @param r The answer
 	 */
-	void AddCache(Query &r)
+	void AddCache(const Question &q, const Query &r)
 	{
-		const ResourceRecord &rr = r.answers[0];
-		Log(LOG_DEBUG_3) << "Resolver cache: added cache for " << rr.name << " -> " << rr.rdata << ", ttl: " << rr.ttl;
-		this->cache[r.questions[0]] = r;
+		unsigned int ttl;
+
+		if (r.error == ERROR_NONE)
+		{
+			ttl = r.answers[0].ttl;
+			for (unsigned i = 1; i < r.answers.size(); ++i)
+				ttl = std::min(ttl, r.answers[i].ttl);
+		}
+		else
+		{
+			/* The SOA from the authority section gives the negative TTL, without one the answer can not be cached */
+			const ResourceRecord *soa = NULL;
+			for (unsigned i = 0; i < r.authorities.size() && !soa; ++i)
+				if (r.authorities[i].type == QUERY_SOA)
+					soa = &r.authorities[i];
+			if (!soa)
+				return;
+
+			/* RFC 2308 recommends not caching negative answers for more than a few hours */
+			ttl = std::min(soa->ttl, 10800U);
+		}
+
+		if (!ttl || !max_cache_bytes)
+			return;
+
+		cache_map::iterator it = this->cache.find(q);
+		if (it != this->cache.end())
+			this->RemoveCache(it);
+
+		CacheEntry &entry = this->cache[q];
+		entry.query = r;
+		/* Only what is needed to answer lookups is kept */
+		entry.query.authorities.clear();
+		entry.query.additional.clear();
+		entry.expires = Anope::CurTime + ttl;
+		entry.bytes = sizeof(CacheEntry) + 2 * (sizeof(Question) + q.name.length()) + RecordBytes(entry.query.answers);
+		entry.lru = this->lru.insert(this->lru.begin(), q);
+
+		this->cache_bytes += entry.bytes;
+
+		Log(LOG_DEBUG_3) << "Resolver cache: added " << (r.error == ERROR_NONE ? "" : "negative ") << "cache for " << q.name << ", ttl: " << ttl;
+
+		while (this->cache_bytes > this->max_cache_bytes && !this->lru.empty())
+		{
+			++cache_evictions;
+			this->RemoveCache(this->cache.find(this->lru.back()));
+		}
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -994,17 +1180,34 @@ class MyManager : public Manager, public Timer
 	bool CheckCache(Request *request)
 	{
 		cache_map::iterator it = this->cache.find(*request);
-		if (it != this->cache.end())
+		if (it == this->cache.end() || it->second.expires <= Anope::CurTime)
 		{
-			Query &record = it->second;
-			Log(LOG_DEBUG_3) << "Resolver: Using cached result for " << request->name;
+			if (it != this->cache.end())
+				this->RemoveCache(it);
+
+			++cache_misses;
+			return false;
+		}
+
+		CacheEntry &entry = it->second;
+		this->lru.splice(this->lru.begin(), this->lru, entry.lru);
+
+		/* The request may make new lookups, which could evict this entry */
+		Query record = entry.query;
+
+		Log(LOG_DEBUG_3) << "Resolver: Using cached result for " << request->name;
+		++cache_hits;
+
+		if (record.error == ERROR_NONE)
 			request->OnLookupComplete(&record);
-			return true;
+		else
+		{
+			++cache_negative_hits;
+			request->OnError(&record);
 		}
 
-		return false;
+		return true;
 	}
-
 };
 
 class ModuleDNS : public Module
@@ -1046,6 +1249,7 @@ class ModuleDNS : public Module
 		admin = block->Get<const Anope::string>("admin", "admin@example.com");
 		nameservers = block->Get<const Anope::string>("nameservers", "ns1.example.com");
 		refresh = block->Get<int>("refresh", "3600");
+		this->manager.max_cache_bytes = block->Get<unsigned>("cachesize", "4194304");
 
 		for (int i = 0; i < block->CountBlock("notify"); ++i)
 		{
@@ -1103,22 +1307,7 @@ class ModuleDNS : public Module
 
 	void OnModuleUnload(User *u, Module *m) anope_override
 	{
-		for (std::map<unsigned short, Request *>::iterator it = this->manager.requests.begin(), it_end = this->manager.requests.end(); it != it_end;)
-		{
-			unsigned short id = it->first;
-			Request *req = it->second;
-			++it;
-
-			if (req->creator == m)
-			{
-				Query rr(*req);
-				rr.error = ERROR_UNLOADED;
-				req->OnError(&rr);
-
-				delete req;
-				this->manager.requests.erase(id);
-			}
-		}
+		this->manager.CancelRequests(m, ERROR_UNLOADED);
 	}
 };
 
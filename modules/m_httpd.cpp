@@ -26,6 +26,8 @@ static Anope::string GetStatusFromCode(HTTPError err)
 			return "200 OK";
 		case HTTP_FOUND:
 			return "302 Found";
+		case HTTP_NOT_MODIFIED:
+			return "304 Not Modified";
 		case HTTP_BAD_REQUEST:
 			return "400 Bad Request";
 		case HTTP_PAGE_NOT_FOUND:
@@ -16,10 +16,120 @@ struct ProxyCheck
 	Anope::string reason;
 };
 
+/* A scan of one IP, which is over once all of its connections are */
+struct IPScan
+{
+	/* Connections queued or open */
+	unsigned connections;
+	/* Set once an open proxy is found, with the ban placed for it */
+	bool found;
+	Anope::string reason;
+	time_t duration;
+
+	IPScan() : connections(0), found(false), duration(0) { }
+};
+
+/* The result of a recent scan of an IP */
+struct CachedScan
+{
+	time_t expires;
+	bool found;
+	Anope::string reason;
+	time_t duration;
+};
+
+/* A connection waiting for a free slot */
+struct PendingConnection
+{
+	Anope::string ip;
+	bool ipv6;
+	ProxyCheck *check;
+	Anope::string type;
+	unsigned short port;
+
+	PendingConnection(const Anope::string &i, bool v6, ProxyCheck *c, const Anope::string &t, unsigned short p) : ip(i), ipv6(v6), check(c), type(t), port(p) { }
+};
+
+static struct
+{
+	/* IPs scanned, and connections made to them */
+	unsigned long long scans, connections;
+	/* Scans skipped as the IP was recently found clean or open, or was already being scanned */
+	unsigned long long cached_clean, cached_found, in_progress;
+} stats;
+
 static Anope::string ProxyCheckString;
 static Anope::string target_ip;
 static unsigned short target_port;
 static bool add_to_akill;
+static unsigned max_connections;
+static time_t clean_cache_time, found_cache_time;
+
+static std::map<Anope::string, IPScan> scans;
+static Anope::hash_map<CachedScan> cache;
+static std::deque<PendingConnection> pending;
+
+static ServiceReference<XLineManager> akills("XLineManager", "xlinemanager/sgline");
+
+static void BanIP(const Anope::string &ip, const Anope::string &reason, time_t duration)
+{
+	BotInfo *OperServ = Config->GetClient("OperServ");
+	XLine *x = new XLine("*@" + ip, OperServ ? OperServ->nick : "", Anope::CurTime + duration, reason, XLineManager::GenerateUID());
+	if (add_to_akill && akills)
+	{
+		akills->AddXLine(x);
+		akills->Send(NULL, x);
+	}
+	else
+	{
+		if (IRCD->CanSZLine)
+			IRCD->SendSZLine(NULL, x);
+		else
+			IRCD->SendAkill(NULL, x);
+		delete x;
+	}
+}
+
+static void StartConnections();
+
+/** Called when a connection to an IP is closed or could not be made. Once
+ * the last one for the IP is, the result of its scan is cached.
+ */
+static void ConnectionDone(const Anope::string &ip)
+{
+	std::map<Anope::string, IPScan>::iterator it = scans.find(ip);
+	if (it != scans.end() && !--it->second.connections)
+	{
+		const IPScan &scan = it->second;
+		time_t ttl = scan.found ? found_cache_time : clean_cache_time;
+		if (ttl > 0)
+		{
+			CachedScan &c = cache[ip];
+			c.expires = Anope::CurTime + ttl;
+			c.found = scan.found;
+			c.reason = scan.reason;
+			c.duration = scan.duration;
+		}
+		scans.erase(it);
+	}
+
+	StartConnections();
+}
+
+/** Drop every queued connection, as their checks are going away */
+static void ClearPending()
+{
+	std::deque<PendingConnection> p;
+	p.swap(pending);
+
+	for (unsigned i = 0; i < p.size(); ++i)
+	{
+		/* Incomplete scans are not cached */
+		std::map<Anope::string, IPScan>::iterator it = scans.find(p[i].ip);
+		if (it != scans.end() && !--it->second.connections)
+			scans.erase(it);
+	}
+}
 
 class ProxyCallbackListener : public ListenSocket
 {
@@ -54,24 +164,26 @@ class ProxyCallbackListener : public ListenSocket
 
 class ProxyConnect : public ConnectionSocket
 {
-	static ServiceReference<XLineManager> akills;
-
  public:
 	static std::set<ProxyConnect *> proxies;
 
 	ProxyCheck proxy;
 	unsigned short port;
 	time_t created;
+	/* The IP being scanned */
+	Anope::string ip;
 
-	ProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ConnectionSocket(), proxy(p),
-		port(po), created(Anope::CurTime)
+	ProxyConnect(ProxyCheck &p, unsigned short po, const Anope::string &i) : Socket(-1), ConnectionSocket(), proxy(p),
+		port(po), created(Anope::CurTime), ip(i)
 	{
 		proxies.insert(this);
+		++stats.connections;
 	}
 
 	~ProxyConnect()
 	{
 		proxies.erase(this);
+		ConnectionDone(this->ip);
 	}
 
 	virtual void OnConnect() anope_override = 0;
@@ -88,35 +200,33 @@ class ProxyConnect : public ConnectionSocket
 
 		BotInfo *OperServ = Config->GetClient("OperServ");
 		Log(OperServ) << "PROXYSCAN: Open " << this->GetType() << " proxy found on " << this->conaddr.addr() << ":" << this->conaddr.port() << " (" << reason << ")";
-		XLine *x = new XLine("*@" + this->conaddr.addr(), OperServ ? OperServ->nick : "", Anope::CurTime + this->proxy.duration, reason, XLineManager::GenerateUID());
-		if (add_to_akill && akills)
+
+		std::map<Anope::string, IPScan>::iterator it = scans.find(this->ip);
+		if (it != scans.end())
 		{
-			akills->AddXLine(x);
-			akills->Send(NULL, x);
-		}
-		else
-		{
-			if (IRCD->CanSZLine)
-				IRCD->SendSZLine(NULL, x);
-			else
-				IRCD->SendAkill(NULL, x);
-			delete x;
+			it->second.found = true;
+			it->second.reason = reason;
+			it->second.duration = this->proxy.duration;
 		}
+
+		BanIP(this->ip, reason, this->proxy.duration);
 	}
 };
-ServiceReference<XLineManager> ProxyConnect::akills("XLineManager", "xlinemanager/sgline");
 std::set<ProxyConnect *> ProxyConnect::proxies;
 
 class HTTPProxyConnect : public ProxyConnect, public BufferedSocket
 {
  public:
-	HTTPProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ProxyConnect(p, po), BufferedSocket()
+	HTTPProxyConnect(ProxyCheck &p, unsigned short po, const Anope::string &i, bool v6) : Socket(-1, v6), ProxyConnect(p, po, i), BufferedSocket()
 	{
 	}
 
 	void OnConnect() anope_override
 	{
-		this->Write("CONNECT %s:%d HTTP/1.0", target_ip.c_str(), target_port);
+		if (target_ip.find(':') != Anope::string::npos)
+			this->Write("CONNECT [%s]:%d HTTP/1.0", target_ip.c_str(), target_port);
+		else
+			this->Write("CONNECT %s:%d HTTP/1.0", target_ip.c_str(), target_port);
 		this->Write("Content-Length: 0");
 		this->Write("Connection: close");
 		this->Write("");
@@ -142,16 +252,16 @@ class HTTPProxyConnect : public ProxyConnect, public BufferedSocket
 class SOCKS5ProxyConnect : public ProxyConnect, public BinarySocket
 {
  public:
-	SOCKS5ProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ProxyConnect(p, po), BinarySocket()
+	SOCKS5ProxyConnect(ProxyCheck &p, unsigned short po, const Anope::string &i, bool v6) : Socket(-1, v6), ProxyConnect(p, po, i), BinarySocket()
 	{
 	}
 
 	void OnConnect() anope_override
 	{
 		sockaddrs target_addr;
-		char buf[4 + sizeof(target_addr.sa4.sin_addr.s_addr) + sizeof(target_addr.sa4.sin_port)];
+		char buf[4 + sizeof(target_addr.sa6.sin6_addr.s6_addr) + sizeof(target_addr.sa6.sin6_port)];
 		int ptr = 0;
-		target_addr.pton(AF_INET, target_ip, target_port);
+		target_addr.pton(target_ip.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, target_ip, target_port);
 		if (!target_addr.valid())
 			return;
 
@@ -164,11 +274,22 @@ class SOCKS5ProxyConnect : public ProxyConnect, public BinarySocket
 		ptr = 1;
 		buf[ptr++] = 1; // Connect
 		buf[ptr++] = 0; // Reserved
-		buf[ptr++] = 1; // IPv4
-		memcpy(buf + ptr, &target_addr.sa4.sin_addr.s_addr, sizeof(target_addr.sa4.sin_addr.s_addr));
-		ptr += sizeof(target_addr.sa4.sin_addr.s_addr);
-		memcpy(buf + ptr, &target_addr.sa4.sin_port, sizeof(target_addr.sa4.sin_port));
-		ptr += sizeof(target_addr.sa4.sin_port);
+		if (target_addr.ipv6())
+		{
+			buf[ptr++] = 4; // IPv6
+			memcpy(buf + ptr, &target_addr.sa6.sin6_addr.s6_addr, sizeof(target_addr.sa6.sin6_addr.s6_addr));
+			ptr += sizeof(target_addr.sa6.sin6_addr.s6_addr);
+			memcpy(buf + ptr, &target_addr.sa6.sin6_port, sizeof(target_addr.sa6.sin6_port));
+			ptr += sizeof(target_addr.sa6.sin6_port);
+		}
+		else
+		{
+			buf[ptr++] = 1; // IPv4
+			memcpy(buf + ptr, &target_addr.sa4.sin_addr.s_addr, sizeof(target_addr.sa4.sin_addr.s_addr));
+			ptr += sizeof(target_addr.sa4.sin_addr.s_addr);
+			memcpy(buf + ptr, &target_addr.sa4.sin_port, sizeof(target_addr.sa4.sin_port));
+			ptr += sizeof(target_addr.sa4.sin_port);
+		}
 
 		this->Write(buf, ptr);
 	}
@@ -189,14 +310,86 @@ class SOCKS5ProxyConnect : public ProxyConnect, public BinarySocket
 	}
 };
 
+static void StartConnections()
+{
+	while (!pending.empty() && (!max_connections || ProxyConnect::proxies.size() < max_connections))
+	{
+		PendingConnection pc = pending.front();
+		pending.pop_front();
+
+		ProxyConnect *con = NULL;
+		try
+		{
+			if (pc.type.equals_ci("HTTP"))
+				con = new HTTPProxyConnect(*pc.check, pc.port, pc.ip, pc.ipv6);
+			else
+				con = new SOCKS5ProxyConnect(*pc.check, pc.port, pc.ip, pc.ipv6);
+		}
+		catch (const SocketException &ex)
+		{
+			Log(LOG_DEBUG) << "m_proxyscan: " << ex.GetReason();
+			ConnectionDone(pc.ip);
+			continue;
+		}
+
+		con->Connect(pc.ip, pc.port);
+	}
+}
+
+class CommandOSProxyScan : public Command
+{
+ public:
+	CommandOSProxyScan(Module *creator) : Command(creator, "operserv/proxyscan", 0, 1)
+	{
+		this->SetDesc(_("Show proxy scanner statistics"));
+		this->SetSyntax("[CLEAR]");
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		if (!params.empty() && params[0].equals_ci("CLEAR"))
+		{
+			Log(LOG_ADMIN, source, this) << "to clear the scan cache";
+			cache.clear();
+			source.Reply(_("The proxy scan cache has been cleared."));
+			return;
+		}
+		else if (!params.empty())
+		{
+			this->OnSyntaxError(source, params[0]);
+			return;
+		}
+
+		source.Reply(_("Scans: %llu started, %lu in progress, %llu connections made"), stats.scans, static_cast<unsigned long>(scans.size()), stats.connections);
+		source.Reply(_("Connections: %lu open, %lu waiting for a free slot"), static_cast<unsigned long>(ProxyConnect::proxies.size()), static_cast<unsigned long>(pending.size()));
+		source.Reply(_("Scans avoided: %llu found clean recently, %llu found open recently, %llu already in progress"), stats.cached_clean, stats.cached_found, stats.in_progress);
+		source.Reply(_("Cached results: %lu"), static_cast<unsigned long>(cache.size()));
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &subcommand) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Shows how many proxy scans were made, how many are\n"
+				"in progress, and how many were avoided because the\n"
+				"IP was scanned recently or is being scanned now.\n"
+				" \n"
+				"\002CLEAR\002 forgets the results of recent scans, so every\n"
+				"IP is scanned again the next time it connects."));
+		return true;
+	}
+};
+
 class ModuleProxyScan : public Module
 {
 	Anope::string listen_ip;
 	unsigned short listen_port;
 	Anope::string con_notice, con_source;
 	std::vector<ProxyCheck> proxyscans;
+	bool ipv6;
 
 	ProxyCallbackListener *listener;
+	CommandOSProxyScan commandosproxyscan;
 
 	class ConnectionTimeout : public Timer
 	{
@@ -207,6 +400,18 @@ class ModuleProxyScan : public Module
 
 		void Tick(time_t) anope_override
 		{
+			static time_t last_purge = 0;
+			if (last_purge + 60 <= Anope::CurTime)
+			{
+				for (Anope::hash_map<CachedScan>::iterator it = cache.begin(), it_end = cache.end(); it != it_end;)
+				{
+					Anope::hash_map<CachedScan>::iterator cur = it++;
+					if (cur->second.expires <= Anope::CurTime)
+						cache.erase(cur);
+				}
+				last_purge = Anope::CurTime;
+			}
+
 			for (std::set<ProxyConnect *>::iterator it = ProxyConnect::proxies.begin(), it_end = ProxyConnect::proxies.end(); it != it_end;)
 			{
 				ProxyConnect *p = *it;
@@ -220,7 +425,7 @@ class ModuleProxyScan : public Module
 
  public:
 	ModuleProxyScan(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR),
-		connectionTimeout(this, 5)
+		ipv6(false), commandosproxyscan(this), connectionTimeout(this, 5)
 	{
 
 
@@ -229,6 +434,8 @@ class ModuleProxyScan : public Module
 
 	~ModuleProxyScan()
 	{
+		ClearPending();
+
 		for (std::set<ProxyConnect *>::iterator it = ProxyConnect::proxies.begin(), it_end = ProxyConnect::proxies.end(); it != it_end;)
 		{
 			ProxyConnect *p = *it;
@@ -277,6 +484,10 @@ class ModuleProxyScan : public Module
 		this->con_source = config->Get<const Anope::string>("connect_source");
 		add_to_akill = config->Get<bool>("add_to_akill", "true");
 		this->connectionTimeout.SetSecs(config->Get<time_t>("timeout", "5s"));
+		this->ipv6 = config->Get<bool>("ipv6");
+		max_connections = config->Get<unsigned>("max_connections", "200");
+		clean_cache_time = config->Get<time_t>("clean_cache_time", "30m");
+		found_cache_time = config->Get<time_t>("found_cache_time", "1h");
 
 		ProxyCheckString = Config->GetBlock("networkinfo")->Get<const Anope::string>("networkname") + " proxy check";
 		delete this->listener;
@@ -290,6 +501,7 @@ class ModuleProxyScan : public Module
 			throw ConfigException("m_proxyscan: " + ex.GetReason());
 		}
 
+		ClearPending();
 		this->proxyscans.clear();
 		for (int i = 0; i < config->CountBlock("proxyscan"); ++i)
 		{
@@ -334,10 +546,33 @@ class ModuleProxyScan : public Module
 		if (exempt || user->Quitting() || !Me->IsSynced() || !user->server->IsSynced())
 			return;
 
-		/* At this time we only support IPv4 */
-		if (!user->ip.valid() || user->ip.sa.sa_family != AF_INET)
-			/* User doesn't have a valid IPv4 IP (ipv6/spoof/etc) */
+		if (!user->ip.valid() || (user->ip.sa.sa_family != AF_INET && (user->ip.sa.sa_family != AF_INET6 || !this->ipv6)))
+			/* User doesn't have a valid IP we can scan (spoof/etc) */
+			return;
+
+		const Anope::string ip = user->ip.addr();
+
+		Anope::hash_map<CachedScan>::iterator cit = cache.find(ip);
+		if (cit != cache.end() && cit->second.expires > Anope::CurTime)
+		{
+			if (cit->second.found)
+			{
+				/* The ban placed for it must be gone, so place it again */
+				Log(LOG_DEBUG) << "m_proxyscan: " << ip << " was recently found to be an open proxy";
+				++stats.cached_found;
+				BanIP(ip, cit->second.reason, cit->second.duration);
+			}
+			else
+				++stats.cached_clean;
+			return;
+		}
+
+		if (scans.count(ip))
+		{
+			/* Clones are covered by the scan already in progress */
+			++stats.in_progress;
 			return;
+		}
 
 		if (!this->con_notice.empty() && !this->con_source.empty())
 		{
@@ -346,32 +581,27 @@ class ModuleProxyScan : public Module
 				user->SendMessage(bi, this->con_notice);
 		}
 
+		IPScan &scan = scans[ip];
 		for (unsigned i = this->proxyscans.size(); i > 0; --i)
 		{
 			ProxyCheck &p = this->proxyscans[i - 1];
 
 			for (std::set<Anope::string, ci::less>::iterator it = p.types.begin(), it_end = p.types.end(); it != it_end; ++it)
-			{
 				for (unsigned k = 0; k < p.ports.size(); ++k)
 				{
-					try
-					{
-						ProxyConnect *con = NULL;
-						if (it->equals_ci("HTTP"))
-							con = new HTTPProxyConnect(p, p.ports[k]);
-						else if (it->equals_ci("SOCKS5"))
-							con = new SOCKS5ProxyConnect(p, p.ports[k]);
-						else
-							continue;
-						con->Connect(user->ip.addr(), p.ports[k]);
-					}
-					catch (const SocketException &ex)
-					{
-						Log(LOG_DEBUG) << "m_proxyscan: " << ex.GetReason();
-					}
+					pending.push_back(PendingConnection(ip, user->ip.ipv6(), &p, *it, p.ports[k]));
+					++scan.connections;
 				}
-			}
 		}
+
+		if (!scan.connections)
+		{
+			scans.erase(ip);
+			return;
+		}
+
+		++stats.scans;
+		StartConnections();
 	}
 };
 
@@ -15,19 +15,36 @@ class MyRedisService;
 
 class RedisSocket : public BinarySocket, public ConnectionSocket
 {
-	size_t ParseReply(Reply &r, const char *buf, size_t l);
+	/* Data received but not yet made into replies */
+	std::vector<char> recv_buffer;
+	/* How far into the unconsumed data the reply currently being received has been scanned,
+	 * and the number of elements still expected by each aggregate it is nested in
+	 */
+	size_t scan_pos;
+	std::vector<long> scan_stack;
+
+	/* Commands waiting to be sent, written out together once the socket is writable */
+	std::vector<char> send_buffer;
+
+	int Scan(const char *buf, size_t l);
+	const char *BuildReply(Reply &r, const char *p);
+	void Dispatch(Reply &r);
  public:
 	MyRedisService *provider;
 	std::deque<Interface *> interfaces;
 	std::map<Anope::string, Interface *> subinterfaces;
 
-	RedisSocket(MyRedisService *pro, bool v6) : Socket(-1, v6), provider(pro) { }
+	RedisSocket(MyRedisService *pro, bool v6) : Socket(-1, v6), scan_pos(0), provider(pro) { }
 
 	~RedisSocket();
 
 	void OnConnect() anope_override;
 	void OnError(const Anope::string &error) anope_override;
 
+	void WriteCommand(const std::vector<std::pair<const char *, size_t> > &args);
+	void Write(const char *buffer, size_t l) anope_override;
+	bool ProcessWrite() anope_override;
+
 	bool Read(const char *buffer, size_t l) anope_override;
 };
 
@@ -113,40 +130,12 @@ class MyRedisService : public Provider
 	}
 
  private:
-	inline void Pack(std::vector<char> &buffer, const char *buf, size_t sz = 0)
-	{
-		if (!sz)
-			sz = strlen(buf);
-
-		size_t old_size = buffer.size();
-		buffer.resize(old_size + sz);
-		std::copy(buf, buf + sz, buffer.begin() + old_size);
-	}
-
 	void Send(RedisSocket *s, Interface *i, const std::vector<std::pair<const char *, size_t> > &args)
 	{
-		std::vector<char> buffer;
-
-		Pack(buffer, "*");
-		Pack(buffer, stringify(args.size()).c_str());
-		Pack(buffer, "\r\n");
-
-		for (unsigned j = 0; j < args.size(); ++j)
-		{
-			const std::pair<const char *, size_t> &pair = args[j];
-
-			Pack(buffer, "$");
-			Pack(buffer, stringify(pair.second).c_str());
-			Pack(buffer, "\r\n");
-
-			Pack(buffer, pair.first, pair.second);
-			Pack(buffer, "\r\n");
-		}
-
-		if (buffer.empty())
+		if (args.empty())
 			return;
 
-		s->Write(&buffer[0], buffer.size());
+		s->WriteCommand(args);
 		if (in_transaction)
 		{
 			ti.interfaces.push_back(i);
@@ -206,9 +195,9 @@ class MyRedisService : public Provider
  public:
 	bool BlockAndProcess() anope_override
 	{
+		this->sock->SetBlocking(true);
 		if (!this->sock->ProcessWrite())
 			this->sock->flags[SF_DEAD] = true;
-		this->sock->SetBlocking(true);
 		if (!this->sock->ProcessRead())
 			this->sock->flags[SF_DEAD] = true;
 		this->sock->SetBlocking(false);
@@ -296,230 +285,295 @@ void RedisSocket::OnError(const Anope::string &error)
 	Log() << "redis: Error on " << provider->name << (this == this->provider->sub ? " (sub)" : "") << ": " << error;
 }
 
-size_t RedisSocket::ParseReply(Reply &r, const char *buffer, size_t l)
+void RedisSocket::WriteCommand(const std::vector<std::pair<const char *, size_t> > &args)
 {
-	size_t used = 0;
+	char num[32];
+	int n = snprintf(num, sizeof(num), "*%lu\r\n", static_cast<unsigned long>(args.size()));
+	send_buffer.insert(send_buffer.end(), num, num + n);
+
+	for (unsigned j = 0; j < args.size(); ++j)
+	{
+		const std::pair<const char *, size_t> &pair = args[j];
 
-	if (!l)
-		return used;
+		n = snprintf(num, sizeof(num), "$%lu\r\n", static_cast<unsigned long>(pair.second));
+		send_buffer.insert(send_buffer.end(), num, num + n);
+		send_buffer.insert(send_buffer.end(), pair.first, pair.first + pair.second);
+		send_buffer.push_back('\r');
+		send_buffer.push_back('\n');
+	}
 
-	if (r.type == Reply::MULTI_BULK)
-		goto multi_bulk_cont;
+	SocketEngine::Change(this, true, SF_WRITABLE);
+}
 
-	switch (*buffer)
+void RedisSocket::Write(const char *buffer, size_t l)
+{
+	if (l == 0)
+		return;
+
+	send_buffer.insert(send_buffer.end(), buffer, buffer + l);
+	SocketEngine::Change(this, true, SF_WRITABLE);
+}
+
+bool RedisSocket::ProcessWrite()
+{
+	/* Everything queued since the last write goes out in one send */
+	if (!send_buffer.empty())
 	{
-		case '+':
+		int len = this->io->Send(this, &send_buffer[0], send_buffer.size());
+		if (len <= -1)
+			return false;
+
+		send_buffer.erase(send_buffer.begin(), send_buffer.begin() + len);
+	}
+
+	if (send_buffer.empty())
+		SocketEngine::Change(this, false, SF_WRITABLE);
+
+	return true;
+}
+
+/* Reads the number following a type byte, up to the \r\n that must follow it */
+static int64_t ParseNumber(const char *p)
+{
+	bool negative = *++p == '-';
+	if (negative || *p == '+')
+		++p;
+
+	int64_t n = 0;
+	for (; *p >= '0' && *p <= '9'; ++p)
+		n = n * 10 + (*p - '0');
+	return negative ? -n : n;
+}
+
+static long ParseLength(const char *p)
+{
+	return static_cast<long>(ParseNumber(p));
+}
+
+/* Checks whether a complete reply is in buf without copying anything out of it.
+ * The scan can be resumed when more data arrives, so a large reply received over
+ * many reads is only looked at once.
+ * Returns 1 if a reply ending at scan_pos is complete, 0 if more data is needed,
+ * and -1 if the data is not valid RESP.
+ */
+int RedisSocket::Scan(const char *buf, size_t l)
+{
+	while (scan_pos < l)
+	{
+		const char *p = buf + scan_pos;
+		const char *nl = static_cast<const char *>(memchr(p, '\n', l - scan_pos));
+		if (nl == NULL)
+			return 0;
+
+		size_t next = nl + 1 - buf;
+		long elements = 0;
+
+		switch (*p)
 		{
-			Anope::string reason(buffer, 1, l - 1);
-			size_t nl = reason.find("\r\n");
-			Log(LOG_DEBUG_2) << "redis: status ok: " << reason.substr(0, nl);
-			if (nl != Anope::string::npos)
+			case '+':
+			case '-':
+			case ':':
+			case '_': // RESP3 null
+			case ',': // RESP3 double
+			case '#': // RESP3 boolean
+			case '(': // RESP3 big number
+				break;
+			case '$':
+			case '!': // RESP3 blob error
+			case '=': // RESP3 verbatim string
 			{
-				r.type = Reply::OK;
-				used = 1 + nl + 2;
+				long len = ParseLength(p);
+				if (len >= 0)
+				{
+					if (next + len + 2 > l)
+						return 0;
+					next += len + 2;
+				}
+				break;
 			}
-			break;
+			case '*':
+			case '~': // RESP3 set
+			case '>': // RESP3 push
+				elements = ParseLength(p);
+				break;
+			case '%': // RESP3 map
+				elements = ParseLength(p) * 2;
+				break;
+			case '|': // RESP3 attributes, followed by the value they apply to
+				elements = ParseLength(p) * 2 + 1;
+				break;
+			default:
+				Log(LOG_DEBUG) << "redis: unknown reply " << *p;
+				return -1;
 		}
-		case '-':
+
+		scan_pos = next;
+
+		if (elements > 0)
 		{
-			Anope::string reason(buffer, 1, l - 1);
-			size_t nl = reason.find("\r\n");
-			Log(LOG_DEBUG) << "redis: status error: " << reason.substr(0, nl);
-			if (nl != Anope::string::npos)
-			{
-				r.type = Reply::NOT_OK;
-				used = 1 + nl + 2;
-			}
-			break;
+			scan_stack.push_back(elements);
+			continue;
 		}
-		case ':':
-		{
-			Anope::string ibuf(buffer, 1, l - 1);
-			size_t nl = ibuf.find("\r\n");
-			if (nl != Anope::string::npos)
-			{
-				try
-				{
-					r.i = convertTo<int64_t>(ibuf.substr(0, nl));
-				}
-				catch (const ConvertException &) { }
 
-				r.type = Reply::INT;
-				used = 1 + nl + 2;
-			}
-			break;
-		}
+		/* A value is complete, which may complete the aggregates containing it */
+		while (!scan_stack.empty() && --scan_stack.back() == 0)
+			scan_stack.pop_back();
+
+		if (scan_stack.empty())
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Builds r from the complete reply at p, which Scan() has already checked, and returns the end of it */
+const char *RedisSocket::BuildReply(Reply &r, const char *p)
+{
+	const char *data = p;
+	while (*data != '\n')
+		++data;
+	++data;
+
+	long len = ParseLength(p);
+
+	switch (*p)
+	{
+		case '+':
+			r.type = Reply::OK;
+			return data;
+		case '-':
+			r.type = Reply::NOT_OK;
+			r.bulk = Anope::string(p + 1, data - 2 - (p + 1));
+			Log(LOG_DEBUG) << "redis: status error: " << r.bulk;
+			return data;
+		case ':':
+			r.type = Reply::INT;
+			r.i = ParseNumber(p);
+			return data;
+		case '#':
+			r.type = Reply::INT;
+			r.i = p[1] == 't';
+			return data;
+		case '_':
+			r.type = Reply::BULK;
+			return data;
+		case ',':
+		case '(':
+			r.type = Reply::BULK;
+			r.bulk = Anope::string(p + 1, data - 2 - (p + 1));
+			return data;
 		case '$':
+		case '!':
+		case '=':
+			r.type = *p == '!' ? Reply::NOT_OK : Reply::BULK;
+			if (len < 0)
+				return data;
+			/* Verbatim strings are prefixed with their format, eg "txt:" */
+			if (*p == '=' && len >= 4)
+				r.bulk = Anope::string(data + 4, len - 4);
+			else
+				r.bulk = Anope::string(data, len);
+			return data + len + 2;
+		case '|':
 		{
-			Anope::string reply(buffer + 1, l - 1);
-			/* This assumes one bulk can always fit in our recv buffer */
-			size_t nl = reply.find("\r\n");
-			if (nl != Anope::string::npos)
+			/* Attributes are not used, skip over them to the value */
+			for (long i = 0; i < len * 2; ++i)
 			{
-				int len;
-				try
-				{
-					len = convertTo<int>(reply.substr(0, nl));
-					if (len >= 0)
-					{
-						if (1 + nl + 2 + len + 2 <= l)
-						{
-							used = 1 + nl + 2 + len + 2;
-							r.bulk = reply.substr(nl + 2, len);
-							r.type = Reply::BULK;
-						}
-					}
-					else
-					{
-						used = 1 + nl + 2 + 2;
-						r.type = Reply::BULK;
-					}
-				}
-				catch (const ConvertException &) { }
+				Reply attr;
+				data = BuildReply(attr, data);
 			}
-			break;
+			return BuildReply(r, data);
 		}
-		multi_bulk_cont:
-		case '*':
+		default:
 		{
-			if (r.type != Reply::MULTI_BULK)
-			{
-				Anope::string reply(buffer + 1, l - 1);
-				size_t nl = reply.find("\r\n");
-				if (nl != Anope::string::npos)
-				{
-					r.type = Reply::MULTI_BULK;
-					try
-					{
-						r.multi_bulk_size = convertTo<int>(reply.substr(0, nl));
-					}
-					catch (const ConvertException &) { }
-
-					used = 1 + nl + 2;
-				}
-				else
-					break;
-			}
-			else if (r.multi_bulk_size >= 0 && r.multi_bulk.size() == static_cast<unsigned>(r.multi_bulk_size))
-			{
-				/* This multi bulk is already complete, so check the sub bulks */
-				for (unsigned i = 0; i < r.multi_bulk.size(); ++i)
-					if (r.multi_bulk[i]->type == Reply::MULTI_BULK)
-						ParseReply(*r.multi_bulk[i], buffer + used, l - used);
-				break;
-			}
-
-			for (int i = r.multi_bulk.size(); i < r.multi_bulk_size; ++i)
+			r.type = Reply::MULTI_BULK;
+			r.multi_bulk_size = *p == '%' ? len * 2 : len;
+			for (int i = 0; i < r.multi_bulk_size; ++i)
 			{
 				Reply *reply = new Reply();
-				size_t u = ParseReply(*reply, buffer + used, l - used);
-				if (!u)
-				{
-					Log(LOG_DEBUG) << "redis: ran out of data to parse";
-					delete reply;
-					break;
-				}
 				r.multi_bulk.push_back(reply);
-				used += u;
+				data = BuildReply(*reply, data);
 			}
-			break;
+			if (r.multi_bulk_size < 0)
+				r.multi_bulk_size = 0;
+			return data;
 		}
-		default:
-			Log(LOG_DEBUG) << "redis: unknown reply " << *buffer;
 	}
-
-	return used;
 }
 
-bool RedisSocket::Read(const char *buffer, size_t l)
+void RedisSocket::Dispatch(Reply &r)
 {
-	static std::vector<char> save;
-	std::vector<char> copy;
-
-	if (!save.empty())
+	if (this == provider->sub)
 	{
-		std::copy(buffer, buffer + l, std::back_inserter(save));
-
-		copy = save;
-
-		buffer = &copy[0];
-		l = copy.size();
-	}
-
-	while (l)
-	{
-		static Reply r;
-
-		size_t used = this->ParseReply(r, buffer, l);
-		if (!used)
+		if (r.multi_bulk.size() == 4)
 		{
-			Log(LOG_DEBUG) << "redis: used == 0 ?";
-			r.Clear();
-			break;
+			/* pmessage
+			 * pattern subscribed to
+			 * __keyevent@0__:set
+			 * key
+			 */
+			std::map<Anope::string, Interface *>::iterator it = this->subinterfaces.find(r.multi_bulk[1]->bulk);
+			if (it != this->subinterfaces.end())
+				it->second->OnResult(r);
 		}
-		else if (used > l)
+	}
+	else
+	{
+		if (this->interfaces.empty())
 		{
-			Log(LOG_DEBUG) << "redis: used > l ?";
-			r.Clear();
-			break;
+			Log(LOG_DEBUG) << "redis: no interfaces?";
 		}
-
-		/* Full result is not here yet */
-		if (r.type == Reply::MULTI_BULK && static_cast<unsigned>(r.multi_bulk_size) != r.multi_bulk.size())
+		else
 		{
-			buffer += used;
-			l -= used;
-			break;
-		}
+			Interface *i = this->interfaces.front();
+			this->interfaces.pop_front();
 
-		if (this == provider->sub)
-		{
-			if (r.multi_bulk.size() == 4)
+			if (i)
 			{
-				/* pmessage
-				 * pattern subscribed to
-				 * __keyevent@0__:set
-				 * key
-				 */
-				std::map<Anope::string, Interface *>::iterator it = this->subinterfaces.find(r.multi_bulk[1]->bulk);
-				if (it != this->subinterfaces.end())
-					it->second->OnResult(r);
+				if (r.type != Reply::NOT_OK)
+					i->OnResult(r);
+				else
+					i->OnError(r.bulk);
 			}
 		}
-		else
-		{
-			if (this->interfaces.empty())
-			{
-				Log(LOG_DEBUG) << "redis: no interfaces?";
-			}
-			else
-			{
-				Interface *i = this->interfaces.front();
-				this->interfaces.pop_front();
+	}
+}
 
-				if (i)
-				{
-					if (r.type != Reply::NOT_OK)
-						i->OnResult(r);
-					else
-						i->OnError(r.bulk);
-				}
-			}
-		}
+bool RedisSocket::Read(const char *buffer, size_t l)
+{
+	/* If nothing is left over from the last read, parse straight from the socket's buffer */
+	if (!recv_buffer.empty())
+	{
+		recv_buffer.insert(recv_buffer.end(), buffer, buffer + l);
+		buffer = &recv_buffer[0];
+		l = recv_buffer.size();
+	}
 
-		buffer += used;
-		l -= used;
+	size_t used = 0;
+	int res;
+	while ((res = this->Scan(buffer + used, l - used)) == 1)
+	{
+		Reply r;
+		const char *end = this->BuildReply(r, buffer + used);
 
-		r.Clear();
+		used = end - buffer;
+		scan_pos = 0;
+
+		this->Dispatch(r);
 	}
 
-	if (l)
+	if (res < 0)
 	{
-		save.resize(l);
-		std::copy(buffer, buffer + l, save.begin());
+		recv_buffer.clear();
+		scan_pos = 0;
+		scan_stack.clear();
+		return false;
 	}
+
+	if (recv_buffer.empty())
+		recv_buffer.assign(buffer + used, buffer + l);
 	else
-		std::vector<char>().swap(save);
+		recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + used);
 
 	return true;
 }
@@ -21,7 +21,7 @@ special[] = {
 	special_chars("&", "&amp;"),
 	special_chars("\"", "&quot;"),
 	special_chars("<", "&lt;"),
-	special_chars(">", "&qt;"),
+	special_chars(">", "&gt;"),
 	special_chars("'", "&#39;"),
 	special_chars("\n", "&#xA;"),
 	special_chars("\002", ""), // bold
@@ -32,13 +32,126 @@ special[] = {
 	special_chars("", "")
 };
 
+/* Appends src to out, escaped for use as XML character data */
+static void Escape(Anope::string &out, const Anope::string &src)
+{
+	for (unsigned i = 0; i < src.length(); ++i)
+	{
+		switch (src[i])
+		{
+			case '&':
+				out += "&amp;";
+				break;
+			case '"':
+				out += "&quot;";
+				break;
+			case '<':
+				out += "&lt;";
+				break;
+			case '>':
+				out += "&gt;";
+				break;
+			case '\'':
+				out += "&#39;";
+				break;
+			case '\n':
+				out += "&#xA;";
+				break;
+			case '\002': // bold
+			case '\003': // color
+			case '\035': // italics
+			case '\037': // underline
+			case '\026': // reverses
+				break;
+			default:
+				out += src[i];
+		}
+	}
+}
+
+/* Appends the replies of request to out as an XMLRPC struct */
+static void EncodeStruct(Anope::string &out, XMLRPCRequest &request)
+{
+	out += "<struct>\n";
+	for (std::map<Anope::string, Anope::string>::const_iterator it = request.get_replies().begin(); it != request.get_replies().end(); ++it)
+	{
+		out += "<member>\n<name>";
+		out += it->first;
+		out += "</name>\n<value>\n<string>";
+		Escape(out, it->second);
+		out += "</string>\n</value>\n</member>\n";
+	}
+	out += "</struct>\n";
+}
+
+/* Appends an XMLRPC fault struct to out */
+static void EncodeFault(Anope::string &out, int code, const Anope::string &message)
+{
+	out += "<struct>\n<member>\n<name>faultCode</name>\n<value>\n<int>" + stringify(code) + "</int>\n</value>\n</member>\n<member>\n<name>faultString</name>\n<value>\n<string>";
+	Escape(out, message);
+	out += "</string>\n</value>\n</member>\n</struct>\n";
+}
+
+static const char *response_header = "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n";
+static const char *response_footer = "</value>\n</param>\n</params>\n</methodResponse>";
+
+/* The state of a system.multicall, kept until every call in it has been answered */
+class XMLRPCMulticall
+{
+ public:
+	Reference<HTTPClient> client;
+	/* Handed to the individual calls, and used to send the response if any of them were deferred */
+	HTTPReply reply;
+	/* The encoded <value> contents of each call's result */
+	std::vector<Anope::string> results;
+	/* Calls which have not been answered yet */
+	unsigned pending;
+	/* Whether the HTTP request has returned without answering, meaning we have to send the reply ourselves */
+	bool deferred;
+	struct timeval started;
+
+	XMLRPCMulticall(HTTPClient *c, HTTPReply &r) : client(c), reply(r), pending(0), deferred(false) { }
+
+	void Encode(Anope::string &out) const
+	{
+		out += response_header;
+		out += "<array>\n<data>\n";
+		for (unsigned i = 0; i < this->results.size(); ++i)
+		{
+			out += "<value>\n";
+			out += this->results[i];
+			out += "</value>\n";
+		}
+		out += "</data>\n</array>\n";
+		out += response_footer;
+	}
+};
+
 class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 {
 	std::deque<XMLRPCEvent *> events;
+	std::set<XMLRPCMulticall *> multicalls;
 
  public:
+	struct MethodStats
+	{
+		unsigned long calls;
+		/* In milliseconds */
+		double total, max;
+
+		MethodStats() : calls(0), total(0), max(0) { }
+	};
+
+	std::map<Anope::string, MethodStats> stats;
+
 	MyXMLRPCServiceInterface(Module *creator, const Anope::string &sname) : XMLRPCServiceInterface(creator, sname), HTTPPage("/xmlrpc", "text/xml") { }
 
+	~MyXMLRPCServiceInterface()
+	{
+		for (std::set<XMLRPCMulticall *>::iterator it = this->multicalls.begin(), it_end = this->multicalls.end(); it != it_end; ++it)
+			delete *it;
+	}
+
 	void Register(XMLRPCEvent *event)
 	{
 		this->events.push_back(event);
@@ -54,9 +167,8 @@ class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 
 	Anope::string Sanitize(const Anope::string &string) anope_override
 	{
-		Anope::string ret = string;
-		for (int i = 0; special[i].character.empty() == false; ++i)
-			ret = ret.replace_all_cs(special[i].character, special[i].replace);
+		Anope::string ret;
+		Escape(ret, string);
 		return ret;
 	}
 
@@ -144,37 +256,177 @@ class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 		return !istag && !data.empty();
 	}
 
+	void RecordLatency(const Anope::string &method, const struct timeval &started)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		double ms = (now.tv_sec - started.tv_sec) * 1000.0 + (now.tv_usec - started.tv_usec) / 1000.0;
+
+		MethodStats &s = this->stats[method];
+		++s.calls;
+		s.total += ms;
+		if (ms > s.max)
+			s.max = ms;
+	}
+
+	/* Runs request through the registered events. Returns false if an event will answer it later */
+	bool Run(HTTPClient *client, XMLRPCRequest &request)
+	{
+		for (unsigned i = 0; i < this->events.size(); ++i)
+		{
+			XMLRPCEvent *e = this->events[i];
+
+			if (!e->Run(this, client, request))
+				return false;
+			else if (!request.get_replies().empty())
+			{
+				/* Unknown methods are not counted, so clients can not grow the stats without bound */
+				this->RecordLatency(request.name, request.started);
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	void DoMethodStats(XMLRPCRequest &request)
+	{
+		for (std::map<Anope::string, MethodStats>::iterator it = this->stats.begin(), it_end = this->stats.end(); it != it_end; ++it)
+		{
+			const MethodStats &s = it->second;
+
+			request.reply(it->first + ".calls", stringify(s.calls));
+			request.reply(it->first + ".avgms", stringify(s.calls ? s.total / s.calls : 0));
+			request.reply(it->first + ".maxms", stringify(s.max));
+		}
+	}
+
+	/* Stores the answer to one call of a multicall */
+	void AddResult(XMLRPCMulticall *mc, XMLRPCRequest &request)
+	{
+		Anope::string &out = mc->results[request.multicall_index];
+
+		if (request.get_replies().empty())
+			EncodeFault(out, -32601, "Unrecognized method " + request.name);
+		else
+		{
+			if (!request.id.empty())
+				request.reply("id", request.id);
+
+			out += "<array>\n<data>\n<value>\n";
+			EncodeStruct(out, request);
+			out += "</value>\n</data>\n</array>\n";
+		}
+	}
+
+	bool DoMulticall(HTTPClient *client, XMLRPCMulticall *mc, std::deque<XMLRPCRequest *> &calls, HTTPReply &reply)
+	{
+		mc->results.resize(calls.size());
+
+		for (unsigned i = 0; i < calls.size(); ++i)
+		{
+			XMLRPCRequest *call = calls[i];
+
+			call->multicall = mc;
+			call->multicall_index = i;
+
+			if (call->name == "system.multicall")
+				EncodeFault(mc->results[i], -32600, "Recursive system.multicall is not allowed");
+			else if (call->name == "system.methodStats")
+			{
+				this->DoMethodStats(*call);
+				this->AddResult(mc, *call);
+			}
+			else
+			{
+				/* The event may answer the call before Run() returns, so count it as pending first */
+				++mc->pending;
+				if (this->Run(client, *call))
+				{
+					--mc->pending;
+					this->AddResult(mc, *call);
+				}
+			}
+
+			delete call;
+		}
+		calls.clear();
+
+		if (mc->pending)
+		{
+			/* SendReply() sends the response once the last deferred call is answered */
+			mc->deferred = true;
+			this->multicalls.insert(mc);
+			return false;
+		}
+
+		Anope::string r;
+		mc->Encode(r);
+		reply.Write(r);
+
+		this->RecordLatency("system.multicall", mc->started);
+		delete mc;
+		return true;
+	}
+
  public:
 	bool OnRequest(HTTPProvider *provider, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply) anope_override
 	{
 		Anope::string content = message.content, tname, data;
 		XMLRPCRequest request(reply);
+		XMLRPCRequest *current = &request;
+		XMLRPCMulticall *mc = NULL;
+		std::deque<XMLRPCRequest *> calls;
 
 		while (GetData(content, tname, data))
 		{
 			Log(LOG_DEBUG) << "m_xmlrpc: Tag name: " << tname << ", data: " << data;
 			if (tname == "methodName")
 				request.name = data;
+			else if (tname == "name" && data == "methodName" && request.name == "system.multicall")
+			{
+				/* Each struct in the multicall's array starts a new call */
+				if (!GetData(content, tname, data))
+					break;
+
+				if (mc == NULL)
+					mc = new XMLRPCMulticall(client, reply);
+
+				current = new XMLRPCRequest(mc->reply);
+				current->name = data;
+				calls.push_back(current);
+			}
 			else if (tname == "name" && data == "id")
 			{
 				GetData(content, tname, data);
-				request.id = data;
+				current->id = data;
 			}
 			else if (tname == "string")
-				request.data.push_back(data);
+				current->data.push_back(data);
 		}
 
-		for (unsigned i = 0; i < this->events.size(); ++i)
+		if (request.name == "system.multicall")
 		{
-			XMLRPCEvent *e = this->events[i];
+			if (mc == NULL)
+				mc = new XMLRPCMulticall(client, reply);
+			mc->started = request.started;
 
-			if (!e->Run(this, client, request))
-				return false;
-			else if (!request.get_replies().empty())
-			{
-				this->Reply(request);
-				return true;
-			}
+			return this->DoMulticall(client, mc, calls, reply);
+		}
+		else if (request.name == "system.methodStats")
+		{
+			this->DoMethodStats(request);
+			this->Reply(request);
+			return true;
+		}
+
+		if (!this->Run(client, request))
+			return false;
+		else if (!request.get_replies().empty())
+		{
+			this->Reply(request);
+			return true;
 		}
 
 		reply.error = HTTP_PAGE_NOT_FOUND;
@@ -182,18 +434,51 @@ class MyXMLRPCServiceInterface : public XMLRPCServiceInterface, public HTTPPage
 		return true;
 	}
 
-	void Reply(XMLRPCRequest &request)
+	void Reply(XMLRPCRequest &request) anope_override
 	{
 		if (!request.id.empty())
 			request.reply("id", request.id);
 
-		Anope::string r = "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<methodResponse>\n<params>\n<param>\n<value>\n<struct>\n";
-		for (std::map<Anope::string, Anope::string>::const_iterator it = request.get_replies().begin(); it != request.get_replies().end(); ++it)
-			r += "<member>\n<name>" + it->first + "</name>\n<value>\n<string>" + this->Sanitize(it->second) + "</string>\n</value>\n</member>\n";
-		r += "</struct>\n</value>\n</param>\n</params>\n</methodResponse>";
+		Anope::string r = response_header;
+		EncodeStruct(r, request);
+		r += response_footer;
 
 		request.r.Write(r);
 	}
+
+	void SendReply(HTTPClient *client, XMLRPCRequest &request) anope_override
+	{
+		if (!request.get_replies().empty())
+			this->RecordLatency(request.name, request.started);
+
+		XMLRPCMulticall *mc = request.multicall;
+		if (mc == NULL)
+		{
+			if (client)
+			{
+				this->Reply(request);
+				client->SendReply(&request.r);
+			}
+			return;
+		}
+
+		this->AddResult(mc, request);
+
+		if (--mc->pending || !mc->deferred)
+			return;
+
+		if (mc->client)
+		{
+			Anope::string r;
+			mc->Encode(r);
+			mc->reply.Write(r);
+			mc->client->SendReply(&mc->reply);
+		}
+
+		this->RecordLatency("system.multicall", mc->started);
+		this->multicalls.erase(mc);
+		delete mc;
+	}
 };
 
 class ModuleXMLRPC : public Module
@@ -24,7 +24,8 @@ class XMLRPCIdentifyRequest : public IdentifyRequest
 
 	void OnSuccess() anope_override
 	{
-		if (!xinterface || !client)
+		/* A multicall is only finished once every deferred call in it is answered, even if its client is gone */
+		if (!xinterface || (!client && !request.multicall))
 			return;
 
 		request.r = this->repl;
@@ -32,21 +33,19 @@ class XMLRPCIdentifyRequest : public IdentifyRequest
 		request.reply("result", "Success");
 		request.reply("account", GetAccount());
 
-		xinterface->Reply(request);
-		client->SendReply(&request.r);
+		xinterface->SendReply(client, request);
 	}
 
 	void OnFail() anope_override
 	{
-		if (!xinterface || !client)
+		if (!xinterface || (!client && !request.multicall))
 			return;
 
 		request.r = this->repl;
 
 		request.reply("error", "Invalid password");
 
-		xinterface->Reply(request);
-		client->SendReply(&request.r);
+		xinterface->SendReply(client, request);
 	}
 };
 
@@ -15,17 +15,26 @@ class BotServCore : public Module
 {
 	Reference<BotInfo> BotServ;
 	ExtensibleRef<bool> persist, inhabit;
+	Configuration::Setting<Anope::string> botmodes;
+	Configuration::Setting<unsigned> minusers;
+	Configuration::Setting<bool> smartjoin;
 
  public:
 	BotServCore(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, PSEUDOCLIENT | VENDOR),
-		persist("PERSIST"), inhabit("inhabit")
+		persist("PERSIST"), inhabit("inhabit"), botmodes("botmodes"), minusers("minusers"), smartjoin("smartjoin")
 	{
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
-		const Anope::string &bsnick = conf->GetModule(this)->Get<const Anope::string>("client");
+		Configuration::Block *block = conf->GetModule(this);
+
+		const Anope::string &bsnick = block->Get<const Anope::string>("client");
 		BotServ = BotInfo::Find(bsnick, true);
+
+		botmodes.Load(block);
+		minusers.Load(block);
+		smartjoin.Load(block);
 	}
 
 	void OnSetCorrectModes(User *user, Channel *chan, AccessGroup &access, bool &give_modes, bool &take_modes) anope_override
@@ -33,17 +42,16 @@ class BotServCore : public Module
 		/* Do not allow removing bot modes on our service bots */
 		if (chan->ci && chan->ci->bi == user)
 		{
-			const Anope::string &botmodes = Config->GetModule(this)->Get<const Anope::string>("botmodes");
-			for (unsigned i = 0; i < botmodes.length(); ++i)
-				chan->SetMode(chan->ci->bi, ModeManager::FindChannelModeByChar(botmodes[i]), chan->ci->bi->GetUID());
+			for (unsigned i = 0; i < botmodes->length(); ++i)
+				chan->SetMode(chan->ci->bi, ModeManager::FindChannelModeByChar((*botmodes)[i]), chan->ci->bi->GetUID());
 		}
 	}
 
 	void OnBotAssign(User *sender, ChannelInfo *ci, BotInfo *bi) anope_override
 	{
-		if (ci->c && ci->c->users.size() >= Config->GetModule(this)->Get<unsigned>("minusers"))
+		if (ci->c && ci->c->users.size() >= minusers)
 		{
-			ChannelStatus status(Config->GetModule(this)->Get<const Anope::string>("botmodes"));
+			ChannelStatus status(botmodes);
 			bi->Join(ci->c, &status);
 		}
 	}
@@ -54,7 +62,7 @@ class BotServCore : public Module
 			return;
 
 		BotInfo *bi = user->server == Me ? dynamic_cast<BotInfo *>(user) : NULL;
-		if (bi && Config->GetModule(this)->Get<bool>("smartjoin"))
+		if (bi && smartjoin)
 		{
 			std::vector<Anope::string> bans = c->GetModeList("BAN");
 
@@ -95,9 +103,9 @@ class BotServCore : public Module
 			 * legit users - Rob
 			 **/
 			/* This is before the user has joined the channel, so check usercount + 1 */
-			if (c->users.size() + 1 >= Config->GetModule(this)->Get<unsigned>("minusers") && !c->FindUser(c->ci->bi))
+			if (c->users.size() + 1 >= minusers && !c->FindUser(c->ci->bi))
 			{
-				ChannelStatus status(Config->GetModule(this)->Get<const Anope::string>("botmodes"));
+				ChannelStatus status(botmodes);
 				c->ci->bi->Join(c, &status);
 			}
 		}
@@ -120,7 +128,7 @@ class BotServCore : public Module
 			return;
 
 		/* This is called prior to removing the user from the channnel, so c->users.size() - 1 should be safe */
-		if (c->ci && c->ci->bi && u != *c->ci->bi && c->users.size() - 1 <= Config->GetModule(this)->Get<unsigned>("minusers") && c->FindUser(c->ci->bi))
+		if (c->ci && c->ci->bi && u != *c->ci->bi && c->users.size() - 1 <= minusers && c->FindUser(c->ci->bi))
 			c->ci->bi->Part(c->ci->c);
 	}
 
@@ -176,7 +184,7 @@ class BotServCore : public Module
 
 	EventReturn OnChannelModeSet(Channel *c, MessageSource &source, ChannelMode *mode, const Anope::string &param) anope_override
 	{
-		if (source.GetUser() && !source.GetBot() && Config->GetModule(this)->Get<bool>("smartjoin") && mode->name == "BAN" && c->ci && c->ci->bi && c->FindUser(c->ci->bi))
+		if (source.GetUser() && !source.GetBot() && smartjoin && mode->name == "BAN" && c->ci && c->ci->bi && c->FindUser(c->ci->bi))
 		{
 			BotInfo *bi = c->ci->bi;
 
@@ -26,10 +26,14 @@ class ChanServCore : public Module, public ChanServService
 	ExtensibleItem<bool> inhabit;
 	ExtensibleRef<bool> persist;
 	bool always_lower;
+	Configuration::Setting<bool> opersonly;
+	Configuration::Setting<Anope::string> require, nomlock;
+	Configuration::Setting<time_t> expiry;
 
  public:
 	ChanServCore(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, PSEUDOCLIENT | VENDOR),
-		ChanServService(this), inhabit(this, "inhabit"), persist("PERSIST"), always_lower(false)
+		ChanServService(this), inhabit(this, "inhabit"), persist("PERSIST"), always_lower(false),
+		opersonly("opersonly"), require("require"), nomlock("nomlock"), expiry("expire", "14d")
 	{
 	}
 
@@ -121,6 +125,12 @@ class ChanServCore : public Module, public ChanServService
 			defaults.clear();
 
 		always_lower = conf->GetModule(this)->Get<bool>("always_lower_ts");
+
+		Configuration::Block *block = conf->GetModule(this);
+		opersonly.Load(block);
+		require.Load(block);
+		nomlock.Load(block);
+		expiry.Load(block);
 	}
 
 	void OnBotDelete(BotInfo *bi) anope_override
@@ -131,7 +141,7 @@ class ChanServCore : public Module, public ChanServService
 
 	EventReturn OnBotPrivmsg(User *u, BotInfo *bi, Anope::string &message) anope_override
 	{
-		if (bi == ChanServ && Config->GetModule(this)->Get<bool>("opersonly") && !u->HasMode("OPER"))
+		if (bi == ChanServ && opersonly && !u->HasMode(UMODE_OPER))
 		{
 			u->SendMessage(bi, ACCESS_DENIED);
 			return EVENT_STOP;
@@ -242,9 +252,8 @@ class ChanServCore : public Module, public ChanServService
 		{
 			ci->c->RemoveMode(ci->WhoSends(), "REGISTERED", "", false);
 
-			const Anope::string &require = Config->GetModule(this)->Get<const Anope::string>("require");
-			if (!require.empty())
-				ci->c->SetModes(ci->WhoSends(), false, "-%s", require.c_str());
+			if (!require->empty())
+				ci->c->SetModes(ci->WhoSends(), false, "-%s", require->c_str());
 		}
 	}
 
@@ -290,13 +299,12 @@ class ChanServCore : public Module, public ChanServService
 		else
 			c->RemoveMode(c->ci->WhoSends(), "REGISTERED", "", false);
 
-		const Anope::string &require = Config->GetModule(this)->Get<const Anope::string>("require");
-		if (!require.empty())
+		if (!require->empty())
 		{
 			if (c->ci)
-				c->SetModes(c->ci->WhoSends(), false, "+%s", require.c_str());
+				c->SetModes(c->ci->WhoSends(), false, "+%s", require->c_str());
 			else
-				c->SetModes(c->ci->WhoSends(), false, "-%s", require.c_str());
+				c->SetModes(c->ci->WhoSends(), false, "-%s", require->c_str());
 		}
 	}
 
@@ -309,8 +317,7 @@ class ChanServCore : public Module, public ChanServService
 
 	EventReturn OnCanSet(User *u, const ChannelMode *cm) anope_override
 	{
-		if (Config->GetModule(this)->Get<const Anope::string>("nomlock").find(cm->mchar) != Anope::string::npos
-			|| Config->GetModule(this)->Get<const Anope::string>("require").find(cm->mchar) != Anope::string::npos)
+		if (nomlock->find(cm->mchar) != Anope::string::npos || require->find(cm->mchar) != Anope::string::npos)
 			return EVENT_STOP;
 		return EVENT_CONTINUE;
 	}
@@ -332,7 +339,7 @@ class ChanServCore : public Module, public ChanServService
 
 	void OnExpireTick() anope_override
 	{
-		time_t chanserv_expire = Config->GetModule(this)->Get<time_t>("expire", "14d");
+		time_t chanserv_expire = expiry;
 
 		if (!chanserv_expire || Anope::NoExpire || Anope::ReadOnly)
 			return;
@@ -460,7 +467,7 @@ class ChanServCore : public Module, public ChanServService
 		if (!show_all)
 			return;
 
-		time_t chanserv_expire = Config->GetModule(this)->Get<time_t>("expire", "14d");
+		time_t chanserv_expire = expiry;
 		if (!ci->HasExt("CS_NO_EXPIRE") && chanserv_expire && !Anope::NoExpire && ci->last_used != Anope::CurTime)
 			info[_("Expires")] = Anope::strftime(ci->last_used + chanserv_expire, source.GetAccount());
 	}
@@ -13,29 +13,110 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-StaticFileServer::StaticFileServer(const Anope::string &f_n, const Anope::string &u, const Anope::string &c_t) : HTTPPage(u, c_t), file_name(f_n)
+/* Reads the whole file at path into buf, returning false if it can not be opened */
+static bool ReadFile(const Anope::string &path, Anope::string &buf, struct stat &st)
 {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	buf.clear();
+
+	int i;
+	char buffer[BUFSIZE];
+	while ((i = read(fd, buffer, sizeof(buffer))) > 0)
+		buf.append(buffer, i);
+
+	close(fd);
+	return i == 0;
 }
 
-bool StaticFileServer::OnRequest(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply)
+/* Header names are case insensitive, but HTTPMessage stores them as sent */
+static const Anope::string *FindHeader(HTTPMessage &message, const Anope::string &name)
 {
-	int fd = open((template_base + "/" + this->file_name).c_str(), O_RDONLY);
-	if (fd < 0)
+	for (std::map<Anope::string, Anope::string>::iterator it = message.headers.begin(), it_end = message.headers.end(); it != it_end; ++it)
+		if (it->first.equals_ci(name))
+			return &it->second;
+	return NULL;
+}
+
+StaticFileServer::StaticFileServer(const Anope::string &f_n, const Anope::string &u, const Anope::string &c_t) : HTTPPage(u, c_t), file_name(f_n), loaded(false)
+{
+}
+
+bool StaticFileServer::Load()
+{
+	const Anope::string path = template_base + "/" + this->file_name;
+
+	struct stat st;
+	if (!ReadFile(path, this->content, st))
 	{
-		Log(LOG_NORMAL, "httpd") << "Error serving file " << page_name << " (" << (template_base + "/" + this->file_name) << "): " << strerror(errno);
+		Log(LOG_NORMAL, "httpd") << "Error serving file " << this->GetURL() << " (" << path << "): " << strerror(errno);
+		return false;
+	}
+
+	/* A stale compressed copy would serve different content depending on the client, so ignore it */
+	struct stat gz_st;
+	if (!ReadFile(path + ".gz", this->gzip_content, gz_st) || gz_st.st_mtime < st.st_mtime)
+		this->gzip_content.clear();
 
+	char timebuf[64];
+	strftime(timebuf, sizeof(timebuf), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&st.st_mtime));
+
+	this->etag = "\"" + stringify(st.st_mtime) + "-" + stringify(this->content.length()) + "\"";
+	this->last_modified = timebuf;
+	this->loaded = true;
+
+	Log(LOG_DEBUG, "httpd") << "webcpanel: Cached " << path << " (" << this->content.length() << " bytes" << (!this->gzip_content.empty() ? ", " + stringify(this->gzip_content.length()) + " bytes compressed" : "") << ")";
+	return true;
+}
+
+void StaticFileServer::Invalidate()
+{
+	this->loaded = false;
+	this->content.clear();
+	this->gzip_content.clear();
+	this->etag.clear();
+	this->last_modified.clear();
+}
+
+bool StaticFileServer::OnRequest(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply)
+{
+	if (!this->loaded && !this->Load())
+	{
 		client->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
 		return true;
 	}
 
 	reply.content_type = this->GetContentType();
 	reply.headers["Cache-Control"] = "public";
+	reply.headers["ETag"] = this->etag;
+	reply.headers["Last-Modified"] = this->last_modified;
+	if (!this->gzip_content.empty())
+		reply.headers["Vary"] = "Accept-Encoding";
 
-	int i;
-	char buffer[BUFSIZE];
-	while ((i = read(fd, buffer, sizeof(buffer))) > 0)
-		reply.Write(buffer, i);
+	/* If-None-Match takes precedence over If-Modified-Since if both are present */
+	const Anope::string *inm = FindHeader(message, "If-None-Match"), *ims = FindHeader(message, "If-Modified-Since");
+	if (inm ? (*inm == "*" || inm->find(this->etag) != Anope::string::npos) : (ims && *ims == this->last_modified))
+	{
+		reply.error = HTTP_NOT_MODIFIED;
+		return true;
+	}
+
+	const Anope::string *ae = FindHeader(message, "Accept-Encoding");
+	if (!this->gzip_content.empty() && ae && ae->find_ci("gzip") != Anope::string::npos)
+	{
+		reply.headers["Content-Encoding"] = "gzip";
+		reply.Write(this->gzip_content.c_str(), this->gzip_content.length());
+	}
+	else
+		reply.Write(this->content.c_str(), this->content.length());
 
-	close(fd);
 	return true;
 }
@@ -7,12 +7,28 @@
 
 #include "modules/httpd.h"
 
-/* A basic file server. Used for serving static content on disk. */
+/* A basic file server. Used for serving static content on disk.
+ * The file (and a pre-compressed .gz variant, if one exists next to it)
+ * is read into memory on first request and kept until Invalidate() is called.
+ */
 class StaticFileServer : public HTTPPage
 {
 	Anope::string file_name;
+
+	/* Whether the file has been read into memory yet */
+	bool loaded;
+	/* The contents of the file, and of file_name.gz if it exists */
+	Anope::string content, gzip_content;
+	/* Validators sent with the file so clients can revalidate with a 304 */
+	Anope::string etag, last_modified;
+
+	bool Load();
  public:
 	StaticFileServer(const Anope::string &f_n, const Anope::string &u, const Anope::string &c_t);
 
+	/** Drop the cached copy of this file, it will be reread on the next request.
+	 */
+	void Invalidate();
+
 	bool OnRequest(HTTPProvider *, const Anope::string &, HTTPClient *, HTTPMessage &, HTTPReply &) anope_override;
 };
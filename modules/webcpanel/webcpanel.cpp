@@ -196,6 +196,15 @@ class ModuleWebCPanel : public Module
 		}
 	}
 
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		/* Pick up any changes made to the static files on disk */
+		style_css.Invalidate();
+		logo_png.Invalidate();
+		cubes_png.Invalidate();
+		favicon_ico.Invalidate();
+	}
+
 	~ModuleWebCPanel()
 	{
 		if (provider)
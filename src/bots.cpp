@@ -116,12 +116,12 @@ void BotInfo::GenerateUID()
 	if (!this->uid.empty())
 	{
 		BotListByUID->erase(this->uid);
-		UserListByUID.erase(this->uid);
+		UserListByUID.Erase(this->uid);
 	}
 
 	this->uid = IRCD->UID_Retrieve();
 	(*BotListByUID)[this->uid] = this;
-	UserListByUID[this->uid] = this;
+	UserListByUID.Insert(this->uid, this);
 }
 
 void BotInfo::OnKill()
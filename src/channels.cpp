@@ -28,6 +28,16 @@
 channel_map ChannelList;
 std::vector<Channel *> Channel::deleting;
 
+/** Deletes the channels which emptied outside of processing the uplink, which deletes them after every line */
+static class DeleteChannelsWork : public Deferred
+{
+ public:
+	void Run() anope_override
+	{
+		Channel::DeleteChannels();
+	}
+} *deleteChannelsWork;
+
 Channel::Channel(const Anope::string &nname, time_t ts)
 {
 	if (nname.empty())
@@ -39,6 +49,7 @@ Channel::Channel(const Anope::string &nname, time_t ts)
 	this->syncing = this->botchannel = false;
 	this->server_modetime = this->chanserv_modetime = 0;
 	this->server_modecount = this->chanserv_modecount = this->bouncy_modes = this->topic_ts = this->topic_time = 0;
+	this->modes_view_dirty = false;
 
 	this->ci = ChannelInfo::Find(this->name);
 	if (this->ci)
@@ -70,6 +81,9 @@ Channel::~Channel()
 void Channel::Reset()
 {
 	this->modes.clear();
+	this->mode_params.clear();
+	this->list_modes.clear();
+	this->modes_view_dirty = true;
 
 	for (ChanUserList::const_iterator it = this->users.begin(), it_end = this->users.end(); it != it_end; ++it)
 	{
@@ -130,7 +144,7 @@ bool Channel::CheckDelete()
 		return false;
 
 	/* Permanent channels never get deleted */
-	if (this->HasMode("PERM"))
+	if (this->HasMode(CMODE_PERM))
 		return false;
 
 	EventReturn MOD_RESULT;
@@ -199,37 +213,81 @@ bool Channel::HasUserStatus(User *u, const Anope::string &mname)
 	return HasUserStatus(u, anope_dynamic_static_cast<ChannelModeStatus *>(ModeManager::FindChannelModeByName(mname)));
 }
 
-size_t Channel::HasMode(const Anope::string &mname, const Anope::string &param)
+bool Channel::HasUserStatus(User *u, ChannelModeID id)
+{
+	return HasUserStatus(u, anope_dynamic_static_cast<ChannelModeStatus *>(ModeManager::FindChannelModeByID(id)));
+}
+
+static unsigned GetModeID(const ChannelMode *cm, bool create)
+{
+	if (cm->id != ModeManager::NO_MODE_ID)
+		return cm->id;
+	return ModeManager::GetChannelModeID(cm->name, create);
+}
+
+const Anope::string *Channel::FindModeParam(unsigned id) const
 {
+	for (unsigned i = 0; i < this->mode_params.size(); ++i)
+		if (this->mode_params[i].first == id)
+			return &this->mode_params[i].second;
+	return NULL;
+}
+
+size_t Channel::HasModeID(unsigned id, const Anope::string &param) const
+{
+	std::map<unsigned, ListModeEntries>::const_iterator it = this->list_modes.find(id);
+
 	if (param.empty())
-		return modes.count(mname);
-	std::vector<Anope::string> v = this->GetModeList(mname);
-	for (unsigned int i = 0; i < v.size(); ++i)
-		if (v[i].equals_ci(param))
+	{
+		if (id < this->modes.size() && this->modes[id])
 			return 1;
-	return 0;
+		return it != this->list_modes.end() ? it->second.entries.size() : 0;
+	}
+
+	if (it != this->list_modes.end())
+		return it->second.index.count(param);
+
+	const Anope::string *p = this->FindModeParam(id);
+	return p && p->equals_ci(param) ? 1 : 0;
+}
+
+size_t Channel::HasMode(const Anope::string &mname, const Anope::string &param)
+{
+	unsigned id = ModeManager::GetChannelModeID(mname);
+	if (id == ModeManager::NO_MODE_ID)
+		return 0;
+	return this->HasModeID(id, param);
+}
+
+size_t Channel::HasMode(ChannelModeID id)
+{
+	return this->HasModeID(id, "");
 }
 
 Anope::string Channel::GetModes(bool complete, bool plus)
 {
 	Anope::string res, params;
 
-	for (std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+	for (unsigned id = 0; id < this->modes.size(); ++id)
 	{
-		ChannelMode *cm = ModeManager::FindChannelModeByName(it->first);
+		if (!this->modes[id])
+			continue;
+
+		ChannelMode *cm = ModeManager::FindChannelModeByID(id);
 		if (!cm || cm->type == MODE_LIST)
 			continue;
 
 		res += cm->mchar;
 
-		if (complete && !it->second.empty())
+		const Anope::string *param = complete ? this->FindModeParam(id) : NULL;
+		if (param && !param->empty())
 		{
 			ChannelModeParam *cmp = NULL;
 			if (cm->type == MODE_PARAM)
 				cmp = anope_dynamic_static_cast<ChannelModeParam *>(cm);
 
 			if (plus || !cmp || !cmp->minus_no_arg)
-				params += " " + it->second;
+				params += " " + *param;
 		}
 	}
 
@@ -238,22 +296,47 @@ Anope::string Channel::GetModes(bool complete, bool plus)
 
 const Channel::ModeList &Channel::GetModes() const
 {
-	return this->modes;
-}
-
-template<typename F, typename S>
-struct second
-{
-	S operator()(const std::pair<F, S> &p)
+	if (this->modes_view_dirty)
 	{
-		return p.second;
+		this->modes_view.clear();
+
+		for (unsigned id = 0; id < this->modes.size(); ++id)
+			if (this->modes[id])
+			{
+				const Anope::string *param = this->FindModeParam(id);
+				this->modes_view.insert(std::make_pair(ModeManager::GetChannelModeName(id), param ? *param : ""));
+			}
+
+		for (std::map<unsigned, ListModeEntries>::const_iterator it = this->list_modes.begin(), it_end = this->list_modes.end(); it != it_end; ++it)
+		{
+			const Anope::string &mname = ModeManager::GetChannelModeName(it->first);
+			for (ListModeEntries::list::const_iterator lit = it->second.entries.begin(), lit_end = it->second.entries.end(); lit != lit_end; ++lit)
+				this->modes_view.insert(std::make_pair(mname, *lit));
+		}
+
+		this->modes_view_dirty = false;
 	}
-};
+
+	return this->modes_view;
+}
 
 std::vector<Anope::string> Channel::GetModeList(const Anope::string &mname)
 {
 	std::vector<Anope::string> r;
-	std::transform(modes.lower_bound(mname), modes.upper_bound(mname), std::back_inserter(r), second<Anope::string, Anope::string>());
+
+	unsigned id = ModeManager::GetChannelModeID(mname);
+	if (id == ModeManager::NO_MODE_ID)
+		return r;
+
+	std::map<unsigned, ListModeEntries>::const_iterator it = this->list_modes.find(id);
+	if (it != this->list_modes.end())
+		r.assign(it->second.entries.begin(), it->second.entries.end());
+	else if (id < this->modes.size() && this->modes[id])
+	{
+		const Anope::string *param = this->FindModeParam(id);
+		r.push_back(param ? *param : "");
+	}
+
 	return r;
 }
 
@@ -299,12 +382,29 @@ void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Ano
 		return;
 	}
 
-	if (cm->type != MODE_LIST)
-		this->modes.erase(cm->name);
-	else if (this->HasMode(cm->name, param))
-		return;
+	unsigned id = GetModeID(cm, true);
+	if (cm->type == MODE_LIST)
+	{
+		ListModeEntries &list = this->list_modes[id];
+		if (list.index.count(param))
+			return;
 
-	this->modes.insert(std::make_pair(cm->name, param));
+		list.index[param] = list.entries.insert(list.entries.end(), param);
+	}
+	else
+	{
+		if (id >= this->modes.size())
+			this->modes.resize(id + 1);
+		this->modes[id] = true;
+
+		unsigned i = 0;
+		for (; i < this->mode_params.size() && this->mode_params[i].first != id; ++i);
+		if (i < this->mode_params.size())
+			this->mode_params[i].second = param;
+		else if (!param.empty())
+			this->mode_params.push_back(std::make_pair(id, param));
+	}
+	this->modes_view_dirty = true;
 
 	if (param.empty() && cm->type != MODE_REGULAR)
 	{
@@ -370,17 +470,35 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *ocm, const
 		return;
 	}
 
+	unsigned id = GetModeID(cm, false);
 	if (cm->type == MODE_LIST)
 	{
-		for (Channel::ModeList::iterator it = modes.lower_bound(cm->name), it_end = modes.upper_bound(cm->name); it != it_end; ++it)
-			if (param.equals_ci(it->second))
+		std::map<unsigned, ListModeEntries>::iterator it = this->list_modes.find(id);
+		if (it != this->list_modes.end())
+		{
+			ListModeEntries &list = it->second;
+			Anope::hash_map<ListModeEntries::list::iterator>::iterator iit = list.index.find(param);
+			if (iit != list.index.end())
 			{
-				this->modes.erase(it);
+				list.entries.erase(iit->second);
+				list.index.erase(iit);
+				if (list.entries.empty())
+					this->list_modes.erase(it);
+			}
+		}
+	}
+	else if (id < this->modes.size())
+	{
+		this->modes[id] = false;
+
+		for (unsigned i = 0; i < this->mode_params.size(); ++i)
+			if (this->mode_params[i].first == id)
+			{
+				this->mode_params.erase(this->mode_params.begin() + i);
 				break;
 			}
 	}
-	else
-		this->modes.erase(cm->name);
+	this->modes_view_dirty = true;
 
 	if (cm->type == MODE_LIST)
 	{
@@ -390,7 +508,7 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *ocm, const
 
 	FOREACH_RESULT(OnChannelModeUnset, MOD_RESULT, (this, setter, cm, param));
 
-	if (cm->name == "PERM")
+	if (cm->id == CMODE_PERM)
 	{
 		if (this->CheckDelete())
 		{
@@ -525,13 +643,25 @@ void Channel::RemoveMode(BotInfo *bi, const Anope::string &mname, const Anope::s
 
 bool Channel::GetParam(const Anope::string &mname, Anope::string &target) const
 {
-	std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.find(mname);
+	unsigned id = ModeManager::GetChannelModeID(mname);
 
 	target.clear();
 
-	if (it != this->modes.end())
+	if (id == ModeManager::NO_MODE_ID)
+		return false;
+
+	if (id < this->modes.size() && this->modes[id])
 	{
-		target = it->second;
+		const Anope::string *param = this->FindModeParam(id);
+		if (param)
+			target = *param;
+		return true;
+	}
+
+	std::map<unsigned, ListModeEntries>::const_iterator it = this->list_modes.find(id);
+	if (it != this->list_modes.end())
+	{
+		target = it->second.entries.front();
 		return true;
 	}
 
@@ -725,13 +855,13 @@ void Channel::SetModesInternal(MessageSource &source, const Anope::string &mode,
 
 bool Channel::MatchesList(User *u, const Anope::string &mode)
 {
-	if (!this->HasMode(mode))
+	std::map<unsigned, ListModeEntries>::const_iterator it = this->list_modes.find(ModeManager::GetChannelModeID(mode));
+	if (it == this->list_modes.end())
 		return false;
 
-	std::vector<Anope::string> v = this->GetModeList(mode);
-	for (unsigned i = 0; i < v.size(); ++i)
+	for (ListModeEntries::list::const_iterator lit = it->second.entries.begin(), lit_end = it->second.entries.end(); lit != lit_end; ++lit)
 	{
-		Entry e(mode, v[i]);
+		Entry e(mode, *lit);
 		if (e.Matches(u))
 			return true;
 	}
@@ -853,7 +983,7 @@ void Channel::SetCorrectModes(User *user, bool give_modes)
 		if (give_modes && has_priv)
 		{
 			/* Always give op. If we have already given one mode, don't give more until it has a symbol */
-			if (cm->name == "OP" || !given || (giving && cm->symbol))
+			if (cm->id == CMODE_OP || !given || (giving && cm->symbol))
 			{
 				this->SetMode(NULL, cm, user->GetUID(), false);
 				/* Now if this contains a symbol don't give any more modes, to prevent setting +qaohv etc on users */
@@ -865,7 +995,7 @@ void Channel::SetCorrectModes(User *user, bool give_modes)
 		else if (take_modes && !has_priv && ci->GetLevel(cm->name + "ME") != ACCESS_INVALID && !u_access.HasPriv(cm->name + "ME"))
 		{
 			/* Only remove modes if they are > voice */
-			if (cm->name == "VOICE")
+			if (cm->id == CMODE_VOICE)
 				take_modes = false;
 			else
 				this->RemoveMode(NULL, cm, user->GetUID(), false);
@@ -946,6 +1076,10 @@ void Channel::QueueForDeletion()
 {
 	if (std::find(deleting.begin(), deleting.end(), this) == deleting.end())
 		deleting.push_back(this);
+
+	if (!deleteChannelsWork)
+		deleteChannelsWork = new DeleteChannelsWork();
+	deleteChannelsWork->Post();
 }
 
 void Channel::DeleteChannels()
@@ -86,7 +86,7 @@ bool CommandSource::IsServicesOper()
 bool CommandSource::IsOper()
 {
 	if (this->u)
-		return this->u->HasMode("OPER");
+		return this->u->HasMode(UMODE_OPER);
 	else if (this->nc)
 		return this->nc->IsServicesOper();
 	return false;
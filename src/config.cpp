@@ -110,10 +110,11 @@ template<typename T> static void ValidateNotZero(const Anope::string &block, con
 		throw ConfigException("The value for <" + block + ":" + name + "> cannot be zero!");
 }
 
-Conf::Conf() : Block("")
+Conf::Conf() : Block(""), RegexEngine("Regex", "")
 {
 	ReadTimeout = 0;
 	UsePrivmsg = DefPrivmsg = false;
+	OutputLines = OutputBytes = TargetLines = 0;
 
 	this->LoadConf(ServicesConf);
 
@@ -180,15 +181,20 @@ Conf::Conf() : Block("")
 
 	if (mail->Get<bool>("usemail"))
 	{
-		Anope::string check[] = { "sendmailpath", "sendfrom", "registration_subject", "registration_message", "emailchange_subject", "emailchange_message", "memo_subject", "memo_message" };
+		Anope::string check[] = { "sendfrom", "registration_subject", "registration_message", "emailchange_subject", "emailchange_message", "memo_subject", "memo_message" };
 		for (unsigned i = 0; i < sizeof(check) / sizeof(Anope::string); ++i)
 			ValidateNotEmpty("mail", check[i], mail->Get<const Anope::string>(check[i]));
+		if (mail->Get<const Anope::string>("smtpserver").empty())
+			ValidateNotEmpty("mail", "sendmailpath", mail->Get<const Anope::string>("sendmailpath"));
 	}
 
 	this->ReadTimeout = options->Get<time_t>("readtimeout");
 	this->UsePrivmsg = options->Get<bool>("useprivmsg");
 	this->UseStrictPrivmsg = options->Get<bool>("usestrictprivmsg");
 	this->StrictPrivmsg = !UseStrictPrivmsg ? "/msg " : "/";
+	this->OutputLines = options->Get<unsigned>("outputlines");
+	this->OutputBytes = options->Get<unsigned>("outputbytes");
+	this->TargetLines = options->Get<unsigned>("targetlines");
 	{
 		std::vector<Anope::string> defaults;
 		spacesepstream(this->GetModule("nickserv")->Get<const Anope::string>("defaults")).GetTokens(defaults);
@@ -197,6 +203,7 @@ Conf::Conf() : Block("")
 	this->DefLanguage = options->Get<const Anope::string>("defaultlanguage");
 	this->TimeoutCheck = options->Get<time_t>("timeoutcheck");
 	this->NickChars = networkinfo->Get<Anope::string>("nick_chars");
+	this->RegexEngine = options->Get<const Anope::string>("regexengine");
 
 	for (int i = 0; i < this->CountBlock("uplink"); ++i)
 	{
@@ -13,26 +13,507 @@
 #include "mail.h"
 #include "config.h"
 
-Mail::Message::Message(const Anope::string &sf, const Anope::string &mailto, const Anope::string &a, const Anope::string &s, const Anope::string &m) : Thread(), sendmail_path(Config->GetBlock("mail")->Get<const Anope::string>("sendmailpath")), send_from(sf), mail_to(mailto), addr(a), subject(s), message(m), dont_quote_addresses(Config->GetBlock("mail")->Get<bool>("dontquoteaddresses")), success(false)
+#include "timers.h"
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+/* Mail is sent by a small pool of sender threads which share one queue. Each
+ * sender either runs sendmailpath for every message, or keeps a connection to
+ * the configured SMTP server open for as long as there is mail waiting. The
+ * results go back to the main thread, which logs them and schedules retries.
+ */
+
+namespace
 {
+	/** A connection to an SMTP server, used by one sender thread
+	 */
+	class SMTPClient
+	{
+		int fd;
+		Anope::string server;
+		unsigned port;
+		/* Whether the server allows commands to be pipelined, RFC 2920 */
+		bool pipelining;
+		/* Read but not yet processed */
+		Anope::string buffer;
+
+		bool Write(const Anope::string &data)
+		{
+			for (size_t written = 0; written < data.length();)
+			{
+				int i = send(this->fd, data.c_str() + written, data.length() - written, 0);
+				if (i <= 0)
+				{
+					this->Close();
+					return false;
+				}
+				written += i;
+			}
+			return true;
+		}
+
+		/** Read a reply, which may span multiple lines
+		 * @param text Set to the text of every line of the reply
+		 * @return The reply code, or 0 if the connection was lost
+		 */
+		int ReadReply(Anope::string &text)
+		{
+			text.clear();
+
+			for (;;)
+			{
+				size_t eol;
+				while ((eol = this->buffer.find('\n')) == Anope::string::npos)
+				{
+					char buf[512];
+					int i = recv(this->fd, buf, sizeof(buf), 0);
+					if (i <= 0)
+					{
+						this->Close();
+						return 0;
+					}
+					this->buffer += Anope::string(buf, i);
+				}
+
+				Anope::string line = this->buffer.substr(0, eol);
+				this->buffer.erase(0, eol + 1);
+				if (!line.empty() && line[line.length() - 1] == '\r')
+					line.erase(line.length() - 1);
+
+				if (line.length() < 3 || !isdigit(line[0]) || !isdigit(line[1]) || !isdigit(line[2]))
+				{
+					this->Close();
+					return 0;
+				}
+
+				if (line.length() > 4)
+					text += line.substr(4) + "\n";
+
+				if (line.length() == 3 || line[3] != '-')
+					return atoi(line.substr(0, 3).c_str());
+			}
+		}
+
+		bool Connect(Mail::Message *m)
+		{
+			this->server = m->smtp_server;
+			this->port = m->smtp_port;
+			this->pipelining = false;
+
+			addrinfo hints, *res;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+
+			if (getaddrinfo(this->server.c_str(), stringify(this->port).c_str(), &hints, &res))
+			{
+				m->error = "Unable to resolve " + this->server;
+				return false;
+			}
+
+			for (addrinfo *ai = res; ai && this->fd == -1; ai = ai->ai_next)
+			{
+				this->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+				if (this->fd == -1)
+					continue;
+
+				/* Never let a stuck server hold up the sender forever */
+#ifndef _WIN32
+				struct timeval tv;
+				tv.tv_sec = 30;
+				tv.tv_usec = 0;
+#else
+				DWORD tv = 30000;
+#endif
+				setsockopt(this->fd, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+				setsockopt(this->fd, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+
+				if (connect(this->fd, ai->ai_addr, ai->ai_addrlen))
+				{
+					anope_close(this->fd);
+					this->fd = -1;
+				}
+			}
+			freeaddrinfo(res);
+
+			if (this->fd == -1)
+			{
+				m->error = "Unable to connect to " + this->server + ":" + stringify(this->port);
+				return false;
+			}
+
+			Anope::string text;
+			if (this->ReadReply(text) != 220)
+			{
+				m->error = "SMTP server " + this->server + " did not greet us";
+				this->Close();
+				return false;
+			}
+
+			if (this->Write("EHLO " + m->helo + "\r\n") && this->ReadReply(text) == 250)
+			{
+				sepstream sep(text, '\n');
+				for (Anope::string ext; sep.GetToken(ext);)
+					if (ext.equals_ci("PIPELINING"))
+						this->pipelining = true;
+			}
+			else if (!this->Connected() || !this->Write("HELO " + m->helo + "\r\n") || this->ReadReply(text) != 250)
+			{
+				m->error = "SMTP server " + this->server + " refused HELO: " + text.replace_all_cs("\n", " ");
+				this->Close();
+				return false;
+			}
+
+			return true;
+		}
+
+	 public:
+		SMTPClient() : fd(-1), port(0), pipelining(false) { }
+
+		~SMTPClient()
+		{
+			this->Close();
+		}
+
+		bool Connected() const
+		{
+			return this->fd != -1;
+		}
+
+		void Close()
+		{
+			if (this->fd != -1)
+			{
+				anope_close(this->fd);
+				this->fd = -1;
+			}
+			this->buffer.clear();
+		}
+
+		void Quit()
+		{
+			Anope::string text;
+			if (this->Connected() && this->Write("QUIT\r\n"))
+				this->ReadReply(text);
+			this->Close();
+		}
+
+		bool Send(Mail::Message *m)
+		{
+			if (this->Connected() && (this->server != m->smtp_server || this->port != m->smtp_port))
+				this->Quit();
+
+			if (!this->Connected() && !this->Connect(m))
+				return false;
+
+			Anope::string from = m->send_from;
+			size_t lt = from.find('<'), gt = from.rfind('>');
+			if (lt != Anope::string::npos && gt != Anope::string::npos && lt < gt)
+				from = from.substr(lt + 1, gt - lt - 1);
+
+			const Anope::string commands[] = { "MAIL FROM:<" + from + ">\r\n", "RCPT TO:<" + m->addr + ">\r\n", "DATA\r\n" };
+			const int expected[] = { 250, 250, 354 };
+
+			/* With pipelining the whole envelope goes in one write, and the replies are read after */
+			if (this->pipelining && !this->Write(commands[0] + commands[1] + commands[2]))
+			{
+				m->error = "Lost connection to " + this->server;
+				return false;
+			}
+
+			bool ok = true;
+			for (unsigned i = 0; i < 3; ++i)
+			{
+				Anope::string text;
+				int code = (this->pipelining || this->Write(commands[i])) ? this->ReadReply(text) : 0;
+
+				if (!code)
+				{
+					m->error = "Lost connection to " + this->server;
+					return false;
+				}
+
+				if (code == expected[i] || (i == 1 && code == 251))
+					continue;
+
+				if (code == 354)
+				{
+					/* DATA was accepted after an earlier command failed, so end it empty */
+					if (!this->Write(".\r\n") || !this->ReadReply(text))
+					{
+						m->error = "Lost connection to " + this->server;
+						return false;
+					}
+					continue;
+				}
+
+				if (ok)
+				{
+					m->error = commands[i].substr(0, commands[i].length() - 2) + " failed: " + stringify(code) + " " + text.replace_all_cs("\n", " ");
+					m->permanent = code >= 500;
+					ok = false;
+				}
+
+				if (!this->pipelining)
+					break;
+			}
+
+			if (!ok)
+			{
+				Anope::string text;
+				if (this->Write("RSET\r\n"))
+					this->ReadReply(text);
+				return false;
+			}
+
+			Anope::string data = "From: " + m->send_from + "\r\n";
+			if (m->dont_quote_addresses)
+				data += "To: " + m->mail_to + " <" + m->addr + ">\r\n";
+			else
+				data += "To: \"" + m->mail_to + "\" <" + m->addr + ">\r\n";
+			data += "Subject: " + m->subject + "\r\n";
+			data += "Date: " + m->date + "\r\n";
+			data += "Message-ID: " + m->message_id + "\r\n\r\n";
+
+			sepstream sep(m->message, '\n', true);
+			for (Anope::string line; sep.GetToken(line);)
+			{
+				if (!line.empty() && line[line.length() - 1] == '\r')
+					line.erase(line.length() - 1);
+				/* Lines starting with a dot would end the message early, RFC 5321 4.5.2 */
+				if (!line.empty() && line[0] == '.')
+					data += ".";
+				data += line + "\r\n";
+			}
+			data += ".\r\n";
+
+			Anope::string text;
+			int code = this->Write(data) ? this->ReadReply(text) : 0;
+			if (code == 250)
+				return true;
+
+			if (!code)
+				m->error = "Lost connection to " + this->server;
+			else
+			{
+				m->error = "Message refused: " + stringify(code) + " " + text.replace_all_cs("\n", " ");
+				m->permanent = code >= 500;
+			}
+			return false;
+		}
+	};
+
+	/** A thread sending mail from the queue
+	 */
+	class Sender : public Thread
+	{
+		SMTPClient smtp;
+
+	 public:
+		void Run() anope_override;
+	};
+
+	/** The queue of mail waiting to be sent. It is also notified
+	 * by the senders when they have finished with a message.
+	 */
+	class MailQueue : public Notifier, public Condition
+	{
+	 public:
+		/* Messages waiting for a sender */
+		std::deque<Mail::Message *> pending;
+		/* Messages sent or failed, waiting for the main thread */
+		MPSCQueue<Mail::Message *> finished;
+		std::vector<Sender *> senders;
+		Mail::Counters stats;
+
+		~MailQueue()
+		{
+			this->Lock();
+			for (unsigned i = 0; i < this->senders.size(); ++i)
+				this->senders[i]->SetExitState();
+			this->Unlock();
+
+			for (unsigned i = 0; i < this->senders.size(); ++i)
+				this->Wakeup();
+
+			for (unsigned i = 0; i < this->senders.size(); ++i)
+			{
+				this->senders[i]->Join();
+				delete this->senders[i];
+			}
+
+			if (!this->pending.empty())
+				Log(LOG_NORMAL, "mail") << "Discarding " << this->pending.size() << " unsent mail(s)";
+
+			for (unsigned i = 0; i < this->pending.size(); ++i)
+				delete this->pending[i];
+			Mail::Message *m;
+			while (this->finished.Pop(m))
+				delete m;
+		}
+
+		/** Queue a message to be sent
+		 * @return false if the queue is full, in which case the message is deleted
+		 */
+		bool Add(Mail::Message *m)
+		{
+			Configuration::Block *b = Config->GetBlock("mail");
+			unsigned workers = std::max(b->Get<unsigned>("workers", "2"), 1U);
+			size_t queuesize = b->Get<unsigned>("queuesize", "1000");
+
+			this->Lock();
+			if (queuesize && this->pending.size() >= queuesize)
+			{
+				this->Unlock();
+
+				Log(LOG_NORMAL, "mail") << "Too much mail waiting to be sent, dropping mail for " << m->mail_to << " (" << m->addr << ")";
+				++this->stats.dropped;
+				delete m;
+				return false;
+			}
+			this->pending.push_back(m);
+			this->Unlock();
+
+			/* The pool only grows, senders without work just wait */
+			while (this->senders.size() < workers)
+			{
+				Sender *s = new Sender();
+				s->Start();
+				this->senders.push_back(s);
+			}
+
+			this->Wakeup();
+			return true;
+		}
+
+		void OnNotify() anope_override;
+	};
+
+	MailQueue *queue = NULL;
+
+	/** Queues a message again once it has waited long enough
+	 */
+	class RetryTimer : public Timer
+	{
+		Mail::Message *message;
+
+	 public:
+		RetryTimer(Mail::Message *m, time_t delay) : Timer(delay), message(m) { }
+
+		void Tick(time_t) anope_override
+		{
+			--queue->stats.retrying;
+			queue->Add(this->message);
+		}
+	};
 }
 
-Mail::Message::~Message()
+void Sender::Run()
 {
-	if (success)
-		Log(LOG_NORMAL, "mail") << "Successfully delivered mail for " << mail_to << " (" << addr << ")";
-	else
-		Log(LOG_NORMAL, "mail") << "Error delivering mail for " << mail_to << " (" << addr << ")";
+	queue->Lock();
+
+	while (!this->GetExitState())
+	{
+		if (queue->pending.empty())
+		{
+			if (this->smtp.Connected())
+			{
+				/* Nothing more to send for now, so do not keep the server waiting */
+				queue->Unlock();
+				this->smtp.Quit();
+				queue->Lock();
+			}
+			else
+				queue->Wait();
+			continue;
+		}
+
+		Mail::Message *m = queue->pending.front();
+		queue->pending.pop_front();
+		queue->Unlock();
+
+		m->error.clear();
+		m->permanent = false;
+		if (!(m->smtp_server.empty() ? m->Sendmail() : this->smtp.Send(m)))
+			++m->attempts;
+
+		queue->finished.Push(m);
+		queue->Notify();
+		queue->Lock();
+	}
+
+	queue->Unlock();
+
+	this->smtp.Quit();
+}
+
+void MailQueue::OnNotify()
+{
+	Configuration::Block *b = Config->GetBlock("mail");
+	unsigned retries = b->Get<unsigned>("retries", "3");
+	time_t retrydelay = std::max(b->Get<time_t>("retrydelay", "1m"), static_cast<time_t>(1));
+
+	Mail::Message *m;
+	while (this->finished.Pop(m))
+	{
+		if (m->error.empty())
+		{
+			Log(LOG_NORMAL, "mail") << "Successfully delivered mail for " << m->mail_to << " (" << m->addr << ")";
+			++this->stats.sent;
+			delete m;
+		}
+		else if (!m->permanent && m->attempts <= retries)
+		{
+			/* Wait twice as long after every failure */
+			time_t delay = retrydelay << std::min(m->attempts - 1, 10U);
+
+			Log(LOG_NORMAL, "mail") << "Error delivering mail for " << m->mail_to << " (" << m->addr << "), retrying in " << Anope::Duration(delay) << ": " << m->error;
+			++this->stats.retried;
+			++this->stats.retrying;
+			new RetryTimer(m, delay);
+		}
+		else
+		{
+			Log(LOG_NORMAL, "mail") << "Error delivering mail for " << m->mail_to << " (" << m->addr << "): " << m->error;
+			++this->stats.failed;
+			delete m;
+		}
+	}
 }
 
-void Mail::Message::Run()
+/** Formats a time as the date of a message, RFC 5322 3.3
+ */
+static Anope::string MailDate(time_t t)
+{
+	static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+	struct tm *tm = gmtime(&t);
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s, %02d %s %d %02d:%02d:%02d +0000", days[tm->tm_wday], tm->tm_mday, months[tm->tm_mon], tm->tm_year + 1900, tm->tm_hour, tm->tm_min, tm->tm_sec);
+	return buf;
+}
+
+Mail::Message::Message(const Anope::string &sf, const Anope::string &mailto, const Anope::string &a, const Anope::string &s, const Anope::string &m) : sendmail_path(Config->GetBlock("mail")->Get<const Anope::string>("sendmailpath")),
+	smtp_server(Config->GetBlock("mail")->Get<const Anope::string>("smtpserver")), smtp_port(Config->GetBlock("mail")->Get<unsigned>("smtpport", "25")), helo(Config->GetBlock("serverinfo")->Get<const Anope::string>("name")),
+	send_from(sf), mail_to(mailto), addr(a), subject(s), message(m), dont_quote_addresses(Config->GetBlock("mail")->Get<bool>("dontquoteaddresses")), attempts(0), permanent(false)
+{
+	this->date = MailDate(Anope::CurTime);
+	this->message_id = "<" + stringify(Anope::CurTime) + "." + Anope::Random(16) + "@" + this->helo + ">";
+}
+
+bool Mail::Message::Sendmail()
 {
 	FILE *pipe = popen(sendmail_path.c_str(), "w");
 
 	if (!pipe)
 	{
-		SetExitState();
-		return;
+		this->error = "Unable to run " + sendmail_path;
+		return false;
 	}
 
 	fprintf(pipe, "From: %s\n", send_from.c_str());
@@ -41,14 +522,50 @@ void Mail::Message::Run()
 	else
 		fprintf(pipe, "To: \"%s\" <%s>\n", mail_to.c_str(), addr.c_str());
 	fprintf(pipe, "Subject: %s\n", subject.c_str());
+	fprintf(pipe, "Date: %s\n", date.c_str());
+	fprintf(pipe, "Message-ID: %s\n", message_id.c_str());
 	fprintf(pipe, "\n");
 	fprintf(pipe, "%s", message.c_str());
 	fprintf(pipe, "\n.\n");
 
-	pclose(pipe);
+	/* sendmail may fail after it has accepted the message, so sending it again could deliver it twice */
+	if (pclose(pipe))
+	{
+		this->error = sendmail_path + " failed";
+		this->permanent = true;
+		return false;
+	}
+
+	return true;
+}
+
+/** Queue a message for the senders
+ */
+static bool Queue(NickCore *nc, const Anope::string &subject, const Anope::string &message)
+{
+	if (!queue)
+		queue = new MailQueue();
 
-	success = true;
-	SetExitState();
+	return queue->Add(new Mail::Message(Config->GetBlock("mail")->Get<const Anope::string>("sendfrom"), nc->display, nc->email, subject, message));
+}
+
+void Mail::Shutdown()
+{
+	delete queue;
+	queue = NULL;
+}
+
+Mail::Counters Mail::GetStats()
+{
+	if (!queue)
+		return Counters();
+
+	queue->Lock();
+	Counters c = queue->stats;
+	c.queued = queue->pending.size();
+	queue->Unlock();
+
+	return c;
 }
 
 bool Mail::Send(User *u, NickCore *nc, BotInfo *service, const Anope::string &subject, const Anope::string &message)
@@ -66,9 +583,7 @@ bool Mail::Send(User *u, NickCore *nc, BotInfo *service, const Anope::string &su
 			return false;
 
 		nc->lastmail = Anope::CurTime;
-		Thread *t = new Mail::Message(b->Get<const Anope::string>("sendfrom"), nc->display, nc->email, subject, message);
-		t->Start();
-		return true;
+		return Queue(nc, subject, message);
 	}
 	else
 	{
@@ -81,9 +596,7 @@ bool Mail::Send(User *u, NickCore *nc, BotInfo *service, const Anope::string &su
 		else
 		{
 			u->lastmail = nc->lastmail = Anope::CurTime;
-			Thread *t = new Mail::Message(b->Get<const Anope::string>("sendfrom"), nc->display, nc->email, subject, message);
-			t->Start();
-			return true;
+			return Queue(nc, subject, message);
 		}
 
 		return false;
@@ -97,10 +610,7 @@ bool Mail::Send(NickCore *nc, const Anope::string &subject, const Anope::string
 		return false;
 
 	nc->lastmail = Anope::CurTime;
-	Thread *t = new Mail::Message(b->Get<const Anope::string>("sendfrom"), nc->display, nc->email, subject, message);
-	t->Start();
-
-	return true;
+	return Queue(nc, subject, message);
 }
 
 /**
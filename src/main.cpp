@@ -15,6 +15,7 @@
 #include "bots.h"
 #include "socketengine.h"
 #include "uplink.h"
+#include "mail.h"
 
 #ifndef _WIN32
 #include <limits.h>
@@ -164,6 +165,8 @@ int main(int ac, char **av, char **envp)
 	{
 		Log(LOG_DEBUG_2) << "Top of main loop";
 
+		Serialize::NewGeneration();
+
 		/* Process timers */
 		if (Anope::CurTime - last_check >= Config->TimeoutCheck)
 		{
@@ -174,6 +177,12 @@ int main(int ac, char **av, char **envp)
 		/* Process the socket engine */
 		SocketEngine::Process();
 
+		/* Run the work deferred to the end of this iteration, such as sending stacked modes */
+		DeferredManager::RunAll();
+
+		/* Send replies which were waiting for room */
+		Uplink::SendQueued();
+
 		if (Anope::Signal)
 			Anope::HandleSignal();
 	}
@@ -194,6 +203,7 @@ int main(int ac, char **av, char **envp)
 	delete UplinkSock;
 
 	ModuleManager::UnloadAll();
+	Mail::Shutdown();
 	SocketEngine::Shutdown();
 	for (Module *m; (m = ModuleManager::FindFirstOf(PROTOCOL)) != NULL;)
 		ModuleManager::UnloadModule(m, NULL);
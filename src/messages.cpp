@@ -411,7 +411,7 @@ void Stats::Run(MessageSource &source, const std::vector<Anope::string> &params)
 	switch (params[0][0])
 	{
 		case 'l':
-			if (u->HasMode("OPER"))
+			if (u->HasMode(UMODE_OPER))
 			{
 				IRCD->SendNumeric(211, source.GetSource(), "Server SendBuf SentBytes SentMsgs RecvBuf RecvBytes RecvMsgs ConnTime");
 				IRCD->SendNumeric(211, source.GetSource(), "%s %d %d %d %d %d %d %ld", Config->Uplinks[Anope::CurrentUplink].host.c_str(), UplinkSock->WriteBufferLen(), TotalWritten, -1, UplinkSock->ReadBufferLen(), TotalRead, -1, static_cast<long>(Anope::CurTime - Anope::StartTime));
@@ -422,7 +422,7 @@ void Stats::Run(MessageSource &source, const std::vector<Anope::string> &params)
 		case 'o':
 		case 'O':
 			/* Check whether the user is an operator */
-			if (!u->HasMode("OPER") && Config->GetBlock("options")->Get<bool>("hidestatso"))
+			if (!u->HasMode(UMODE_OPER) && Config->GetBlock("options")->Get<bool>("hidestatso"))
 				IRCD->SendNumeric(219, source.GetSource(), "%c :End of /STATS report.", params[0][0]);
 			else
 			{
@@ -403,40 +403,103 @@ Anope::string Anope::Expires(time_t expires, const NickCore *nc)
 	}
 }
 
-bool Anope::Match(const Anope::string &str, const Anope::string &mask, bool case_sensitive, bool use_regex)
+Anope::RegexCacheCounters Anope::RegexCacheStats;
+
+namespace
 {
-	size_t s = 0, m = 0, str_len = str.length(), mask_len = mask.length();
+	/* How many compiled regexes Anope::Match keeps */
+	const size_t RegexCacheSize = 64;
 
-	if (use_regex && mask_len >= 2 && mask[0] == '/' && mask[mask.length() - 1] == '/')
+	typedef std::pair<RegexProvider *, Anope::string> RegexKey;
+	/* Most recently used first. Expressions which failed to compile are kept as NULL so they are not retried. */
+	typedef std::list<std::pair<RegexKey, Regex *> > RegexList;
+
+	struct RegexCache
 	{
-		Anope::string stripped_mask = mask.substr(1, mask_len - 2);
-		// This is often called with the same mask multiple times in a row, so cache it
-		static Regex *r = NULL;
+		RegexList lru;
+		std::map<RegexKey, RegexList::iterator> index;
+	};
 
-		if (r == NULL || r->GetExpression() != stripped_mask)
+	/* Not destroyed at exit, the regexes in it are freed when their providers are */
+	RegexCache &GetRegexCache()
+	{
+		static RegexCache *cache = new RegexCache();
+		return *cache;
+	}
+}
+
+RegexProvider::~RegexProvider()
+{
+	RegexCache &cache = GetRegexCache();
+
+	for (RegexList::iterator it = cache.lru.begin(); it != cache.lru.end();)
+	{
+		if (it->first.first != this)
 		{
-			ServiceReference<RegexProvider> provider("Regex", Config->GetBlock("options")->Get<const Anope::string>("regexengine"));
-			if (provider)
-			{
-				try
-				{
-					delete r;
-					r = NULL;
-					// This may throw
-					r = provider->Compile(stripped_mask);
-				}
-				catch (const RegexException &ex)
-				{
-					Log(LOG_DEBUG) << ex.GetReason();
-				}
-			}
-			else
-			{
-				delete r;
-				r = NULL;
-			}
+			++it;
+			continue;
 		}
 
+		delete it->second;
+		cache.index.erase(it->first);
+		it = cache.lru.erase(it);
+	}
+
+	Anope::RegexCacheStats.entries = cache.lru.size();
+}
+
+/* Finds the compiled form of expression from the configured regex engine, compiling it if it is not cached */
+static Regex *FindRegex(const Anope::string &expression)
+{
+	ServiceReference<RegexProvider> &provider = Config->RegexEngine;
+	if (!provider)
+		return NULL;
+
+	RegexCache &cache = GetRegexCache();
+	RegexKey key(*provider, expression);
+
+	std::map<RegexKey, RegexList::iterator>::iterator it = cache.index.find(key);
+	if (it != cache.index.end())
+	{
+		++Anope::RegexCacheStats.hits;
+		cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+		return it->second->second;
+	}
+
+	++Anope::RegexCacheStats.misses;
+
+	Regex *r = NULL;
+	try
+	{
+		// This may throw
+		r = provider->Compile(expression);
+	}
+	catch (const RegexException &ex)
+	{
+		Log(LOG_DEBUG) << ex.GetReason();
+	}
+
+	cache.lru.push_front(std::make_pair(key, r));
+	cache.index[key] = cache.lru.begin();
+
+	if (cache.lru.size() > RegexCacheSize)
+	{
+		delete cache.lru.back().second;
+		cache.index.erase(cache.lru.back().first);
+		cache.lru.pop_back();
+	}
+
+	Anope::RegexCacheStats.entries = cache.lru.size();
+	return r;
+}
+
+bool Anope::Match(const Anope::string &str, const Anope::string &mask, bool case_sensitive, bool use_regex)
+{
+	size_t s = 0, m = 0, str_len = str.length(), mask_len = mask.length();
+
+	if (use_regex && mask_len >= 2 && mask[0] == '/' && mask[mask.length() - 1] == '/')
+	{
+		Regex *r = FindRegex(mask.substr(1, mask_len - 2));
 		if (r != NULL && r->Matches(str))
 			return true;
 
@@ -30,8 +30,59 @@ static std::vector<UserMode *> UserModes;
 static std::vector<ChannelMode *> ChannelModesIdx;
 static std::vector<UserMode *> UserModesIdx;
 
-static std::map<Anope::string, ChannelMode *> ChannelModesByName;
-static std::map<Anope::string, UserMode *> UserModesByName;
+/* Mode IDs by name, and the names and (loaded) modes by ID.
+ * Names are never forgotten so an ID always refers to the same mode name.
+ */
+template<typename T> struct ModeIDTable
+{
+	typedef TR1NS::unordered_map<Anope::string, unsigned, Anope::hash_cs> id_map;
+	id_map ids;
+	std::vector<Anope::string> names;
+	std::vector<T *> modes;
+
+	ModeIDTable(const char *const *known)
+	{
+		for (; *known; ++known)
+			this->GetID(*known, true);
+	}
+
+	unsigned GetID(const Anope::string &name, bool create)
+	{
+		typename id_map::const_iterator it = this->ids.find(name);
+		if (it != this->ids.end())
+			return it->second;
+		if (!create)
+			return ModeManager::NO_MODE_ID;
+
+		unsigned id = this->names.size();
+		this->ids[name] = id;
+		this->names.push_back(name);
+		this->modes.push_back(NULL);
+		return id;
+	}
+
+	const Anope::string &GetName(unsigned id) const
+	{
+		static const Anope::string empty;
+		if (id >= this->names.size())
+			return empty;
+		return this->names[id];
+	}
+
+	T *Find(unsigned id) const
+	{
+		if (id >= this->modes.size())
+			return NULL;
+		return this->modes[id];
+	}
+};
+
+/* These must be in the same order as ChannelModeID and UserModeID */
+static const char *const KnownChannelModes[] = { "BAN", "EXCEPT", "INVITEOVERRIDE", "LBAN", "PERM", "VOICE", "OP", NULL };
+static const char *const KnownUserModes[] = { "OPER", "CLOAK", "VHOST", "PROTECTED", "GOD", NULL };
+
+static ModeIDTable<ChannelMode> ChannelModeIDs(KnownChannelModes);
+static ModeIDTable<UserMode> UserModeIDs(KnownUserModes);
 
 /* Sorted by status */
 static std::vector<ChannelModeStatus *> ChannelModesByStatus;
@@ -114,7 +165,7 @@ Anope::string ChannelStatus::BuildModePrefixList() const
 	return ret;
 }
 
-Mode::Mode(const Anope::string &mname, ModeClass mcl, char mch, ModeType mt) : name(mname), mclass(mcl), mchar(mch), type(mt)
+Mode::Mode(const Anope::string &mname, ModeClass mcl, char mch, ModeType mt) : name(mname), mclass(mcl), mchar(mch), type(mt), id(ModeManager::NO_MODE_ID)
 {
 }
 
@@ -176,7 +227,7 @@ ChannelModeList::ChannelModeList(const Anope::string &cm, char mch) : ChannelMod
 
 bool ChannelModeList::IsValid(Anope::string &mask) const
 {
-	if (name == "BAN" || name == "EXCEPT" || name == "INVITEOVERRIDE")
+	if (id == CMODE_BAN || id == CMODE_EXCEPT || id == CMODE_INVITEOVERRIDE)
 		mask = IRCD->NormalizeMask(mask);
 	return true;
 }
@@ -233,7 +284,7 @@ template class ChannelModeVirtual<ChannelModeList>;
 
 bool UserModeOperOnly::CanSet(User *u) const
 {
-	return u && u->HasMode("OPER");
+	return u && u->HasMode(UMODE_OPER);
 }
 
 bool UserModeNoone::CanSet(User *u) const
@@ -251,7 +302,7 @@ bool ChannelModeKey::IsValid(Anope::string &value) const
 
 bool ChannelModeOperOnly::CanSet(User *u) const
 {
-	return u && u->HasMode("OPER");
+	return u && u->HasMode(UMODE_OPER);
 }
 
 bool ChannelModeNoone::CanSet(User *u) const
@@ -310,14 +361,15 @@ void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
 	list->push_back(std::make_pair(mode, param));
 }
 
-static class ModePipe : public Pipe
+/** Sends the stacked modes once at the end of the iteration of the main loop they were stacked in */
+static class ModeFlush : public Deferred
 {
  public:
-	void OnNotify()
+	void Run() anope_override
 	{
 		ModeManager::ProcessModes();
 	}
-} *modePipe;
+} *modeFlush;
 
 /** Get the stacker info for an item, if one doesn't exist it is created
  * @param Item The user/channel etc
@@ -409,7 +461,8 @@ bool ModeManager::AddUserMode(UserMode *um)
 		UserModesIdx.resize(want + 1);
 	UserModesIdx[want] = um;
 
-	UserModesByName[um->name] = um;
+	um->id = UserModeIDs.GetID(um->name, true);
+	UserModeIDs.modes[um->id] = um;
 
 	UserModes.push_back(um);
 
@@ -450,7 +503,8 @@ bool ModeManager::AddChannelMode(ChannelMode *cm)
 		RebuildStatusModes();
 	}
 
-	ChannelModesByName[cm->name] = cm;
+	cm->id = ChannelModeIDs.GetID(cm->name, true);
+	ChannelModeIDs.modes[cm->id] = cm;
 
 	ChannelModes.push_back(cm);
 
@@ -476,7 +530,8 @@ void ModeManager::RemoveUserMode(UserMode *um)
 
 	UserModesIdx[want] = NULL;
 
-	UserModesByName.erase(um->name);
+	if (UserModeIDs.Find(um->id) == um)
+		UserModeIDs.modes[um->id] = NULL;
 
 	std::vector<UserMode *>::iterator it = std::find(UserModes.begin(), UserModes.end(), um);
 	if (it != UserModes.end())
@@ -518,7 +573,8 @@ void ModeManager::RemoveChannelMode(ChannelMode *cm)
 		RebuildStatusModes();
 	}
 
-	ChannelModesByName.erase(cm->name);
+	if (ChannelModeIDs.Find(cm->id) == cm)
+		ChannelModeIDs.modes[cm->id] = NULL;
 
 	std::vector<ChannelMode *>::iterator it = std::find(ChannelModes.begin(), ChannelModes.end(), cm);
 	if (it != ChannelModes.end())
@@ -527,6 +583,36 @@ void ModeManager::RemoveChannelMode(ChannelMode *cm)
 	StackerDel(cm);
 }
 
+unsigned ModeManager::GetChannelModeID(const Anope::string &name, bool create)
+{
+	return ChannelModeIDs.GetID(name, create);
+}
+
+const Anope::string &ModeManager::GetChannelModeName(unsigned id)
+{
+	return ChannelModeIDs.GetName(id);
+}
+
+ChannelMode *ModeManager::FindChannelModeByID(unsigned id)
+{
+	return ChannelModeIDs.Find(id);
+}
+
+unsigned ModeManager::GetUserModeID(const Anope::string &name, bool create)
+{
+	return UserModeIDs.GetID(name, create);
+}
+
+const Anope::string &ModeManager::GetUserModeName(unsigned id)
+{
+	return UserModeIDs.GetName(id);
+}
+
+UserMode *ModeManager::FindUserModeByID(unsigned id)
+{
+	return UserModeIDs.Find(id);
+}
+
 ChannelMode *ModeManager::FindChannelModeByChar(char mode)
 {
 	unsigned want = mode;
@@ -547,18 +633,12 @@ UserMode *ModeManager::FindUserModeByChar(char mode)
 
 ChannelMode *ModeManager::FindChannelModeByName(const Anope::string &name)
 {
-	std::map<Anope::string, ChannelMode *>::iterator it = ChannelModesByName.find(name);
-	if (it != ChannelModesByName.end())
-		return it->second;
-	return NULL;
+	return ChannelModeIDs.Find(ChannelModeIDs.GetID(name, false));
 }
 
 UserMode *ModeManager::FindUserModeByName(const Anope::string &name)
 {
-	std::map<Anope::string, UserMode *>::iterator it = UserModesByName.find(name);
-	if (it != UserModesByName.end())
-		return it->second;
-	return NULL;
+	return UserModeIDs.Find(UserModeIDs.GetID(name, false));
 }
 
 char ModeManager::GetStatusChar(char value)
@@ -619,9 +699,9 @@ void ModeManager::StackerAdd(BotInfo *bi, Channel *c, ChannelMode *cm, bool Set,
 	else
 		s->bi = c->ci->WhoSends();
 
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
+	if (!modeFlush)
+		modeFlush = new ModeFlush();
+	modeFlush->Post();
 }
 
 void ModeManager::StackerAdd(BotInfo *bi, User *u, UserMode *um, bool Set, const Anope::string &Param)
@@ -631,9 +711,9 @@ void ModeManager::StackerAdd(BotInfo *bi, User *u, UserMode *um, bool Set, const
 	if (bi)
 		s->bi = bi;
 
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
+	if (!modeFlush)
+		modeFlush = new ModeFlush();
+	modeFlush->Post();
 }
 
 void ModeManager::ProcessModes()
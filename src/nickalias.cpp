@@ -19,6 +19,7 @@
 #include "config.h"
 
 Serialize::Checker<nickalias_map> NickAliasList("NickAlias");
+Anope::map<NickAlias *> SortedNickAliasList;
 
 NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serializable("NickAlias")
 {
@@ -34,6 +35,7 @@ NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serial
 
 	size_t old = NickAliasList->size();
 	(*NickAliasList)[this->nick] = this;
+	SortedNickAliasList[this->nick] = this;
 	if (old == NickAliasList->size())
 		Log(LOG_DEBUG) << "Duplicate nick " << nickname << " in nickalias table";
 
@@ -76,6 +78,7 @@ NickAlias::~NickAlias()
 
 	/* Remove us from the aliases list */
 	NickAliasList->erase(this->nick);
+	SortedNickAliasList.erase(this->nick);
 }
 
 void NickAlias::SetVhost(const Anope::string &ident, const Anope::string &host, const Anope::string &creator, time_t created)
@@ -12,10 +12,14 @@
 #include "services.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "threadengine.h"
 
 #ifndef _WIN32
 #include <fcntl.h>
 #endif
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 
 Pipe::Pipe() : Socket(-1), write_pipe(-1)
 {
@@ -78,3 +82,71 @@ void Pipe::Notify()
 {
 	this->Write("\0", 1);
 }
+
+Notifier::Notifier() : Socket(-1), write_fd(-1), pending(0)
+{
+#ifdef HAVE_EVENTFD
+	int read_fd = eventfd(0, EFD_NONBLOCK);
+	if (read_fd < 0)
+		throw CoreException("Could not create eventfd: " + Anope::LastError());
+	int wfd = read_fd;
+#else
+	int fds[2];
+	if (pipe(fds))
+		throw CoreException("Could not create pipe: " + Anope::LastError());
+	int sflags = fcntl(fds[0], F_GETFL, 0);
+	fcntl(fds[0], F_SETFL, sflags | O_NONBLOCK);
+	sflags = fcntl(fds[1], F_GETFL, 0);
+	fcntl(fds[1], F_SETFL, sflags | O_NONBLOCK);
+	int read_fd = fds[0], wfd = fds[1];
+#endif
+
+	SocketEngine::Change(this, false, SF_READABLE);
+	SocketEngine::Change(this, false, SF_WRITABLE);
+	anope_close(this->sock);
+	this->io->Destroy();
+	SocketEngine::Sockets.erase(this->sock);
+
+	this->sock = read_fd;
+	this->write_fd = wfd;
+
+	SocketEngine::Sockets[this->sock] = this;
+	SocketEngine::Change(this, true, SF_READABLE);
+}
+
+Notifier::~Notifier()
+{
+	if (this->write_fd >= 0 && this->write_fd != this->sock)
+		anope_close(this->write_fd);
+}
+
+bool Notifier::ProcessRead()
+{
+#ifdef HAVE_EVENTFD
+	eventfd_t count;
+	eventfd_read(this->GetFD(), &count);
+#else
+	char dummy[512];
+	while (read(this->GetFD(), dummy, 512) == 512);
+#endif
+
+	/* Clear only after draining, so a notification made from now on writes again. One made
+	 * before this is for work already queued, which OnNotify picks up below.
+	 */
+	Atomic::Exchange(&this->pending, 0L);
+
+	this->OnNotify();
+	return true;
+}
+
+void Notifier::Notify()
+{
+	if (Atomic::Exchange(&this->pending, 1L))
+		return;
+
+#ifdef HAVE_EVENTFD
+	eventfd_write(this->write_fd, 1);
+#else
+	write(this->write_fd, "\0", 1);
+#endif
+}
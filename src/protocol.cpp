@@ -435,7 +435,7 @@ void IRCDProto::SendOper(User *u)
 
 unsigned IRCDProto::GetMaxListFor(Channel *c)
 {
-	return c->HasMode("LBAN") ? 0 : Config->GetBlock("networkinfo")->Get<int>("modelistsize");
+	return c->HasMode(CMODE_LBAN) ? 0 : Config->GetBlock("networkinfo")->Get<int>("modelistsize");
 }
 
 Anope::string IRCDProto::NormalizeMask(const Anope::string &mask)
@@ -450,8 +450,11 @@ MessageSource::MessageSource(const Anope::string &src) : source(src), u(NULL), s
 	/* no source for incoming message is our uplink */
 	if (src.empty())
 		this->s = Servers::GetUplink();
-	else if (IRCD->RequiresID || src.find('.') != Anope::string::npos)
-		this->s = Server::Find(src);
+	/* Server names always contain a '.', and IDs never do */
+	else if (src.find('.') != Anope::string::npos)
+		this->s = Server::Find(src, true);
+	else if (IRCD->RequiresID)
+		this->s = Servers::ByID.Find(src);
 	if (this->s == NULL)
 		this->u = User::Find(src);
 }
@@ -20,6 +20,7 @@
 #include "servers.h"
 
 Serialize::Checker<registered_channel_map> RegisteredChannelList("ChannelInfo");
+Anope::map<ChannelInfo *> SortedRegisteredChannelList;
 
 AutoKick::AutoKick() : Serializable("AutoKick")
 {
@@ -118,6 +119,7 @@ ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInf
 
 	size_t old = RegisteredChannelList->size();
 	(*RegisteredChannelList)[this->name] = this;
+	SortedRegisteredChannelList[this->name] = this;
 	if (old == RegisteredChannelList->size())
 		Log(LOG_DEBUG) << "Duplicate channel " << this->name << " in registered channel table?";
 
@@ -163,6 +165,7 @@ ChannelInfo::~ChannelInfo()
 	}
 
 	RegisteredChannelList->erase(this->name);
+	SortedRegisteredChannelList.erase(this->name);
 
 	this->SetFounder(NULL);
 	this->SetSuccessor(NULL);
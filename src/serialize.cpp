@@ -24,6 +24,10 @@ using namespace Serialize;
 std::vector<Anope::string> Type::TypeOrder;
 std::map<Anope::string, Type *> Serialize::Type::Types;
 std::list<Serializable *> *Serializable::SerializableItems;
+Serialize::Counters Serialize::Stats;
+
+/* Generations start at 1 so new objects and types are never considered up to date */
+static uint64_t Generation = 1;
 
 void Serialize::RegisterTypes()
 {
@@ -32,6 +36,11 @@ void Serialize::RegisterTypes()
 		akick("AutoKick", AutoKick::Unserialize), memo("Memo", Memo::Unserialize), xline("XLine", XLine::Unserialize);
 }
 
+void Serialize::NewGeneration()
+{
+	++Generation;
+}
+
 void Serialize::CheckTypes()
 {
 	for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
@@ -41,7 +50,7 @@ void Serialize::CheckTypes()
 	}
 }
 
-Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), id(0), redis_ignore(0)
+Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), update_generation(0), id(0), redis_ignore(0)
 {
 	if (SerializableItems == NULL)
 		SerializableItems = new std::list<Serializable *>();
@@ -55,7 +64,7 @@ Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0)
 	FOREACH_MOD(OnSerializableConstruct, (this));
 }
 
-Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), id(0), redis_ignore(0)
+Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), update_generation(0), id(0), redis_ignore(0)
 {
 	SerializableItems->push_back(this);
 	this->s_iter = SerializableItems->end();
@@ -80,11 +89,20 @@ Serializable &Serializable::operator=(const Serializable &)
 
 void Serializable::QueueUpdate()
 {
+	if (this->update_generation == Generation)
+	{
+		++Stats.updates_skipped;
+		return;
+	}
+	this->update_generation = Generation;
+	++Stats.updates;
+
 	/* Schedule updater */
 	FOREACH_MOD(OnSerializableUpdate, (this));
 
 	/* Check for modifications now - this can delete this object! */
-	FOREACH_MOD(OnSerializeCheck, (this->GetSerializableType()));
+	if (this->s_type)
+		this->s_type->Check();
 }
 
 bool Serializable::IsCached(Serialize::Data &data)
@@ -112,7 +130,7 @@ const std::list<Serializable *> &Serializable::GetItems()
 	return *SerializableItems;
 }
 
-Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), unserialize(f), owner(o), timestamp(0)
+Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), unserialize(f), owner(o), timestamp(0), check_generation(0)
 {
 	TypeOrder.push_back(this->name);
 	Types[this->name] = this;
@@ -145,6 +163,14 @@ Serializable *Type::Unserialize(Serializable *obj, Serialize::Data &data)
 
 void Type::Check()
 {
+	if (this->check_generation == Generation)
+	{
+		++Stats.checks_skipped;
+		return;
+	}
+	this->check_generation = Generation;
+	++Stats.checks;
+
 	FOREACH_MOD(OnSerializeCheck, (this));
 }
 
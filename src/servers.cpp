@@ -23,7 +23,7 @@
 Server *Me = NULL;
 
 Anope::map<Server *> Servers::ByName;
-Anope::map<Server *> Servers::ByID;
+Anope::IDMap<Server *> Servers::ByID;
 
 std::set<Anope::string> Servers::Capab;
 
@@ -35,7 +35,7 @@ Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Ano
 
 	Servers::ByName[sname] = this;
 	if (!ssid.empty())
-		Servers::ByID[ssid] = this;
+		Servers::ByID.Insert(ssid, this);
 
 	Log(this, "connect") << "has connected to the network (uplinked to " << (this->uplink ? this->uplink->GetName() : "no uplink") << ")";
 
@@ -160,7 +160,7 @@ Server::~Server()
 
 	Servers::ByName.erase(this->name);
 	if (!this->sid.empty())
-		Servers::ByID.erase(this->sid);
+		Servers::ByID.Erase(this->sid);
 }
 
 void Server::Delete(const Anope::string &reason)
@@ -196,7 +196,7 @@ void Server::SetSID(const Anope::string &nsid)
 	if (!this->sid.empty())
 		throw CoreException("Server already has an id?");
 	this->sid = nsid;
-	Servers::ByID[nsid] = this;
+	Servers::ByID.Insert(nsid, this);
 }
 
 const Anope::string &Server::GetSID() const
@@ -335,16 +335,14 @@ void Server::Notice(BotInfo *source, const Anope::string &message)
 
 Server *Server::Find(const Anope::string &name, bool name_only)
 {
-	Anope::map<Server *>::iterator it;
-
 	if (!name_only)
 	{
-		it = Servers::ByID.find(name);
-		if (it != Servers::ByID.end())
-			return it->second;
+		Server *s = Servers::ByID.Find(name);
+		if (s)
+			return s;
 	}
 
-	it = Servers::ByName.find(name);
+	Anope::map<Server *>::iterator it = Servers::ByName.find(name);
 	if (it != Servers::ByName.end())
 		return it->second;
 
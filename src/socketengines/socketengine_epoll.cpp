@@ -75,7 +75,7 @@ void SocketEngine::Process()
 	if (Sockets.size() > events.size())
 		events.resize(events.size() * 2);
 
-	int total = epoll_wait(EngineHandle, &events.front(), events.size(), Config->ReadTimeout * 1000);
+	int total = epoll_wait(EngineHandle, &events.front(), events.size(), SocketEngine::GetTimeout() * 1000);
 	Anope::CurTime = time(NULL);
 
 	/* EINTR can be given if the read timeout expires */
@@ -99,7 +99,7 @@ void SocketEngine::Change(Socket *s, bool set, SocketFlag flag)
 
 void SocketEngine::Process()
 {
-	int total = poll(&events.front(), events.size(), Config->ReadTimeout * 1000);
+	int total = poll(&events.front(), events.size(), SocketEngine::GetTimeout() * 1000);
 	Anope::CurTime = time(NULL);
 
 	/* EINTR can be given if the read timeout expires */
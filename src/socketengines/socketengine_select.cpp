@@ -85,7 +85,7 @@ void SocketEngine::Process()
 {
 	fd_set rfdset = ReadFDs, wfdset = WriteFDs, efdset = ReadFDs;
 	timeval tval;
-	tval.tv_sec = Config->ReadTimeout;
+	tval.tv_sec = SocketEngine::GetTimeout();
 	tval.tv_usec = 0;
 
 #ifdef _WIN32
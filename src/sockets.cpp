@@ -13,6 +13,8 @@
 #include "sockets.h"
 #include "socketengine.h"
 #include "logger.h"
+#include "config.h"
+#include "uplink.h"
 
 #ifndef _WIN32
 #include <arpa/inet.h>
@@ -584,6 +586,13 @@ bool ListenSocket::ProcessRead()
 	return true;
 }
 
+time_t SocketEngine::GetTimeout()
+{
+	if (Uplink::HasQueued() && Config->ReadTimeout > 1)
+		return 1;
+	return Config->ReadTimeout;
+}
+
 int SocketEngine::GetLastError()
 {
 #ifndef _WIN32
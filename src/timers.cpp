@@ -10,6 +10,7 @@
 #include "timers.h"
 
 std::multimap<time_t, Timer *> TimerManager::Timers;
+std::vector<Deferred *> DeferredManager::Queue;
 
 Timer::Timer(long time_from_now, time_t now, bool repeating)
 {
@@ -124,3 +125,56 @@ void TimerManager::DeleteTimersFor(Module *m)
 			delete it->second;
 	}
 }
+
+Deferred::Deferred() : posted(false)
+{
+}
+
+Deferred::~Deferred()
+{
+	if (this->posted)
+		DeferredManager::Del(this);
+}
+
+void Deferred::Post()
+{
+	if (this->posted)
+		return;
+
+	this->posted = true;
+	DeferredManager::Add(this);
+}
+
+bool Deferred::IsPosted() const
+{
+	return this->posted;
+}
+
+void DeferredManager::Add(Deferred *d)
+{
+	Queue.push_back(d);
+}
+
+void DeferredManager::Del(Deferred *d)
+{
+	std::vector<Deferred *>::iterator it = std::find(Queue.begin(), Queue.end(), d);
+	if (it != Queue.end())
+		*it = NULL;
+}
+
+void DeferredManager::RunAll()
+{
+	/* Run by index, as work may post more work or delete other work */
+	for (unsigned i = 0; i < Queue.size(); ++i)
+	{
+		Deferred *d = Queue[i];
+		if (d == NULL)
+			continue;
+
+		Queue[i] = NULL;
+		d->posted = false;
+		d->Run();
+	}
+
+	Queue.clear();
+}
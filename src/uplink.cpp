@@ -14,9 +14,102 @@
 #include "config.h"
 #include "protocol.h"
 #include "servers.h"
+#include "users.h"
+#include "bots.h"
 
 UplinkSocket *UplinkSock = NULL;
 
+namespace
+{
+	/* Replies are held back while the uplink has this much waiting to be written,
+	 * so protocol messages are not stuck behind them
+	 */
+	const int MaxUplinkBacklog = 16384;
+	/* Replies to one user past this many lines or bytes are dropped, so a user flooding
+	 * commands can not make the queue grow without bound
+	 */
+	const size_t MaxQueuedLines = 500;
+	const size_t MaxQueuedBytes = 65536;
+
+	struct QueuedReply
+	{
+		Reference<BotInfo> source;
+		Anope::string msg;
+		bool privmsg;
+	};
+
+	struct ReplyQueue
+	{
+		std::deque<QueuedReply> replies;
+		/* Bytes of the queued replies */
+		size_t bytes;
+		/* Lines sent to the user this second */
+		time_t second;
+		unsigned lines;
+
+		ReplyQueue() : bytes(0), second(0), lines(0) { }
+	};
+
+	/* Queues by user, rather than by UID which is the nick on some IRCds and so can
+	 * pass to another user. Users only have one while they have queued replies or
+	 * were sent a reply this second, and it is removed when the user is deleted.
+	 */
+	std::map<User *, ReplyQueue> reply_queues;
+	/* Users with queued replies, in the order they take turns */
+	std::deque<User *> reply_turns;
+	/* Lines and bytes sent to all users this second */
+	time_t output_second = 0;
+	unsigned output_lines = 0, output_bytes = 0;
+	time_t queues_checked = 0;
+	Uplink::OutputStats output_stats;
+
+	/** Check whether there is room to send a line to a user this second */
+	bool HasRoom(ReplyQueue &q, size_t len)
+	{
+		if (output_second != Anope::CurTime)
+		{
+			output_second = Anope::CurTime;
+			output_lines = output_bytes = 0;
+		}
+		if (q.second != Anope::CurTime)
+		{
+			q.second = Anope::CurTime;
+			q.lines = 0;
+		}
+
+		if (UplinkSock && UplinkSock->WriteBufferLen() >= MaxUplinkBacklog)
+			return false;
+		if (Config->OutputLines && output_lines >= Config->OutputLines)
+			return false;
+		/* A line longer than the whole budget is let through at the start of a second */
+		if (Config->OutputBytes && output_bytes && output_bytes + len > Config->OutputBytes)
+			return false;
+		return !Config->TargetLines || q.lines < Config->TargetLines;
+	}
+
+	void Send(ReplyQueue &q, BotInfo *source, User *target, const Anope::string &msg, bool privmsg)
+	{
+		++q.lines;
+		++output_lines;
+		output_bytes += msg.length();
+
+		/* Resolved now, as the UID may be a nick which changed since the reply was queued */
+		if (privmsg)
+			IRCD->SendPrivmsg(source, target->GetUID(), "%s", msg.c_str());
+		else
+			IRCD->SendNotice(source, target->GetUID(), "%s", msg.c_str());
+	}
+
+	void ClearReplies()
+	{
+		for (std::map<User *, ReplyQueue>::iterator it = reply_queues.begin(), it_end = reply_queues.end(); it != it_end; ++it)
+			output_stats.dropped += it->second.replies.size();
+		reply_queues.clear();
+		reply_turns.clear();
+		output_stats.lines = output_stats.bytes = 0;
+	}
+}
+
 class ReconnectTimer : public Timer
 {
  public:
@@ -57,6 +150,115 @@ void Uplink::Connect()
 	UplinkSock->Connect(ip, u.port);
 }
 
+void Uplink::SendReply(BotInfo *source, User *target, const Anope::string &msg, bool privmsg)
+{
+	ReplyQueue &q = reply_queues[target];
+
+	/* Replies to a user are sent in order, so nothing may overtake the ones already queued */
+	if (q.replies.empty() && HasRoom(q, msg.length()))
+	{
+		Send(q, source, target, msg, privmsg);
+		return;
+	}
+
+	if (q.replies.size() >= MaxQueuedLines || q.bytes + msg.length() > MaxQueuedBytes)
+	{
+		++output_stats.dropped;
+		return;
+	}
+
+	if (q.replies.empty())
+		reply_turns.push_back(target);
+
+	QueuedReply r;
+	r.source = source;
+	r.msg = msg;
+	r.privmsg = privmsg;
+	q.replies.push_back(r);
+	q.bytes += msg.length();
+
+	++output_stats.lines;
+	output_stats.bytes += msg.length();
+	++output_stats.delayed;
+}
+
+void Uplink::SendQueued()
+{
+	/* Each user with queued replies is sent one line per turn. A full round
+	 * without anything sent means there is no room left this second.
+	 */
+	for (size_t idle = 0; !reply_turns.empty() && idle < reply_turns.size();)
+	{
+		User *u = reply_turns.front();
+		reply_turns.pop_front();
+
+		std::map<User *, ReplyQueue>::iterator it = reply_queues.find(u);
+		if (it == reply_queues.end() || it->second.replies.empty())
+			continue;
+		ReplyQueue &q = it->second;
+
+		QueuedReply &r = q.replies.front();
+		if (!HasRoom(q, r.msg.length()))
+		{
+			reply_turns.push_back(u);
+			++idle;
+			continue;
+		}
+
+		Send(q, r.source, u, r.msg, r.privmsg);
+		--output_stats.lines;
+		output_stats.bytes -= r.msg.length();
+		q.bytes -= r.msg.length();
+		q.replies.pop_front();
+		idle = 0;
+
+		if (!q.replies.empty())
+			reply_turns.push_back(u);
+	}
+
+	/* Once a second, forget users which have nothing queued and were only sent replies in earlier seconds */
+	if (queues_checked != Anope::CurTime)
+	{
+		queues_checked = Anope::CurTime;
+		for (std::map<User *, ReplyQueue>::iterator it = reply_queues.begin(), it_end = reply_queues.end(); it != it_end;)
+		{
+			if (it->second.replies.empty() && it->second.second != Anope::CurTime)
+				reply_queues.erase(it++);
+			else
+				++it;
+		}
+	}
+}
+
+void Uplink::DropReplies(User *u)
+{
+	std::map<User *, ReplyQueue>::iterator it = reply_queues.find(u);
+	if (it == reply_queues.end())
+		return;
+
+	ReplyQueue &q = it->second;
+	output_stats.lines -= q.replies.size();
+	output_stats.bytes -= q.bytes;
+	output_stats.dropped += q.replies.size();
+	reply_queues.erase(it);
+
+	std::deque<User *>::iterator turn = std::find(reply_turns.begin(), reply_turns.end(), u);
+	if (turn != reply_turns.end())
+		reply_turns.erase(turn);
+}
+
+bool Uplink::HasQueued()
+{
+	return !reply_turns.empty();
+}
+
+Uplink::OutputStats Uplink::GetOutputStats()
+{
+	Uplink::OutputStats s = output_stats;
+	s.targets = reply_turns.size();
+	return s;
+}
+
 UplinkSocket::UplinkSocket() : Socket(-1, Config->Uplinks[Anope::CurrentUplink].ipv6), ConnectionSocket(), BufferedSocket()
 {
 	error = false;
@@ -103,6 +305,7 @@ UplinkSocket::~UplinkSocket()
 			Me->GetLinks()[i - 1]->Delete(Me->GetName() + " " + Me->GetLinks()[i - 1]->GetName());
 
 	UplinkSock = NULL;
+	ClearReplies();
 
 	Me->Unsync();
 
@@ -134,6 +337,9 @@ bool UplinkSocket::ProcessRead()
 	for (Anope::string buf; (buf = this->GetLine()).empty() == false;)
 	{
 		Anope::Process(buf);
+		/* Quit users and empty channels can still be found until they are deleted,
+		 * so they are deleted before the next line can reuse their names
+		 */
 		User::QuitUsers();
 		Channel::DeleteChannels();
 	}
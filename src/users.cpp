@@ -23,7 +23,8 @@
 #include "sockets.h"
 #include "uplink.h"
 
-user_map UserListByNick, UserListByUID;
+user_map UserListByNick;
+Anope::IDMap<User *> UserListByUID;
 
 int OperCount = 0;
 unsigned MaxUserCount = 0;
@@ -31,6 +32,16 @@ time_t MaxUserTime = 0;
 
 std::list<User *> User::quitting_users;
 
+/** Deletes the users which quit outside of processing the uplink, which deletes them after every line */
+static class QuitUsersWork : public Deferred
+{
+ public:
+	void Run() anope_override
+	{
+		User::QuitUsers();
+	}
+} *quitUsersWork;
+
 User::User(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &uip, Server *sserver, const Anope::string &srealname, time_t ts, const Anope::string &smodes, const Anope::string &suid, NickCore *account) : ip(uip)
 {
 	if (snick.empty() || sident.empty() || shost.empty())
@@ -41,6 +52,7 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 	server = NULL;
 	invalid_pw_count = invalid_pw_time = lastmemosend = lastnickreg = lastmail = 0;
 	on_access = false;
+	modes_view_dirty = false;
 
 	this->nick = snick;
 	this->ident = sident;
@@ -58,7 +70,7 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 	size_t old = UserListByNick.size();
 	UserListByNick[snick] = this;
 	if (!suid.empty())
-		UserListByUID[suid] = this;
+		UserListByUID.Insert(suid, this);
 	if (old == UserListByNick.size())
 		Log(LOG_DEBUG) << "Duplicate user " << snick << " in user table?";
 
@@ -202,7 +214,7 @@ const Anope::string &User::GetDisplayedHost() const
 {
 	if (!this->vhost.empty())
 		return this->vhost;
-	else if (this->HasMode("CLOAK") && !this->GetCloakedHost().empty())
+	else if (this->HasMode(UMODE_CLOAK) && !this->GetCloakedHost().empty())
 		return this->GetCloakedHost();
 	else
 		return this->host;
@@ -302,9 +314,10 @@ User::~User()
 	FOREACH_MOD(OnPreUserLogoff, (this));
 
 	ModeManager::StackerDel(this);
+	Uplink::DropReplies(this);
 	this->Logout();
 
-	if (this->HasMode("OPER"))
+	if (this->HasMode(UMODE_OPER))
 		--OperCount;
 
 	while (!this->chans.empty())
@@ -312,7 +325,7 @@ User::~User()
 
 	UserListByNick.erase(this->nick);
 	if (!this->uid.empty())
-		UserListByUID.erase(this->uid);
+		UserListByUID.Erase(this->uid);
 
 	FOREACH_MOD(OnPostUserLogoff, (this));
 }
@@ -344,12 +357,7 @@ void User::SendMessage(BotInfo *source, const Anope::string &msg)
 	bool send_privmsg = Config->UsePrivmsg && ((!this->nc && Config->DefPrivmsg) || (this->nc && this->nc->HasExt("MSG")));
 	sepstream sep(translated_message, '\n', true);
 	for (Anope::string tok; sep.GetToken(tok);)
-	{
-		if (send_privmsg)
-			IRCD->SendPrivmsg(source, this->GetUID(), "%s", tok.c_str());
-		else
-			IRCD->SendNotice(source, this->GetUID(), "%s", tok.c_str());
-	}
+		Uplink::SendReply(source, this, tok, send_privmsg);
 }
 
 void User::Identify(NickAlias *na)
@@ -374,8 +382,8 @@ void User::Identify(NickAlias *na)
 		{
 			this->SetModes(NULL, "%s", this->nc->o->ot->modes.c_str());
 			this->SendMessage(NULL, "Changing your usermodes to \002%s\002", this->nc->o->ot->modes.c_str());
-			UserMode *um = ModeManager::FindUserModeByName("OPER");
-			if (um && !this->HasMode("OPER") && this->nc->o->ot->modes.find(um->mchar) != Anope::string::npos)
+			UserMode *um = ModeManager::FindUserModeByID(UMODE_OPER);
+			if (um && !this->HasMode(UMODE_OPER) && this->nc->o->ot->modes.find(um->mchar) != Anope::string::npos)
 				IRCD->SendOper(this);
 		}
 		if (IRCD->CanSetVHost && !this->nc->o->vhost.empty())
@@ -453,7 +461,7 @@ bool User::IsServicesOper()
 	if (!this->nc || !this->nc->IsServicesOper())
 		// No opertype.
 		return false;
-	else if (this->nc->o->require_oper && !this->HasMode("OPER"))
+	else if (this->nc->o->require_oper && !this->HasMode(UMODE_OPER))
 		return false;
 	else if (!this->nc->o->certfp.empty() && this->fingerprint != this->nc->o->certfp)
 		// Certfp mismatch
@@ -514,7 +522,13 @@ void User::UpdateHost()
 
 bool User::HasMode(const Anope::string &mname) const
 {
-	return this->modes.count(mname);
+	unsigned id = ModeManager::GetUserModeID(mname);
+	return id < this->modes.size() && this->modes[id];
+}
+
+bool User::HasMode(UserModeID id) const
+{
+	return static_cast<unsigned>(id) < this->modes.size() && this->modes[id];
 }
 
 void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anope::string &param)
@@ -522,9 +536,20 @@ void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anop
 	if (!um)
 		return;
 
-	this->modes[um->name] = param;
+	unsigned id = um->id != ModeManager::NO_MODE_ID ? um->id : ModeManager::GetUserModeID(um->name, true);
+	if (id >= this->modes.size())
+		this->modes.resize(id + 1);
+	this->modes[id] = true;
+
+	unsigned i = 0;
+	for (; i < this->mode_params.size() && this->mode_params[i].first != id; ++i);
+	if (i < this->mode_params.size())
+		this->mode_params[i].second = param;
+	else if (!param.empty())
+		this->mode_params.push_back(std::make_pair(id, param));
+	this->modes_view_dirty = true;
 
-	if (um->name == "OPER")
+	if (id == UMODE_OPER)
 	{
 		++OperCount;
 
@@ -534,8 +559,8 @@ void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anop
 			{
 				this->SetModes(NULL, "%s", this->nc->o->ot->modes.c_str());
 				this->SendMessage(NULL, "Changing your usermodes to \002%s\002", this->nc->o->ot->modes.c_str());
-				UserMode *oper = ModeManager::FindUserModeByName("OPER");
-				if (oper && !this->HasMode("OPER") && this->nc->o->ot->modes.find(oper->mchar) != Anope::string::npos)
+				UserMode *oper = ModeManager::FindUserModeByID(UMODE_OPER);
+				if (oper && !this->HasMode(UMODE_OPER) && this->nc->o->ot->modes.find(oper->mchar) != Anope::string::npos)
 					IRCD->SendOper(this);
 			}
 			if (IRCD->CanSetVHost && !this->nc->o->vhost.empty())
@@ -547,7 +572,7 @@ void User::SetModeInternal(const MessageSource &source, UserMode *um, const Anop
 		}
 	}
 
-	if (um->name == "CLOAK" || um->name == "VHOST")
+	if (id == UMODE_CLOAK || id == UMODE_VHOST)
 		this->UpdateHost();
 
 	FOREACH_MOD(OnUserModeSet, (source, this, um->name));
@@ -558,9 +583,21 @@ void User::RemoveModeInternal(const MessageSource &source, UserMode *um)
 	if (!um)
 		return;
 
-	this->modes.erase(um->name);
+	unsigned id = um->id != ModeManager::NO_MODE_ID ? um->id : ModeManager::GetUserModeID(um->name);
+	if (id < this->modes.size())
+	{
+		this->modes[id] = false;
+
+		for (unsigned i = 0; i < this->mode_params.size(); ++i)
+			if (this->mode_params[i].first == id)
+			{
+				this->mode_params.erase(this->mode_params.begin() + i);
+				break;
+			}
+	}
+	this->modes_view_dirty = true;
 
-	if (um->name == "OPER")
+	if (id == UMODE_OPER)
 	{
 		--OperCount;
 
@@ -568,7 +605,7 @@ void User::RemoveModeInternal(const MessageSource &source, UserMode *um)
 		this->super_admin = false;
 	}
 
-	if (um->name == "CLOAK" || um->name == "VHOST")
+	if (id == UMODE_CLOAK || id == UMODE_VHOST)
 	{
 		this->vhost.clear();
 		this->UpdateHost();
@@ -700,16 +737,23 @@ Anope::string User::GetModes() const
 {
 	Anope::string m, params;
 
-	for (ModeList::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+	for (unsigned id = 0; id < this->modes.size(); ++id)
 	{
-		UserMode *um = ModeManager::FindUserModeByName(it->first);
+		if (!this->modes[id])
+			continue;
+
+		UserMode *um = ModeManager::FindUserModeByID(id);
 		if (um == NULL)
 			continue;
 
 		m += um->mchar;
 
-		if (!it->second.empty())
-			params += " " + it->second;
+		for (unsigned i = 0; i < this->mode_params.size(); ++i)
+			if (this->mode_params[i].first == id)
+			{
+				params += " " + this->mode_params[i].second;
+				break;
+			}
 	}
 
 	return m + params;
@@ -717,7 +761,21 @@ Anope::string User::GetModes() const
 
 const User::ModeList &User::GetModeList() const
 {
-	return modes;
+	if (this->modes_view_dirty)
+	{
+		this->modes_view.clear();
+
+		for (unsigned id = 0; id < this->modes.size(); ++id)
+			if (this->modes[id])
+				this->modes_view[ModeManager::GetUserModeName(id)];
+
+		for (unsigned i = 0; i < this->mode_params.size(); ++i)
+			this->modes_view[ModeManager::GetUserModeName(this->mode_params[i].first)] = this->mode_params[i].second;
+
+		this->modes_view_dirty = false;
+	}
+
+	return this->modes_view;
 }
 
 ChanUserContainer *User::FindChannel(Channel *c) const
@@ -730,7 +788,7 @@ ChanUserContainer *User::FindChannel(Channel *c) const
 
 bool User::IsProtected()
 {
-	return this->HasMode("PROTECTED") || this->HasMode("GOD") || this->HasPriv("protected") || (this->server && this->server->IsULined());
+	return this->HasMode(UMODE_PROTECTED) || this->HasMode(UMODE_GOD) || this->HasPriv("protected") || (this->server && this->server->IsULined());
 }
 
 void User::Kill(const MessageSource &source, const Anope::string &reason)
@@ -765,6 +823,10 @@ void User::Quit(const Anope::string &reason)
 
 	this->quit = true;
 	quitting_users.push_back(this);
+
+	if (!quitUsersWork)
+		quitUsersWork = new QuitUsersWork();
+	quitUsersWork->Post();
 }
 
 bool User::Quitting() const
@@ -823,9 +885,9 @@ User* User::Find(const Anope::string &name, bool nick_only)
 {
 	if (!nick_only && IRCD && IRCD->RequiresID)
 	{
-		user_map::iterator it = UserListByUID.find(name);
-		if (it != UserListByUID.end())
-			return it->second;
+		User *u = UserListByUID.Find(name);
+		if (u)
+			return u;
 
 		if (IRCD->AmbiguousID)
 			return NULL;